@@ -1,59 +1,84 @@
 //////////////////////////////////////////////////////////////////////
-// SubgradientMethod.hpp
+// BundleMethod.hpp
 //
 // This file contains an implementation of the bundle
 // optimization algorithm.
 //////////////////////////////////////////////////////////////////////
+
 #ifndef BUNDLEMETHOD_HPP
 #define BUNDLEMETHOD_HPP
 
 #include <vector>
+#include <utility>
 #include "Utilities.hpp"
 
-#include "utilities/sml.hpp"
-#include "utilities/common.hpp"
-#include "utilities/timer.hpp"
-#include "utilities/configuration.hpp"
-#include "utilities/bmrmexception.hpp"
-#include "solver/bmrminnersolver/bmrminnersolver.hpp"
-#include "solver/bmrminnersolver/l2n2_daifletcherpgm.hpp"
-#include "solver/bmrminnersolver/l2n2_prloqo.hpp"
-#include <fstream>
-#include <sstream>
-using namespace std;
+//////////////////////////////////////////////////////////////////////
+// struct CuttingPlane
+//
+// Linear lower bound a'*w + b on the loss.  Subgradients of the
+// max-margin loss touch few parameters, so the slope is stored
+// sparsely as (index, value) pairs.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+struct CuttingPlane
+{
+    std::vector<std::pair<int,RealT> > a;
+    RealT b;
+    int last_active;
+};
 
 //////////////////////////////////////////////////////////////////////
 // BundleMethod()
 //
-// Implementation of bundle optimization routine.
+// Implementation of bundle optimization routine for objectives of
+// the form
+//
+//     0.5 * sum_i C[i] * w[i]^2 + loss(w)
+//
+// where loss(w) is convex but not necessarily smooth.  The
+// subclass returns loss(w) and one of its subgradients; the
+// regularizer is handled internally.
 //////////////////////////////////////////////////////////////////////
 
 template<class RealT>
 class BundleMethod
 {
-  const int   MAX_ITERATIONS;
-  double lambda;
+    const std::vector<RealT> regularization;
+    const int   MAX_ITERATIONS;
+    const int   MAX_BUNDLE_SIZE;
+    const RealT TOLERANCE;
+
+    std::vector<RealT> inverse_regularization;
+    std::vector<CuttingPlane<RealT> > planes;
+    std::vector<std::vector<RealT> > Q;
+    std::vector<RealT> alpha;
 
+    void AddPlane(const std::vector<RealT> &g, RealT b, int iteration);
+    void CompressBundle();
+    RealT SolveDual(int iteration);
+    void RecoverPrimal(std::vector<RealT> &x) const;
 
 public:
-    virtual ~BundleMethod() {}
-  BundleMethod
+    BundleMethod
     (
-        const int     MAX_ITERATIONS                 = 1000,          // maximum number of iterations to run subgradient method
-        const double  lambda                         = 1
+        const std::vector<RealT> &regularization,                     // regularization coefficients (all positive)
+        const int     MAX_ITERATIONS                 = 1000,          // maximum number of iterations to run bundle method
+        const int     MAX_BUNDLE_SIZE                = 50,            // maximum number of cutting planes kept
+        const RealT   TOLERANCE                      = RealT(1e-4)    // stop when best objective minus lower bound falls below this
     );
 
+    virtual ~BundleMethod() {}
+
     RealT Minimize(std::vector<RealT> &x0);
-    
+
     virtual RealT ComputeFunction(const std::vector<RealT> &x) = 0;
     virtual void ComputeSubgradient(std::vector<RealT> &g, const std::vector<RealT> &x) = 0;
     virtual void Report(int iteration, const std::vector<RealT> &x, RealT f, const std::vector<RealT> &g,
-                        RealT norm_bound, RealT step_size) = 0;
+                        RealT lower_bound, int bundle_size) = 0;
     virtual void Report(const std::string &s) = 0;
-
 };
 
 #include "BundleMethod.ipp"
 
 #endif
-
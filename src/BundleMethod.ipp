@@ -1,10 +1,24 @@
 //////////////////////////////////////////////////////////////////////
 // BundleMethod.ipp
 //
-// This file contains an implementation bundle method optimization 
-// algorithm
+// This file contains an implementation of the bundle method
+// optimization algorithm (BMRM).  At each iteration, the loss is
+// linearized at the current point and the new cutting plane is
+// added to the bundle; the next point minimizes the regularizer
+// plus the maximum over all cutting planes.  This inner problem is
+// solved in the dual, which is a small QP over the simplex:
+//
+//     max_alpha  b'*alpha - 0.5 * alpha'*Q*alpha
+//
+// where Q[i][j] = a_i' * diag(1/C) * a_j.  Q is grown by one row
+// per iteration, and the dual is warm-started from the previous
+// solution.  The optimal dual value is a lower bound on the
+// objective.
 //////////////////////////////////////////////////////////////////////
 
+const int BUNDLE_MAX_DUAL_STEPS = 10000;
+const double BUNDLE_DUAL_TOLERANCE = 1e-10;
+
 //////////////////////////////////////////////////////////////////////
 // BundleMethod::BundleMethod()
 //
@@ -14,282 +28,256 @@
 template<class RealT>
 BundleMethod<RealT>::BundleMethod
 (
-    const int     MAX_ITERATIONS,                     // maximum number of iterations to run subgradient method
-    const double lambda
+    const std::vector<RealT> &regularization,         // regularization coefficients (all positive)
+    const int     MAX_ITERATIONS,                     // maximum number of iterations to run bundle method
+    const int     MAX_BUNDLE_SIZE,                    // maximum number of cutting planes kept
+    const RealT   TOLERANCE                           // stop when best objective minus lower bound falls below this
 ) :
-  MAX_ITERATIONS(MAX_ITERATIONS),
-  lambda(lambda)
+    regularization(regularization),
+    MAX_ITERATIONS(MAX_ITERATIONS),
+    MAX_BUNDLE_SIZE(MAX_BUNDLE_SIZE),
+    TOLERANCE(TOLERANCE),
+    inverse_regularization(regularization.size())
 {
+    Assert(MAX_BUNDLE_SIZE >= 2, "Bundle must hold at least two cutting planes.");
+    for (size_t i = 0; i < regularization.size(); i++)
+    {
+        if (regularization[i] <= RealT(0)) Error("Bundle method requires positive regularization coefficients.");
+        inverse_regularization[i] = RealT(1) / regularization[i];
+    }
 }
 
-
 //////////////////////////////////////////////////////////////////////
-// BundleMethod::Minimize()
+// BundleMethod::AddPlane()
 //
-// Implementation of bundle methods for optimization
+// Add the cutting plane g'*w + b to the bundle, computing only the
+// new row of Q.  The new plane starts with zero dual weight, so the
+// previous dual solution remains feasible.
 //////////////////////////////////////////////////////////////////////
 
 template<class RealT>
-RealT BundleMethod<RealT>::Minimize(std::vector<RealT> &x)
+void BundleMethod<RealT>::AddPlane(const std::vector<RealT> &g, RealT b, int iteration)
 {
+    planes.push_back(CuttingPlane<RealT>());
+    CuttingPlane<RealT> &plane = planes.back();
+    plane.b = b;
+    plane.last_active = iteration;
+    for (size_t i = 0; i < g.size(); i++)
+        if (g[i] != RealT(0)) plane.a.push_back(std::make_pair(int(i), g[i]));
+
+    // scaled dense copy of the new slope
+
+    std::vector<RealT> scaled_g = inverse_regularization * g;
 
-  CBMRMInnerSolver* innerSolver;  // pointer to inner solver object 
-#ifdef DAIFLETCHER              
-  cout << "Using daifletcher as inner solver\n";
-  innerSolver = new CL2N2_DaiFletcherPGM(lambda);
-#else
-  cout << "Using loqo as inner solver\n";
-  innerSolver = new CL2N2_prLOQO(lambda);
-#endif
-  int verbosity        = 2;
-  int convergenceLog   = 0;
-  unsigned int maxNumOfIter     = 10000;
-  double epsilonTol       = 1e-4;
-  double gammaTol         = 0.0;
-  std::string checkpointPrefix = "model.checkpoint";
-  //unsigned int checkpointInterval = 1000000;  // no checkpoint by default
-  //unsigned int checkpointMode = 2;
-
-  std::vector<RealT> g;
-  ComputeSubgradient(g, x);
-  RealT f = ComputeFunction(x);
-  
-
-  /* Start from here */
-  Scalar temp;
-  /* Copy g to the matrix format */
-  const int col = g.size();
-  const int row = 1;
-  TheMatrix a(row, col, SML::DENSE);   // gradient vector                                                                         
-  TheMatrix w(row, col, SML::DENSE);   // weight vector                                                                         
-  TheMatrix w_best(row, col, SML::DENSE);   // best weight vector                                                                         
-  a.Zero();
-  w.Zero();
-  w_best.Zero();
-  /*for (int i=0;i<col; i++){
-    x[i] = i;
-    }*/
-  for (int i=0;i<col; i++){
-    w.Set(i, x[i]);
-  }
-
-  /*cout <<"print X init\n";
-  for (int i=0;i<col; i++){
-    cout << x[i] << " ";
-  }
-  cout << "\n";
-  cout <<"print W init\n";
-  for (int i=0;i<col; i++){
-    w.Get(i, temp);
-    cout << temp << " ";
-  }
-  cout << "\n";*/
-
-  // Timers (CPU and wall-clock)
-  CTimer totalTime;             // total runtime of the training
-  CTimer innerSolverTime;       // time for inner optimization (e.g., QP or LP)
-  CTimer lossAndGradientTime;   // time for loss and gradient computation
-  
-  unsigned int iter = 0;              // iteration count
-  Scalar loss = 0.0;            // loss function value        
-  Scalar exactObjVal = 0.0;           // (exact) objective function value
-  Scalar approxObjVal = -SML::INFTY;    // convex lower-bound (approximate) of objective function value
-  Scalar minExactObjVal = SML::INFTY; // minimum of all previously evaluated (exact) objective function value
-  Scalar regVal = 0.0;          // value of the regularizer term e.g., 0.5*w'*w
-  Scalar epsilon = 0.0;         // (duality) gap := exactObjVal - approxObjVal
-  Scalar gamma = 0.0;           // := minExactObjVal - approxObjVal
-  double innerSolverTol = 1.0;  // optimization tolerance for inner solver
-  
-  ofstream lossFp;              // keep loss values
-  ofstream exactObjValFp;       // keep exactObjVal values
-  ofstream approxObjValFp;      // keep approxObjVal values
-  ofstream regValFp;            // keep regVal values
-  ofstream epsilonFp;           // keep epsilon values
-  ofstream gammaFp;             // keep gamma values
-  
-  // convergence log files
-  if(convergenceLog) 
+    const int k = int(planes.size()) - 1;
+    std::vector<RealT> row(k+1);
+    for (int j = 0; j <= k; j++)
     {
-      lossFp.open("loss.dump");    
-      exactObjValFp.open("exactobj.dump");
-      approxObjValFp.open("approxobj.dump");
-      regValFp.open("regval.dump");
-      epsilonFp.open("epsilon.dump");
-      gammaFp.open("gamma.dump");	
+        RealT sum = RealT(0);
+        for (size_t p = 0; p < planes[j].a.size(); p++)
+            sum += planes[j].a[p].second * scaled_g[planes[j].a[p].first];
+        row[j] = sum;
     }
-  
-  // start training
-  totalTime.Start();
-  while(1)
+
+    for (int j = 0; j < k; j++)
+        Q[j].push_back(row[j]);
+    Q.push_back(row);
+    alpha.push_back(k == 0 ? RealT(1) : RealT(0));
+}
+
+//////////////////////////////////////////////////////////////////////
+// BundleMethod::CompressBundle()
+//
+// Make room for a new cutting plane.  Planes with zero dual weight
+// are dropped, least recently active first.  If every plane is
+// active, the bundle is replaced by their convex combination under
+// the current dual weights; this aggregate plane is still a lower
+// bound on the loss and preserves the current dual solution.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void BundleMethod<RealT>::CompressBundle()
+{
+    while (int(planes.size()) >= MAX_BUNDLE_SIZE)
     {
-      /*if (iter > 1)
-	return f;*/
-      iter++;
-      // column generation
-      lossAndGradientTime.Start();      
-      for (int i=0;i<col; i++){
-	w.Get(i, temp);
-	x[i] = temp;
-	a.Get(i, temp);
-	g[i] = temp;
-      }
-      /*cout << "col = "<< col <<"\n";
-      cout << "lambda = " << lambda << "\n";
-      cout << " X == W " << "\n";
-      cout <<"print X, iter = " << iter << "\n";
-      for (int i=0;i<col; i++){
-	cout << x[i] << " ";
-      }
-      cout << "\n";
-      cout <<"print W, iter = "<< iter <<"\n";
-      for (int i=0;i<col; i++){
-	w.Get(i, temp);
-	cout << temp << " ";
-      }
-      cout << "\n";*/
-
-      ComputeSubgradient(g, x);
-      RealT f = ComputeFunction(x);
-      loss = f;
-      
-      for (int i=0;i<col; i++){
-	temp = g[i];
-	a.Set(i, temp);
-      }
-      /*cout << " f == loss " << "\n";
-      cout << " A == G " << "\n";
-      cout << "f = " << f << "\n";
-      cout << "loss = "<< loss << "\n";
-      cout << "print G iter = "<< iter <<" \n";
-      for (int i=0;i<col; i++){
-	cout << g[i] << " " ;
-      }
-      cout << "\n";
-      cout << "print A iter = " << iter <<"\n";
-      for (int i=0;i<col; i++){
-	a.Get(i, temp);
-	cout << temp << " " ;
-      }
-      cout << "\n";*/
-      //cout << "Finish copying\n";
-      lossAndGradientTime.Stop();
-      
-      // update convergence monitor
-      regVal = innerSolver->ComputeRegularizerValue(w);
-      exactObjVal = loss + regVal;
-      //minExactObjVal = std::min(minExactObjVal,exactObjVal);
-      if (minExactObjVal > exactObjVal){
-	w_best.Assign(w);
-	minExactObjVal = exactObjVal;
-      }
-      epsilon = exactObjVal - approxObjVal;
-      gamma = minExactObjVal - approxObjVal;
-      
-      // dump convergence statistics into files
-      if(convergenceLog) 
-	{
-	  lossFp         << loss         << endl;
-	  //xiFp           << xi           << endl;
-	  exactObjValFp  << exactObjVal  << endl;   
-	  approxObjValFp << approxObjVal << endl;
-	  regValFp       << regVal       << endl;    
-	  epsilonFp      << epsilon      << endl;
-	  gammaFp        << gamma        << endl;
-	}
-      
-      // dump convergence statistics on stdout
-      if(verbosity < 1) 
-	{
-	  printf(".");
-	  if(iter%100 == 0) 
-	    printf("%d",iter);
-	  fflush(stdout);
-	}
-      else if(verbosity == 1)
-	printf("#%d   eps %.6e   loss %.6e   reg %.6e\n",iter, epsilon, loss, regVal);      
-      else if(verbosity > 1)
-	printf("#%d   f %.6e pobj %.6e   aobj %.6e   eps %.6e   gam %.6e   loss %.6e    reg %.6e\n", iter, minExactObjVal, exactObjVal, approxObjVal, epsilon, gamma, loss, regVal);   
-      
-      // stopping criteria
-      if((iter >= 2) && ((gamma < gammaTol) || (epsilon < epsilonTol)))
-	{
-	  break;
-	}
-      if(iter >= maxNumOfIter)
-	{ 
-	  printf("\nWARNING: program exceeded maximum number of iterations (%d) !\n", maxNumOfIter);
-	  break;
-	}
-      
-      // adjust inner solver optimization tolerance
-      innerSolverTol = std::min(innerSolverTol, std::max((double)epsilon, (double)epsilonTol));
-      innerSolverTol = std::min(innerSolverTol, std::max((double)gamma, (double)gammaTol));
-      innerSolver->SetTolerance(innerSolverTol*0.5);        
-			
-      innerSolverTime.Start();
-      //innerSolver->Solve(w, a, loss, xi, regVal, approxObjVal);
-      innerSolver->Solve(w, a, loss, approxObjVal);
-      innerSolverTime.Stop();
+        int oldest = -1;
+        for (size_t i = 0; i < planes.size(); i++)
+            if (alpha[i] == RealT(0) && (oldest == -1 || planes[i].last_active < planes[oldest].last_active))
+                oldest = int(i);
+        if (oldest == -1) break;
+
+        planes.erase(planes.begin() + oldest);
+        alpha.erase(alpha.begin() + oldest);
+        Q.erase(Q.begin() + oldest);
+        for (size_t i = 0; i < Q.size(); i++)
+            Q[i].erase(Q[i].begin() + oldest);
+    }
+
+    if (int(planes.size()) < MAX_BUNDLE_SIZE) return;
+
+    std::vector<RealT> a(regularization.size());
+    RealT b = RealT(0);
+    int last_active = 0;
+    for (size_t i = 0; i < planes.size(); i++)
+    {
+        for (size_t p = 0; p < planes[i].a.size(); p++)
+            a[planes[i].a[p].first] += alpha[i] * planes[i].a[p].second;
+        b += alpha[i] * planes[i].b;
+        last_active = std::max(last_active, planes[i].last_active);
     }
-  
-  // legends
-  if(verbosity >= 1) 
+
+    planes.clear();
+    Q.clear();
+    alpha.clear();
+    AddPlane(a, b, last_active);
+}
+
+//////////////////////////////////////////////////////////////////////
+// BundleMethod::SolveDual()
+//
+// Maximize the dual over the simplex by pairwise (SMO-style)
+// updates: weight is moved from the active plane with the smallest
+// dual gradient to the plane with the largest, until the two agree.
+// Returns the dual objective value.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+RealT BundleMethod<RealT>::SolveDual(int iteration)
+{
+    const int k = int(planes.size());
+
+    std::vector<RealT> Q_alpha(k);
+    for (int i = 0; i < k; i++)
+        for (int j = 0; j < k; j++)
+            Q_alpha[i] += Q[i][j] * alpha[j];
+
+    for (int step = 0; step < BUNDLE_MAX_DUAL_STEPS; step++)
     {
-      printf("\nLegends::\n");
-      if(verbosity > 1)
-	printf("pobj: primal objective function value\naobj: approximate objective function value\n");
-      //printf("eps: epsilon (approximation error) \ngam: lower bound on eps \nloss: loss function value \nxi: approximation to loss \nreg: regularizer value\n");
-      printf("eps: epsilon (approximation error) \ngam: lower bound on eps \nloss: loss function value \nreg: regularizer value\n");
+        int up = -1, down = -1;
+        for (int i = 0; i < k; i++)
+        {
+            const RealT gradient = planes[i].b - Q_alpha[i];
+            if (up == -1 || gradient > planes[up].b - Q_alpha[up]) up = i;
+            if (alpha[i] > RealT(0) && (down == -1 || gradient < planes[down].b - Q_alpha[down])) down = i;
+        }
+
+        const RealT difference = (planes[up].b - Q_alpha[up]) - (planes[down].b - Q_alpha[down]);
+        if (up == down || difference <= RealT(BUNDLE_DUAL_TOLERANCE)) break;
+
+        const RealT curvature = Q[up][up] + Q[down][down] - RealT(2) * Q[up][down];
+        RealT delta = alpha[down];
+        if (curvature > RealT(0)) delta = std::min(delta, difference / curvature);
+
+        alpha[up] += delta;
+        alpha[down] -= delta;
+        if (alpha[down] <= RealT(0)) alpha[down] = RealT(0);
+        for (int i = 0; i < k; i++)
+            Q_alpha[i] += delta * (Q[i][up] - Q[i][down]);
     }
-  
-  w.Assign(w_best);
-  Scalar norm1 = 0, norm2 = 0, norminf = 0;
-  w.Norm1(norm1);
-  w.Norm2(norm2);
-  w.NormInf(norminf);
-  printf("\n");
-  printf("No. of iterations:  %d\n",iter);
-  printf("Primal obj. val.: %.6e\n",exactObjVal);
-  printf("Approx obj. val.: %.6e\n",approxObjVal);
-  printf("Primal - Approx.: %.6e\n",exactObjVal-approxObjVal);
-  printf("Loss:             %.6e\n",loss);
-  printf("|w|_1:            %.6e\n",norm1);
-  printf("|w|_2:            %.6e\n",norm2);
-  printf("|w|_oo:           %.6e\n",norminf);
-  
-  totalTime.Stop();
-  // end of training
-  
-  // display timing profile
-  printf("\nCPU seconds in:\n");
-  printf("1. loss and gradient: %8.2f\n", lossAndGradientTime.CPUTotal());
-  printf("2. solver:            %8.2f\n", innerSolverTime.CPUTotal()); 
-  printf("               Total: %8.2f\n", totalTime.CPUTotal());
-  
-  // clean up
-  if(convergenceLog)
+
+    RealT value = RealT(0);
+    for (int i = 0; i < k; i++)
     {
-      lossFp.close();
-      //xiFp.close();
-      exactObjValFp.close();
-      approxObjValFp.close();
-      regValFp.close();
-      epsilonFp.close();
-      gammaFp.close();
-    }   
-  //cout << "Start copying\n";
-  f = minExactObjVal;
-  for (int i=1;i<col; i++){
-    w_best.Get(i, temp);
-    x[i] = temp;
-  }
-  /*cout <<"X\n";
-    for (int i=1;i<col; i++){
-    cout << x[i] << " ";
+        value += alpha[i] * (planes[i].b - RealT(0.5) * Q_alpha[i]);
+        if (alpha[i] > RealT(0)) planes[i].last_active = iteration;
     }
-    cout <<"\n";*/
-  //cout << "Finish copying\n";
+    return value;
+}
+
+//////////////////////////////////////////////////////////////////////
+// BundleMethod::RecoverPrimal()
+//
+// Primal solution of the inner problem, w = -diag(1/C) * sum_i
+// alpha[i] * a_i.
+//////////////////////////////////////////////////////////////////////
 
-  return f;
+template<class RealT>
+void BundleMethod<RealT>::RecoverPrimal(std::vector<RealT> &x) const
+{
+    std::fill(x.begin(), x.end(), RealT(0));
+    for (size_t i = 0; i < planes.size(); i++)
+    {
+        if (alpha[i] == RealT(0)) continue;
+        for (size_t p = 0; p < planes[i].a.size(); p++)
+            x[planes[i].a[p].first] -= alpha[i] * planes[i].a[p].second;
+    }
+    x *= inverse_regularization;
 }
 
+//////////////////////////////////////////////////////////////////////
+// BundleMethod::Minimize()
+//
+// Implementation of bundle methods for optimization.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+RealT BundleMethod<RealT>::Minimize(std::vector<RealT> &x)
+{
+    Assert(x.size() == regularization.size(), "Parameter vector size does not match regularization.");
+
+    planes.clear();
+    Q.clear();
+    alpha.clear();
+
+    std::vector<RealT> g;
+    std::vector<RealT> best_x = x;
+    std::vector<RealT> best_g;
+    RealT best_f = RealT(1e20);
+    RealT lower_bound = -RealT(1e20);
+
+    for (int iteration = 1; iteration <= MAX_ITERATIONS; iteration++)
+    {
+        // linearize loss at current point
+
+        ComputeSubgradient(g, x);
+        const RealT loss = ComputeFunction(x);
+        const RealT f = loss + RealT(0.5) * DotProduct(regularization, x*x);
+
+        if (f >= RealT(1e20))
+        {
+            Report(SPrintF("Termination before optimization: function value too big (%lf > %lf)", double(f), 1e20));
+            break;
+        }
+
+        // keep track of best parameter vector
+
+        if (f < best_f)
+        {
+            best_f = f;
+            best_x = x;
+            best_g = g + regularization * x;
+        }
+
+        // solve for next point
+
+        if (int(planes.size()) >= MAX_BUNDLE_SIZE) CompressBundle();
+        AddPlane(g, loss - DotProduct(g, x), iteration);
+        lower_bound = std::max(lower_bound, SolveDual(iteration));
+        RecoverPrimal(x);
+
+        // print updates
+
+        const int update_frequency = std::max(1, MAX_ITERATIONS / 100);
+        if (iteration % update_frequency == 0)
+        {
+            Report(iteration, best_x, best_f, best_g, lower_bound, int(planes.size()));
+        }
+
+        // check convergence criteria
+
+        if (best_f - lower_bound < TOLERANCE)
+        {
+            Report(SPrintF("Termination condition: duality gap %lf below tolerance after %d iterations", double(best_f - lower_bound), iteration));
+            break;
+        }
+
+        if (iteration >= MAX_ITERATIONS)
+        {
+            Report("Termination condition: maximum number of iterations reached");
+            break;
+        }
+    }
+
+    x = best_x;
+    return best_f;
+}
@@ -16,6 +16,9 @@
 //
 // Implementation of conjugate gradient for solving linear
 // systems Ax = b, where A is symmetric positive definite.
+// Subclasses may override ApplyPreconditioner() to supply an
+// approximation M^{-1} of the inverse of A; by default, no
+// preconditioning is done.
 //////////////////////////////////////////////////////////////////////
 
 template<class Real>
@@ -28,12 +31,14 @@ public:
         
         const int    MAX_ITERATIONS              = 1000,         // maximum number of iterations to run CG
         const Real   SMALL_STEP_RATIO            = 0.001,        // ratio beneath which steps are considered "small"
-        const int    MAX_SMALL_STEPS             = 5             // maximum number of small steps before we quit
+        const int    MAX_SMALL_STEPS             = 5,            // maximum number of small steps before we quit
+        const Real   RESIDUAL_RATIO              = 0.001         // relative residual |b - Ax| / |b| beneath which we quit
     );
 
     virtual ~CGLinear() {}
 
     virtual void ComputeAx(std::vector<double> &Ax, const std::vector<double> &x) = 0;
+    virtual void ApplyPreconditioner(std::vector<double> &z, const std::vector<double> &r) { z = r; }
     virtual void Report(int iteration, const std::vector<double> &x, double f, double step_size) = 0;
     virtual void Report(const std::string &s) = 0;
 };
@@ -8,8 +8,9 @@
 //////////////////////////////////////////////////////////////////////
 // CGLinear()
 //
-// Implementation of conjugate gradient for solving linear
-// systems Ax = b, where A is symmetric positive definite.
+// Implementation of preconditioned conjugate gradient for
+// solving linear systems Ax = b, where A is symmetric positive
+// definite.
 //////////////////////////////////////////////////////////////////////
 
 template<class Real>
@@ -20,19 +21,24 @@ Real CGLinear<Real>::Minimize
      
      const int    MAX_ITERATIONS,                             // maximum number of iterations to run CG
      const Real   SMALL_STEP_RATIO,                           // ratio beneath which steps are considered "small"
-     const int    MAX_SMALL_STEPS                             // maximum number of small steps before we quit
+     const int    MAX_SMALL_STEPS,                            // maximum number of small steps before we quit
+     const Real   RESIDUAL_RATIO                              // relative residual |b - Ax| / |b| beneath which we quit
 )
 {
     std::vector<Real> Ax;
     ComputeAx(Ax, x);
     std::vector<Real> r = b - Ax;
-    std::vector<Real> d = r;
+    std::vector<Real> z;
+    ApplyPreconditioner(z, r);
+    std::vector<Real> d = z;
     Real rTr = DotProduct(r,r);
+    Real rTz = DotProduct(r,z);
     Real f = DotProduct(x, 0.5 * Ax - b);
     
     Real best_f = f;
     std::vector<Real> best_x = x;
     Real best_rTr = rTr;
+    const Real bTb = DotProduct(b,b);
     
     int num_consecutive_small_steps = 0;
     bool progress_made = false;
@@ -47,7 +53,7 @@ Real CGLinear<Real>::Minimize
         
         std::vector<Real> Ad;
         ComputeAx(Ad, d);
-        Real alpha = rTr / DotProduct(d,Ad);
+        Real alpha = rTz / DotProduct(d,Ad);
         
         // update x and r
         
@@ -68,9 +74,11 @@ Real CGLinear<Real>::Minimize
         
         // update direction
         
-        Real rpTrp = rTr;
+        ApplyPreconditioner(z, r);
+        Real rpTzp = rTz;
         rTr = DotProduct(r,r);
-        d = r + (rTr / rpTrp) * d;
+        rTz = DotProduct(r,z);
+        d = z + (rTz / rpTzp) * d;
         
         // update function value
         
@@ -96,11 +104,19 @@ Real CGLinear<Real>::Minimize
             best_rTr = rTr;
         }
         
+        // stop once the residual is small
+
+        if (rTr <= RESIDUAL_RATIO * RESIDUAL_RATIO * bTb)
+        {
+            Report("Termination: Residual below tolerance");
+            break;
+        }
+
         // prevent increasing steps
 
         if (DotProduct(d, r) < 0)
         {
-            d = r;
+            d = z;
         }
         
         // if we're making slow progress
@@ -115,7 +131,7 @@ Real CGLinear<Real>::Minimize
                 progress_made = false;
                 num_consecutive_small_steps = 0;
                 Report("Restart: Too many consecutive small steps");
-                d = r;
+                d = z;
             }
             else
             {
@@ -126,6 +142,6 @@ Real CGLinear<Real>::Minimize
     }
 
     x = best_x;
-    return Sqrt(best_rTr / DotProduct(b,b));
+    return Sqrt(best_rTr / bTb);
 }
 
@@ -24,6 +24,7 @@ class CGOptimizationWrapper : public CGLinear<RealT>
     const std::vector<int> units;
     const std::vector<RealT> w;
     const std::vector<RealT> C;
+    std::vector<RealT> inverse_diagonal;
     
 public:
     CGOptimizationWrapper(OptimizationWrapper<RealT> *optimizer,
@@ -32,6 +33,7 @@ public:
                           const std::vector<RealT> &C);
     
     void ComputeAx(std::vector<RealT> &Ax, const std::vector<RealT> &x);
+    void ApplyPreconditioner(std::vector<RealT> &z, const std::vector<RealT> &r);
     void Report(int iteration, const std::vector<RealT> &x, RealT f, RealT step_size);
     void Report(const std::string &s);
 };
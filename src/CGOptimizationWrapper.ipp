@@ -9,16 +9,25 @@
 //////////////////////////////////////////////////////////////////////
 // CGOptimizationWrapper<RealT>::CGOptimizationWrapper()
 //
-// Constructor.
+// Constructor.  Estimates the diagonal of the Hessian (one
+// inside/outside pass) when preconditioning is enabled.
 //////////////////////////////////////////////////////////////////////
 
 template<class RealT>
 CGOptimizationWrapper<RealT>::CGOptimizationWrapper(OptimizationWrapper<RealT> *optimization_wrapper,
                                                     const std::vector<int> &units,
-                                             const std::vector<RealT> &w,
+                                                    const std::vector<RealT> &w,
                                                     const std::vector<RealT> &C) :
     CGLinear<RealT>(), optimization_wrapper(optimization_wrapper), units(units), w(w), C(C)
-{}
+{
+#if CG_DIAGONAL_PRECONDITIONER
+    std::vector<RealT> Ce = optimization_wrapper->GetParameterManager().ExpandParameterGroupValues(C);
+    std::vector<RealT> diagonal = optimization_wrapper->GetComputationWrapper().ComputeHessianDiagonal(units, w, true, optimization_wrapper->GetOptions().GetRealValue("log_base")) + Ce;
+    inverse_diagonal.resize(diagonal.size());
+    for (size_t i = 0; i < diagonal.size(); i++)
+        inverse_diagonal[i] = (diagonal[i] > RealT(0) ? RealT(1) / diagonal[i] : RealT(1));
+#endif
+}
 
 //////////////////////////////////////////////////////////////////////
 // CGOptimizationWrapper<RealT>::ComputeAx()
@@ -33,6 +42,22 @@ void CGOptimizationWrapper<RealT>::ComputeAx(std::vector<RealT> &Ax, const std::
     Ax = optimization_wrapper->GetComputationWrapper().ComputeHessianVectorProduct(units, w, x, true, optimization_wrapper->GetOptions().GetRealValue("log_base")) + Ce * x;
 }
 
+//////////////////////////////////////////////////////////////////////
+// CGOptimizationWrapper<RealT>::ApplyPreconditioner()
+//
+// Scale the residual by the inverse of the estimated Hessian
+// diagonal.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void CGOptimizationWrapper<RealT>::ApplyPreconditioner(std::vector<RealT> &z, const std::vector<RealT> &r)
+{
+    if (inverse_diagonal.empty())
+        z = r;
+    else
+        z = inverse_diagonal * r;
+}
+
 //////////////////////////////////////////////////////////////////////
 // CGOptimizationWrapper<RealT>::Report()
 //
@@ -47,6 +47,12 @@ struct SharedInfo
     int areZeros;
 
     RealT hyperparam_data;
+
+    bool update_working_set;
+    bool use_working_set;
+
+    // trial step lengths along direction v (see ComputeFunctionAlongDirection)
+    RealT steps[MAX_LINE_SEARCH_WIDTH];
 };
 
 //////////////////////////////////////////////////////////////////////
@@ -76,12 +82,67 @@ enum ProcessingType
     COMPUTE_GRADIENT_SE,
     CHECK_ZEROS_IN_DATA,
     COMPUTE_HV,
+    COMPUTE_HESSIAN_DIAGONAL,
+    COMPUTE_FUNCTION_ALONG_DIRECTION,
+    COMPUTE_EXAMPLE_GRADIENT_SE,
+    COMPUTE_GRADIENT_WITH_HOLDOUT_SE,
+    COMPUTE_EXAMPLE_STATISTICS_SE,
     PREDICT
 };
 
 struct NonSharedInfo
 {
     int index;
+    int step;
+    bool holdout;
+};
+
+//////////////////////////////////////////////////////////////////////
+// struct WorkingSet
+//
+// Violating structures found by loss-augmented inference for a
+// single training example during max-margin training, together with
+// their (sparse) feature counts and losses, and the feature counts of
+// the true structure.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+struct WorkingSet
+{
+    bool initialized;
+    std::vector<std::pair<int,RealT> > true_counts;
+    std::vector<std::vector<int> > mappings;
+    std::vector<std::vector<std::pair<int,RealT> > > counts;
+    std::vector<RealT> losses;
+    std::vector<int> last_used;
+
+    WorkingSet() : initialized(false) {}
+};
+
+//////////////////////////////////////////////////////////////////////
+// struct InferencePlan
+//
+// Inference mode chosen for a single sequence under a time or memory
+// budget (--timebudget, --memorybudget), together with its estimated
+// cost.
+//////////////////////////////////////////////////////////////////////
+
+enum InferenceMode
+{
+    INFERENCE_EXACT,
+    INFERENCE_SPAN_LIMITED,
+    INFERENCE_BEAM_PRUNED,
+    NUM_INFERENCE_MODES
+};
+
+struct InferencePlan
+{
+    InferenceMode mode;
+    int max_span;
+    int beam_width;
+    double seconds;
+    double megabytes;
+    bool within_budget;
 };
 
 //////////////////////////////////////////////////////////////////////
@@ -98,6 +159,31 @@ class ComputationEngine : public DistributedComputation<RealT, SharedInfo<RealT>
     InferenceEngine<RealT> &inference_engine;
     ParameterManager<RealT> &parameter_manager;
 
+    // working sets for max-margin training, indexed by work unit
+    std::vector<WorkingSet<RealT> > working_sets;
+    int working_set_clock;
+
+    bool ComputeFunctionAndGradientFromWorkingSet(std::vector<RealT> &result, const SharedInfo<RealT> &shared, const NonSharedInfo &nonshared, bool need_gradient);
+    void UpdateWorkingSet(int index, const std::vector<int> &mapping, const std::vector<RealT> &counts, const std::vector<RealT> &true_counts);
+
+    // parameter sets for ensemble prediction (several --params files),
+    // empty if not in use
+    std::vector<std::vector<RealT> > ensemble_values;
+
+    void PredictEnsemble(const SharedInfo<RealT> &shared, const NonSharedInfo &nonshared);
+    void WriteExpectedAccuracy(const SStruct &solution, const std::string &input_filename, const RealT gamma);
+    void WritePrediction(const SStruct &solution, const std::string &input_filename, const RealT gamma, const std::string &suffix);
+
+    // cost model for budgeted prediction; budget_speed[mode] scales the
+    // estimated running time by the throughput measured so far
+    double budget_speed[NUM_INFERENCE_MODES];
+
+    double EstimateSeconds(const InferenceMode mode, const int L, const int width) const;
+    double EstimateMegabytes(const InferenceMode mode, const int L, const int width) const;
+    InferencePlan PlanInference(const int L) const;
+    void ReportInferencePlan(const InferencePlan &plan, const std::string &input_filename, const int L) const;
+    void UpdateInferenceSpeed(const InferencePlan &plan, const double seconds);
+
     std::string MakeOutputFilename(const std::string &input_filename,
                                    const std::string &output_destination,
                                    const bool cross_validation,
@@ -124,6 +210,11 @@ public:
     void ComputeMStepFunctionAndGradient(std::vector<RealT> &result, const SharedInfo<RealT> &shared, const NonSharedInfo &nonshared, bool need_gradient);
     void ComputeGammaMLEFunctionAndGradient(std::vector<RealT> &result, const SharedInfo<RealT> &shared, const NonSharedInfo &nonshared, bool need_gradient);
     void ComputeHessianVectorProduct(std::vector<RealT> &result, const SharedInfo<RealT> &shared, const NonSharedInfo &nonshared);
+    void ComputeHessianDiagonal(std::vector<RealT> &result, const SharedInfo<RealT> &shared, const NonSharedInfo &nonshared);
+    void ComputeFunctionAlongDirection(std::vector<RealT> &result, const SharedInfo<RealT> &shared, const NonSharedInfo &nonshared);
+    void ComputeExampleGradientSE(std::vector<RealT> &result, const SharedInfo<RealT> &shared, const NonSharedInfo &nonshared);
+    void ComputeGradientWithHoldoutSE(std::vector<RealT> &result, const SharedInfo<RealT> &shared, const NonSharedInfo &nonshared);
+    void ComputeExampleStatisticsSE(std::vector<RealT> &result, const SharedInfo<RealT> &shared, const NonSharedInfo &nonshared);
     void Predict(std::vector<RealT> &result, const SharedInfo<RealT> &shared, const NonSharedInfo &nonshared);
     void CheckZerosInData(std::vector<RealT> &result, const SharedInfo<RealT> &shared, const NonSharedInfo &nonshared);
     void ComputeGammaMLEScalingFactor(std::vector<RealT> &result, const SharedInfo<RealT> &shared, const NonSharedInfo &nonshared);
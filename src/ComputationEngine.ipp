@@ -20,8 +20,33 @@ ComputationEngine<RealT>::ComputationEngine(const Options &options,
     options(options),
     descriptions(descriptions),
     inference_engine(inference_engine),
-    parameter_manager(parameter_manager)
-{ }
+    parameter_manager(parameter_manager),
+    working_set_clock(0)
+{
+    // keep each node's dynamic programming matrices on its own NUMA
+    // node: matrices are first touched by the node that uses them, so
+    // pinning before any inference suffices
+    if (options.GetBoolValue("pin_cores"))
+    {
+#ifdef MULTI
+        if (!PinToCore(this->GetNodeID())) Warning("Unable to pin node %d to a core.", this->GetNodeID());
+#else
+        if (!PinToCore(-1)) Warning("Unable to pin process to a core.");
+#endif
+    }
+    inference_engine.UseHugePages(options.GetBoolValue("use_huge_pages"));
+    inference_engine.UseMaxSpan(options.GetIntValue("max_span"));
+    std::fill(budget_speed, budget_speed + NUM_INFERENCE_MODES, 1.0);
+
+    // every node reads the ensemble's parameter files itself, as the
+    // shared information only has room for a single parameter set
+    if (options.GetIntValue("num_parameter_files") > 1)
+    {
+        ensemble_values.resize(options.GetIntValue("num_parameter_files"));
+        for (size_t k = 0; k < ensemble_values.size(); k++)
+            parameter_manager.ReadFromFile(options.GetStringValue(SPrintF("parameter_filename_%d", int(k))), ensemble_values[k]);
+    }
+}
 
 template<class RealT>
 ComputationEngine<RealT>::~ComputationEngine()
@@ -86,6 +111,21 @@ void ComputationEngine<RealT>::DoComputation(std::vector<RealT> &result,
         case COMPUTE_HV:
             ComputeHessianVectorProduct(result, shared, nonshared);
             break;
+        case COMPUTE_HESSIAN_DIAGONAL:
+            ComputeHessianDiagonal(result, shared, nonshared);
+            break;
+        case COMPUTE_FUNCTION_ALONG_DIRECTION:
+            ComputeFunctionAlongDirection(result, shared, nonshared);
+            break;
+        case COMPUTE_EXAMPLE_GRADIENT_SE:
+            ComputeExampleGradientSE(result, shared, nonshared);
+            break;
+        case COMPUTE_GRADIENT_WITH_HOLDOUT_SE:
+            ComputeGradientWithHoldoutSE(result, shared, nonshared);
+            break;
+        case COMPUTE_EXAMPLE_STATISTICS_SE:
+            ComputeExampleStatisticsSE(result, shared, nonshared);
+            break;
         case PREDICT:
             Predict(result, shared, nonshared);
             break;
@@ -98,9 +138,8 @@ void ComputationEngine<RealT>::DoComputation(std::vector<RealT> &result,
 //////////////////////////////////////////////////////////////////////
 // ComputationEngine::CheckParsability()
 //
-// Check to see if a sequence is parsable or not.  Return a
-// vector with a "0" in the appropriate spot indicating that a
-// file is not parsable.
+// Check to see if a sequence is parsable or not.  Report a keyed
+// result of "0" under the unit index if the file is not parsable.
 //////////////////////////////////////////////////////////////////////
 
 template <class RealT>
@@ -122,8 +161,7 @@ void ComputationEngine<RealT>::CheckParsability(std::vector<RealT> &result,
 
     // check for bad parse
     result.clear();
-    result.resize(descriptions.size());
-    result[nonshared.index] = (conditional_score < RealT(NEG_INF/2) ? 0 : 1);
+    this->AddKeyedResult(nonshared.index, std::vector<RealT>(1, conditional_score < RealT(NEG_INF/2) ? RealT(0) : RealT(1)));
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -165,19 +203,15 @@ void ComputationEngine<RealT>::ComputeSolutionNormBound(std::vector<RealT> &resu
     max_loss += inference_engine.GetViterbiScore();
 #endif
 
-    result.clear();
-    result.resize(descriptions.size());
-    result[nonshared.index] = max_entropy / shared.log_base + max_loss;
-
-    result *= RealT(descriptions[nonshared.index].weight);
+    // only the sum over examples is needed
+    result.assign(1, RealT(descriptions[nonshared.index].weight) * (max_entropy / shared.log_base + max_loss));
 }
 
 //////////////////////////////////////////////////////////////////////
 // ComputationEngine::ComputeGradientNormBound()
 //
 // Compute the max L1 norm for the features of an example.
-// Return a vector with this value in the appropriate spot for
-// this example.
+// Return a single-entry vector, to be summed over examples.
 //////////////////////////////////////////////////////////////////////
 
 template<class RealT>
@@ -197,9 +231,7 @@ void ComputationEngine<RealT>::ComputeGradientNormBound(std::vector<RealT> &resu
     inference_engine.ComputeViterbi();
     const RealT max_L1_norm = inference_engine.GetViterbiScore();
 
-    result.clear();
-    result.resize(descriptions.size());
-    result[nonshared.index] = max_L1_norm;
+    result.assign(1, max_L1_norm);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -223,36 +255,28 @@ void ComputationEngine<RealT>::ComputeLoss(std::vector<RealT> &result,
     inference_engine.UpdateEvidenceStructures();
 
     // perform inference
-    SStruct *solution;
+    std::vector<int> solution;
     if (options.GetBoolValue("viterbi_parsing"))
     {
         inference_engine.ComputeViterbi();
-        solution = new SStruct(sstruct);
-        solution->SetMapping(inference_engine.PredictPairingsViterbi());
+        solution = inference_engine.PredictPairingsViterbi();
     }
     else
     {
         inference_engine.ComputeInside();
         inference_engine.ComputeOutside();
         inference_engine.ComputePosterior();
-        solution = new SStruct(sstruct);
-        solution->SetMapping(inference_engine.PredictPairingsPosterior(shared.gamma));
+        solution = inference_engine.PredictPairingsPosterior(shared.gamma);
     }
 
     // compute loss
     if (!shared.use_loss) Error("Must be using loss function in order to compute loss.");
+    result.clear();
 #if defined(HAMMING_LOSS)
-    inference_engine.UseLoss(sstruct.GetMapping(), shared.log_base * RealT(HAMMING_LOSS));
+    result.push_back(inference_engine.ComputeLoss(sstruct.GetMapping(), solution, shared.log_base * RealT(HAMMING_LOSS)));
+#else
+    result.push_back(RealT(0));
 #endif
-    inference_engine.LoadValues(std::vector<RealT>(w.size()));
-    inference_engine.UseConstraints(solution->GetMapping());
-    inference_engine.UpdateEvidenceStructures();
-    inference_engine.ComputeViterbi();
-
-    delete solution;
-
-    result.clear();
-    result.push_back(inference_engine.GetViterbiScore());
 
     result *= RealT(descriptions[nonshared.index].weight);
     result.back() /= shared.log_base;
@@ -721,16 +745,12 @@ void ComputationEngine<RealT>::CheckZerosInData(std::vector<RealT> &result,
     inference_engine.LoadValues(std::vector<RealT>(parameter_manager.GetNumLogicalParameters()));
     inference_engine.UseConstraints(sstruct.GetMapping());
 
-    result.clear();
-    result.resize(descriptions.size());
-    // ignore structures that only have ground truth
+    // the number of examples with zeros is returned as a single entry
+    result.assign(1, RealT(0));
 
     // ignore structures that have no evidence for this dataset
     if (!sstruct.HasEvidence(which_data))
-    {
-        result[nonshared.index] = 0;
         return;
-    }
 
     inference_engine.UpdateEvidenceStructures(which_data);
 
@@ -741,7 +761,7 @@ void ComputationEngine<RealT>::CheckZerosInData(std::vector<RealT> &result,
         areZeros = inference_engine.AreZerosInSeqPairing(shared.id_base, shared.id_pairing, shared.which_data);
     }
 
-    result[nonshared.index] = (RealT)areZeros;
+    result[0] = (areZeros ? RealT(1) : RealT(0));
 }
 
 
@@ -757,6 +777,11 @@ void ComputationEngine<RealT>::ComputeFunctionAndGradient(std::vector<RealT> &re
                                                           const NonSharedInfo &nonshared,
                                                           bool need_gradient)
 {
+    // for max-margin training, try the working set first
+    const bool update_working_set = (shared.use_nonsmooth && shared.update_working_set && NONCONVEX_MULTIPLIER == 0);
+    working_set_clock++;
+    if (update_working_set && shared.use_working_set &&
+        ComputeFunctionAndGradientFromWorkingSet(result, shared, nonshared, need_gradient)) return;
 
     // load training example
     const SStruct &sstruct = descriptions[nonshared.index].sstruct;
@@ -765,6 +790,7 @@ void ComputationEngine<RealT>::ComputeFunctionAndGradient(std::vector<RealT> &re
     // load parameters
     const std::vector<RealT> w(shared.w, shared.w + parameter_manager.GetNumLogicalParameters());
     inference_engine.LoadValues(w * shared.log_base);
+    inference_engine.UpdateEvidenceStructures();
 #if defined(HAMMING_LOSS)
     if (shared.use_loss) inference_engine.UseLoss(sstruct.GetMapping(), shared.log_base * RealT(HAMMING_LOSS));
 #endif
@@ -772,12 +798,14 @@ void ComputationEngine<RealT>::ComputeFunctionAndGradient(std::vector<RealT> &re
     // unconditional inference
     RealT unconditional_score;
     std::vector<RealT> unconditional_counts;
+    std::vector<int> unconditional_mapping;
 
     if (shared.use_nonsmooth)
     {
         inference_engine.ComputeViterbi();
         unconditional_score = inference_engine.GetViterbiScore();
-        if (need_gradient) unconditional_counts = inference_engine.ComputeViterbiFeatureCounts();
+        if (update_working_set) unconditional_mapping = inference_engine.PredictPairingsViterbi();
+        if (need_gradient || update_working_set) unconditional_counts = inference_engine.ComputeViterbiFeatureCounts();
     }
     else
     {
@@ -799,7 +827,7 @@ void ComputationEngine<RealT>::ComputeFunctionAndGradient(std::vector<RealT> &re
     {
         inference_engine.ComputeViterbi();
         conditional_score = inference_engine.GetViterbiScore();
-        if (need_gradient) conditional_counts = inference_engine.ComputeViterbiFeatureCounts();
+        if (need_gradient || update_working_set) conditional_counts = inference_engine.ComputeViterbiFeatureCounts();
     }
     else
     {
@@ -829,6 +857,8 @@ void ComputationEngine<RealT>::ComputeFunctionAndGradient(std::vector<RealT> &re
         return;
     }
 
+    if (update_working_set) UpdateWorkingSet(nonshared.index, unconditional_mapping, unconditional_counts, conditional_counts);
+
     if (NONCONVEX_MULTIPLIER != 0)
     {
         
@@ -911,6 +941,139 @@ void ComputationEngine<RealT>::ComputeFunctionAndGradient(std::vector<RealT> &re
     result.back() /= shared.log_base;
 }
 
+//////////////////////////////////////////////////////////////////////
+// ComputationEngine::ComputeFunctionAndGradientFromWorkingSet()
+//
+// Compute the max-margin function value (and subgradient) for an
+// example using only the structures in its working set, which
+// requires a dot product per structure rather than loss-augmented
+// inference.  If no cached structure is violated, the example is
+// treated as satisfying its margin until the next exact pass.
+// Returns false if exact inference has not yet been run for the
+// example on this node.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+bool ComputationEngine<RealT>::ComputeFunctionAndGradientFromWorkingSet(std::vector<RealT> &result,
+                                                                        const SharedInfo<RealT> &shared,
+                                                                        const NonSharedInfo &nonshared,
+                                                                        bool need_gradient)
+{
+    if (nonshared.index >= int(working_sets.size())) return false;
+    WorkingSet<RealT> &working_set = working_sets[nonshared.index];
+    if (!working_set.initialized) return false;
+
+    const std::vector<RealT> w(shared.w, shared.w + parameter_manager.GetNumLogicalParameters());
+
+    // score of the true structure
+    RealT conditional_score = 0;
+    for (size_t i = 0; i < working_set.true_counts.size(); i++)
+        conditional_score += w[working_set.true_counts[i].first] * working_set.true_counts[i].second;
+    conditional_score *= shared.log_base;
+
+    // find most violating structure
+    RealT unconditional_score = conditional_score;
+    int best = -1;
+    for (size_t k = 0; k < working_set.counts.size(); k++)
+    {
+        RealT score = 0;
+        for (size_t i = 0; i < working_set.counts[k].size(); i++)
+            score += w[working_set.counts[k][i].first] * working_set.counts[k][i].second;
+        score *= shared.log_base;
+        if (shared.use_loss) score += shared.log_base * working_set.losses[k];
+
+        if (score > unconditional_score)
+        {
+            unconditional_score = score;
+            best = int(k);
+        }
+    }
+
+    result.clear();
+
+    // compute subgradient
+    if (need_gradient)
+    {
+        result.resize(w.size());
+        if (best >= 0)
+        {
+            for (size_t i = 0; i < working_set.counts[best].size(); i++)
+                result[working_set.counts[best][i].first] += working_set.counts[best][i].second;
+            for (size_t i = 0; i < working_set.true_counts.size(); i++)
+                result[working_set.true_counts[i].first] -= working_set.true_counts[i].second;
+        }
+    }
+    if (best >= 0) working_set.last_used[best] = working_set_clock;
+
+    // compute function value
+    result.push_back(unconditional_score - conditional_score);
+
+    result *= RealT(descriptions[nonshared.index].weight);
+    result.back() /= shared.log_base;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationEngine::UpdateWorkingSet()
+//
+// Add a structure found by loss-augmented inference to the working
+// set of an example, replacing the least recently violated structure
+// if the working set is full.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ComputationEngine<RealT>::UpdateWorkingSet(int index,
+                                                const std::vector<int> &mapping,
+                                                const std::vector<RealT> &counts,
+                                                const std::vector<RealT> &true_counts)
+{
+    if (int(working_sets.size()) <= index) working_sets.resize(descriptions.size());
+    WorkingSet<RealT> &working_set = working_sets[index];
+    const std::vector<int> &true_mapping = descriptions[index].sstruct.GetMapping();
+    working_set.initialized = true;
+
+    // the conditional structure may change if the true structure is
+    // only partially known
+    working_set.true_counts.clear();
+    for (size_t i = 0; i < true_counts.size(); i++)
+        if (true_counts[i] != RealT(0)) working_set.true_counts.push_back(std::make_pair(int(i), true_counts[i]));
+    
+    // the true structure is never violating
+    if (mapping == true_mapping) return;
+    for (size_t k = 0; k < working_set.mappings.size(); k++)
+    {
+        if (working_set.mappings[k] == mapping)
+        {
+            working_set.last_used[k] = working_set_clock;
+            return;
+        }
+    }
+
+    // choose slot
+    size_t slot = working_set.mappings.size();
+    if (int(slot) < WORKING_SET_SIZE)
+    {
+        working_set.mappings.push_back(std::vector<int>());
+        working_set.counts.push_back(std::vector<std::pair<int,RealT> >());
+        working_set.losses.push_back(RealT(0));
+        working_set.last_used.push_back(0);
+    }
+    else
+    {
+        slot = std::min_element(working_set.last_used.begin(), working_set.last_used.end()) - working_set.last_used.begin();
+    }
+
+    working_set.mappings[slot] = mapping;
+    working_set.counts[slot].clear();
+    for (size_t i = 0; i < counts.size(); i++)
+        if (counts[i] != RealT(0)) working_set.counts[slot].push_back(std::make_pair(int(i), counts[i]));
+#if defined(HAMMING_LOSS)
+    working_set.losses[slot] = inference_engine.ComputeLoss(true_mapping, mapping, RealT(HAMMING_LOSS));
+#else
+    working_set.losses[slot] = RealT(0);
+#endif
+    working_set.last_used[slot] = working_set_clock;
+}
 
 //////////////////////////////////////////////////////////////////////
 // ComputationEngine::ComputeFunctionAndGradientSE();
@@ -1211,6 +1374,143 @@ void ComputationEngine<RealT>::ComputeHessianVectorProduct(std::vector<RealT> &r
     result = (result - result2) / (RealT(2) * EPSILON);
 }
 
+//////////////////////////////////////////////////////////////////////
+// ComputationEngine::ComputeHessianDiagonal()
+//
+// Return a vector containing an estimate of the diagonal of the
+// Hessian.  The exact diagonal is the variance of each feature count
+// under the unconditional distribution, less its variance under the
+// conditional distribution.  Inside/outside gives only expected
+// counts, so each count is treated as a sum of rare independent
+// events (variance roughly equal to mean), and the conditional term
+// is dropped; it is zero for fully known structures.  The result is
+// only used for preconditioning, so an overestimate is harmless.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ComputationEngine<RealT>::ComputeHessianDiagonal(std::vector<RealT> &result, 
+                                                      const SharedInfo<RealT> &shared,
+                                                      const NonSharedInfo &nonshared)
+{
+    if (options.GetBoolValue("viterbi_parsing"))
+    {
+        Error("Should not use Hessian diagonal with Viterbi parsing.");
+    }
+
+    // load training example
+    const SStruct &sstruct = descriptions[nonshared.index].sstruct;
+    inference_engine.LoadSequence(sstruct);
+
+    // load parameters
+    const std::vector<RealT> w(shared.w, shared.w + parameter_manager.GetNumLogicalParameters());
+    inference_engine.LoadValues(w * shared.log_base);
+    inference_engine.UpdateEvidenceStructures();
+#if defined(HAMMING_LOSS)
+    if (shared.use_loss) inference_engine.UseLoss(sstruct.GetMapping(), shared.log_base * RealT(HAMMING_LOSS));
+#endif
+
+    // unconditional inference
+    inference_engine.ComputeInside();
+    inference_engine.ComputeOutside();
+    result = inference_engine.ComputeFeatureCountExpectations();
+
+    for (size_t i = 0; i < result.size(); i++)
+        result[i] = Abs(result[i]);
+    result *= RealT(descriptions[nonshared.index].weight) * shared.log_base;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationEngine::ComputeFunctionAlongDirection()
+//
+// Compute the function value for one example at one trial step
+// length, w + steps[step] * v.  The value is reported as a keyed
+// result so that the master can separate the trial step lengths.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ComputationEngine<RealT>::ComputeFunctionAlongDirection(std::vector<RealT> &result, 
+                                                             const SharedInfo<RealT> &shared,
+                                                             const NonSharedInfo &nonshared)
+{
+    SharedInfo<RealT> shared_temp(shared);
+    const RealT step = shared.steps[nonshared.step];
+    for (size_t i = 0; i < parameter_manager.GetNumLogicalParameters(); i++)
+        shared_temp.w[i] = shared.w[i] + step * shared.v[i];
+
+    if (shared.use_nonsmooth)
+        ComputeFunctionAndGradient(result, shared_temp, nonshared, false);
+    else
+        ComputeFunctionAndGradientSE(result, shared_temp, nonshared, false);
+
+    this->AddKeyedResult(nonshared.index * MAX_LINE_SEARCH_WIDTH + nonshared.step, std::vector<RealT>(1, result.back()));
+    result.clear();
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationEngine::ComputeExampleGradientSE()
+//
+// Compute the gradient for a single example.  The gradient is
+// reported as a keyed result rather than summed, so that the master
+// can keep one gradient per example (see
+// InnerOptimizationWrapperStochasticGradient).
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ComputationEngine<RealT>::ComputeExampleGradientSE(std::vector<RealT> &result, 
+                                                        const SharedInfo<RealT> &shared,
+                                                        const NonSharedInfo &nonshared)
+{
+    ComputeFunctionAndGradientSE(result, shared, nonshared, true);
+    result.pop_back();
+    this->AddKeyedResult(nonshared.index, result);
+    result.clear();
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationEngine::ComputeGradientWithHoldoutSE()
+//
+// Compute the gradient for a training example, or only the function
+// value for a holdout example.  Holdout values are reported as keyed
+// results and contribute zero to the summed gradient.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ComputationEngine<RealT>::ComputeGradientWithHoldoutSE(std::vector<RealT> &result, 
+                                                            const SharedInfo<RealT> &shared,
+                                                            const NonSharedInfo &nonshared)
+{
+    if (!nonshared.holdout)
+    {
+        ComputeFunctionAndGradientSE(result, shared, nonshared, true);
+        return;
+    }
+
+    ComputeFunctionAndGradientSE(result, shared, nonshared, false);
+    this->AddKeyedResult(nonshared.index, std::vector<RealT>(1, result.back()));
+    result.assign(parameter_manager.GetNumLogicalParameters() + 1, RealT(0));
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationEngine::ComputeExampleStatisticsSE()
+//
+// Compute the gradient, function value and estimated Hessian
+// diagonal for a single example, reported as one keyed result (see
+// ExampleStatistics).
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ComputationEngine<RealT>::ComputeExampleStatisticsSE(std::vector<RealT> &result, 
+                                                          const SharedInfo<RealT> &shared,
+                                                          const NonSharedInfo &nonshared)
+{
+    std::vector<RealT> diagonal;
+    ComputeHessianDiagonal(diagonal, shared, nonshared);
+    ComputeFunctionAndGradientSE(result, shared, nonshared, true);
+    result.insert(result.end(), diagonal.begin(), diagonal.end());
+    this->AddKeyedResult(nonshared.index, result);
+    result.clear();
+}
+
 //////////////////////////////////////////////////////////////////////
 // ComputationEngine::Predict()
 //
@@ -1223,9 +1523,32 @@ void ComputationEngine<RealT>::Predict(std::vector<RealT> &result,
                                        const NonSharedInfo &nonshared)
 {
     result.clear();
+
+    if (!ensemble_values.empty())
+    {
+        PredictEnsemble(shared, nonshared);
+        return;
+    }
     
-    // load sequence, with constraints if necessary
+    // choose inference mode, within the budget if one is given
     const SStruct &sstruct = descriptions[nonshared.index].sstruct;
+    int beam_width = options.GetIntValue("beam_width");
+    int max_span = options.GetIntValue("max_span");
+    const bool budgeted = options.GetRealValue("time_budget") > 0 || options.GetRealValue("memory_budget") > 0;
+    const double starting_time = GetSystemTime();
+    InferencePlan plan = InferencePlan();
+    if (budgeted)
+    {
+        plan = PlanInference(sstruct.GetLength());
+        ReportInferencePlan(plan, descriptions[nonshared.index].input_filename, sstruct.GetLength());
+        beam_width = plan.beam_width;
+        max_span = plan.max_span;
+        inference_engine.UseMaxSpan(max_span);
+    }
+
+    // load sequence, with constraints if necessary; beam-pruned
+    // inference needs no O(L^2) tables
+    inference_engine.UseSparseTables(beam_width > 0);
     inference_engine.LoadSequence(sstruct);
     if (options.GetBoolValue("use_constraints")) inference_engine.UseConstraints(sstruct.GetMapping());
 
@@ -1235,15 +1558,22 @@ void ComputationEngine<RealT>::Predict(std::vector<RealT> &result,
 
     inference_engine.UpdateEvidenceStructures();
 
-    // perform inference
+    // perform inference; posteriors restricted by a span limit or beam
+    // are sparse enough for the sparse decoder
+    const bool sparse_posterior = beam_width > 0 || max_span > 0;
     SStruct *solution;
     if (options.GetBoolValue("viterbi_parsing"))
     {
-        if (options.GetBoolValue("use_evidence"))
+        if (options.GetBoolValue("use_evidence") && beam_width == 0)
             Error("Viterbi parsing is not supported with evidence yet");
         // Basically, add a ComputeViterbiESS and then call it to support this.
+        if (options.GetBoolValue("output_expected_accuracy"))
+            Error("Expected accuracy requires posterior decoding");
 
-        inference_engine.ComputeViterbi();
+        if (beam_width > 0)
+            inference_engine.ComputeViterbiBeam(beam_width, options.GetBoolValue("use_evidence"));
+        else
+            inference_engine.ComputeViterbi();
         if (options.GetBoolValue("partition_function_only"))
         {
             std::cout << "Viterbi score for \"" << descriptions[nonshared.index].input_filename << "\": " 
@@ -1251,11 +1581,24 @@ void ComputationEngine<RealT>::Predict(std::vector<RealT> &result,
             return;
         }
         solution = new SStruct(sstruct);
-        solution->SetMapping(inference_engine.PredictPairingsViterbi());
+        solution->SetMapping(beam_width > 0 ? inference_engine.PredictPairingsViterbiBeam() : inference_engine.PredictPairingsViterbi());
     }
     else
     {
-        if (options.GetBoolValue("use_evidence")) 
+        if (beam_width > 0)
+        {
+
+            inference_engine.ComputeInsideBeam(beam_width, options.GetBoolValue("use_evidence"));
+            if (options.GetBoolValue("partition_function_only"))
+            {
+                std::cout << "Log partition coefficient for \"" << descriptions[nonshared.index].input_filename << "\": " 
+                          << inference_engine.ComputeLogPartitionCoefficient() << std::endl;
+                return;
+            }
+            inference_engine.ComputePosteriorBeam();
+
+        }
+        else if (options.GetBoolValue("use_evidence")) 
         {
 
             inference_engine.ComputeInsideESS();
@@ -1287,51 +1630,362 @@ void ComputationEngine<RealT>::Predict(std::vector<RealT> &result,
         solution = new SStruct(sstruct);
         if (options.GetBoolValue("centroid_estimator")) {
             std::cout << "Predicting using centroid estimator." << std::endl;
-            solution->SetMapping(inference_engine.PredictPairingsPosteriorCentroid(shared.gamma));
+            solution->SetMapping(sparse_posterior ? inference_engine.PredictPairingsPosteriorSparse(shared.gamma, true) :
+                                 inference_engine.PredictPairingsPosteriorCentroid(shared.gamma));
         } else {
             std::cout << "Predicting using MEA estimator." << std::endl;
-            solution->SetMapping(inference_engine.PredictPairingsPosterior(shared.gamma));
+            solution->SetMapping(sparse_posterior ? inference_engine.PredictPairingsPosteriorSparse(shared.gamma, false) :
+                                 inference_engine.PredictPairingsPosterior(shared.gamma));
         }
+
+        if (options.GetBoolValue("output_expected_accuracy"))
+            WriteExpectedAccuracy(*solution, descriptions[nonshared.index].input_filename, shared.gamma);
     }
 
+    // refine the cost model with the measured running time
+    if (budgeted) UpdateInferenceSpeed(plan, GetSystemTime() - starting_time);
+
     // write output
+    WritePrediction(*solution, descriptions[nonshared.index].input_filename, shared.gamma, "");
+    
+    delete solution;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationEngine::EstimateSeconds()
+// ComputationEngine::EstimateMegabytes()
+//
+// Estimated running time and memory of posterior inference for a
+// sequence of length L in the given mode, where width is the maximum
+// base-pair span or beam width.  Running times are scaled by the
+// throughput measured on earlier sequences.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+double ComputationEngine<RealT>::EstimateSeconds(const InferenceMode mode, const int L, const int width) const
+{
+    const double n = L;
+    const double w = width;
+    double seconds = 0;
+    switch (mode)
+    {
+        case INFERENCE_EXACT:
+            seconds = BUDGET_EXACT_TIME * n * n * n;
+            break;
+        case INFERENCE_SPAN_LIMITED:
+            seconds = (BUDGET_SPAN_LINEAR_TIME + BUDGET_SPAN_TIME * w) * n * w + BUDGET_QUADRATIC_TIME * n * n;
+            break;
+        case INFERENCE_BEAM_PRUNED:
+            seconds = BUDGET_BEAM_TIME * n * w + BUDGET_QUADRATIC_TIME * n * n;
+            break;
+        default:
+            Assert(false, "Unknown inference mode.");
+    }
+    return seconds * budget_speed[mode];
+}
+
+template<class RealT>
+double ComputationEngine<RealT>::EstimateMegabytes(const InferenceMode mode, const int L, const int width) const
+{
+    // span-limited inference still allocates the full matrices but
+    // fills only a band; beam-pruned inference keeps only the decoder's
+    // score and traceback tables dense
+    const double entries = 0.5 * (L+1.0) * (L+2.0);
+    if (mode == INFERENCE_BEAM_PRUNED)
+        return BUDGET_BASE_MEMORY + (BUDGET_BEAM_DENSE_TABLES * entries + BUDGET_BEAM_STATE_SIZE * double(L) * width) * sizeof(RealT) / 1048576.0;
+    return BUDGET_BASE_MEMORY + BUDGET_DENSE_TABLES * entries * sizeof(RealT) / 1048576.0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationEngine::PlanInference()
+//
+// Choose the most accurate inference mode whose estimated cost fits
+// the time and memory budgets: exact inference, then span-limited
+// inference with the largest span that fits, then beam-pruned
+// inference with the largest beam that fits.  If nothing fits, fall
+// back to the narrowest beam.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+InferencePlan ComputationEngine<RealT>::PlanInference(const int L) const
+{
+    const double time_budget = options.GetRealValue("time_budget");
+    const double memory_budget = options.GetRealValue("memory_budget");
+
+    InferencePlan plan = InferencePlan();
+    plan.within_budget = true;
+
+    // exact inference
+    plan.mode = INFERENCE_EXACT;
+    plan.max_span = 0;
+    plan.beam_width = 0;
+    plan.seconds = EstimateSeconds(INFERENCE_EXACT, L, 0);
+    plan.megabytes = EstimateMegabytes(INFERENCE_EXACT, L, 0);
+    const bool memory_fits = memory_budget <= 0 || plan.megabytes <= memory_budget;
+    if (memory_fits && (time_budget <= 0 || plan.seconds <= time_budget)) return plan;
+
+    // span-limited inference, largest span within the time budget
+    if (memory_fits && L > BUDGET_MIN_SPAN + 1 &&
+        EstimateSeconds(INFERENCE_SPAN_LIMITED, L, BUDGET_MIN_SPAN) <= time_budget)
+    {
+        int lo = BUDGET_MIN_SPAN, hi = L-1;
+        while (lo < hi)
+        {
+            const int mid = lo + (hi - lo + 1) / 2;
+            if (EstimateSeconds(INFERENCE_SPAN_LIMITED, L, mid) <= time_budget) lo = mid; else hi = mid-1;
+        }
+        plan.mode = INFERENCE_SPAN_LIMITED;
+        plan.max_span = lo;
+        plan.seconds = EstimateSeconds(INFERENCE_SPAN_LIMITED, L, lo);
+        return plan;
+    }
+
+    // beam-pruned inference, largest beam within both budgets
+    plan.mode = INFERENCE_BEAM_PRUNED;
+    for (plan.beam_width = BUDGET_MAX_BEAM; plan.beam_width >= BUDGET_MIN_BEAM; plan.beam_width--)
+    {
+        plan.seconds = EstimateSeconds(INFERENCE_BEAM_PRUNED, L, plan.beam_width);
+        plan.megabytes = EstimateMegabytes(INFERENCE_BEAM_PRUNED, L, plan.beam_width);
+        if ((time_budget <= 0 || plan.seconds <= time_budget) &&
+            (memory_budget <= 0 || plan.megabytes <= memory_budget)) return plan;
+    }
+
+    // nothing fits; degrade as far as possible
+    plan.beam_width = BUDGET_MIN_BEAM;
+    plan.seconds = EstimateSeconds(INFERENCE_BEAM_PRUNED, L, plan.beam_width);
+    plan.megabytes = EstimateMegabytes(INFERENCE_BEAM_PRUNED, L, plan.beam_width);
+    plan.within_budget = false;
+    return plan;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationEngine::ReportInferencePlan()
+//
+// Report the inference mode chosen for a sequence.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ComputationEngine<RealT>::ReportInferencePlan(const InferencePlan &plan, const std::string &input_filename, const int L) const
+{
+    std::cerr << "Inference for \"" << input_filename << "\" (length " << L << "): ";
+    switch (plan.mode)
+    {
+        case INFERENCE_EXACT: std::cerr << "exact"; break;
+        case INFERENCE_SPAN_LIMITED: std::cerr << "span-limited (maximum base-pair span " << plan.max_span << ")"; break;
+        case INFERENCE_BEAM_PRUNED: std::cerr << "beam-pruned (beam width " << plan.beam_width << ")"; break;
+        default: Assert(false, "Unknown inference mode.");
+    }
+    std::cerr << SPrintF(" (estimated %.1lf s, %.0lf MB%s)", plan.seconds, plan.megabytes,
+                         plan.within_budget ? "" : ", over budget") << std::endl;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationEngine::UpdateInferenceSpeed()
+//
+// Refine the time estimates of the mode used by the running time
+// measured for a sequence.  Very short runs are ignored, as their
+// timings are dominated by fixed overheads.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ComputationEngine<RealT>::UpdateInferenceSpeed(const InferencePlan &plan, const double seconds)
+{
+    if (seconds < BUDGET_MIN_MEASURED_TIME || plan.seconds <= 0) return;
+    const double ratio = seconds / plan.seconds;
+    budget_speed[plan.mode] *= (1.0 - BUDGET_SPEED_UPDATE) + BUDGET_SPEED_UPDATE * ratio;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationEngine::PredictEnsemble()
+//
+// Predict structure of a single sequence with each model of the
+// ensemble in turn, reusing the loaded sequence, and then decode the
+// posteriors averaged over all models.  Each model's prediction is
+// written with the suffix ".model<k>"; the ensemble prediction and
+// averaged posteriors are written without a suffix.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ComputationEngine<RealT>::PredictEnsemble(const SharedInfo<RealT> &shared,
+                                               const NonSharedInfo &nonshared)
+{
+    // load sequence once, with constraints if necessary
+    const SStruct &sstruct = descriptions[nonshared.index].sstruct;
+    const std::string &input_filename = descriptions[nonshared.index].input_filename;
+    const int beam_width = options.GetIntValue("beam_width");
+    inference_engine.UseSparseTables(beam_width > 0);
+    inference_engine.LoadSequence(sstruct);
+    if (options.GetBoolValue("use_constraints")) inference_engine.UseConstraints(sstruct.GetMapping());
+
+    const bool sparse_posterior = beam_width > 0 || options.GetIntValue("max_span") > 0;
+    const bool centroid = options.GetBoolValue("centroid_estimator");
+    std::cout << "Predicting using " << (centroid ? "centroid" : "MEA") << " estimator with an ensemble of "
+              << ensemble_values.size() << " models." << std::endl;
+
+    // posteriors are summed densely, or by pair with sparse tables
+    std::vector<RealT> average(beam_width > 0 ? 0 : inference_engine.GetPosteriorSize(), RealT(0));
+    std::vector<RealT> posterior(average.size());
+    std::map<std::pair<int,int>, RealT> average_sparse;
+    std::vector<std::vector<std::pair<int,RealT> > > posterior_sparse;
+    SStruct solution(sstruct);
+
+    for (size_t k = 0; k < ensemble_values.size(); k++)
+    {
+        // load parameters of this model and compute its posteriors
+        inference_engine.LoadValues(ensemble_values[k] * shared.log_base);
+        inference_engine.UpdateEvidenceStructures();
+
+        if (beam_width > 0)
+        {
+            inference_engine.ComputeInsideBeam(beam_width, options.GetBoolValue("use_evidence"));
+            inference_engine.ComputePosteriorBeam();
+        }
+        else if (options.GetBoolValue("use_evidence"))
+        {
+            inference_engine.ComputeInsideESS();
+            inference_engine.ComputeOutsideESS();
+            inference_engine.ComputePosteriorESS();
+        }
+        else
+        {
+            inference_engine.ComputeInside();
+            inference_engine.ComputeOutside();
+            inference_engine.ComputePosterior();
+        }
+
+        if (beam_width > 0)
+        {
+            inference_engine.GetPosterior(posterior_sparse, RealT(0));
+            for (size_t j = 0; j < posterior_sparse.size(); j++)
+                for (size_t i = 0; i < posterior_sparse[j].size(); i++)
+                    average_sparse[std::make_pair(int(j), posterior_sparse[j][i].first)] += posterior_sparse[j][i].second;
+        }
+        else
+        {
+            inference_engine.GetPosterior(&posterior[0], RealT(0));
+            for (size_t i = 0; i < average.size(); i++)
+                average[i] += posterior[i];
+        }
+
+        // decode and write this model's prediction
+        solution.SetMapping(sparse_posterior ? inference_engine.PredictPairingsPosteriorSparse(shared.gamma, centroid) :
+                            centroid ? inference_engine.PredictPairingsPosteriorCentroid(shared.gamma) :
+                            inference_engine.PredictPairingsPosterior(shared.gamma));
+        WritePrediction(solution, input_filename, shared.gamma,
+                        SPrintF(".model%d", int(k)+1));
+    }
+
+    // decode the averaged posteriors
+    if (beam_width > 0)
+    {
+        posterior_sparse.assign(sstruct.GetLength()+1, std::vector<std::pair<int,RealT> >());
+        for (typename std::map<std::pair<int,int>, RealT>::const_iterator iter = average_sparse.begin(); iter != average_sparse.end(); ++iter)
+            posterior_sparse[iter->first.first].push_back(std::make_pair(iter->first.second, iter->second / RealT(ensemble_values.size())));
+        inference_engine.LoadPosterior(posterior_sparse);
+    }
+    else
+    {
+        for (size_t i = 0; i < average.size(); i++)
+            average[i] /= RealT(ensemble_values.size());
+        inference_engine.LoadPosterior(average);
+    }
+
+    solution.SetMapping(sparse_posterior ? inference_engine.PredictPairingsPosteriorSparse(shared.gamma, centroid) :
+                        centroid ? inference_engine.PredictPairingsPosteriorCentroid(shared.gamma) :
+                        inference_engine.PredictPairingsPosterior(shared.gamma));
+    if (options.GetBoolValue("output_expected_accuracy"))
+        WriteExpectedAccuracy(solution, input_filename, shared.gamma);
+    WritePrediction(solution, input_filename, shared.gamma, "");
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationEngine::WriteExpectedAccuracy()
+//
+// Report the expected accuracy of a prediction under the posterior
+// distribution currently held by the inference engine.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ComputationEngine<RealT>::WriteExpectedAccuracy(const SStruct &solution,
+                                                     const std::string &input_filename,
+                                                     const RealT gamma)
+{
+    const ExpectedAccuracy<RealT> accuracy = inference_engine.ComputeExpectedAccuracy(solution.GetMapping(), gamma);
+    std::cout << "Expected accuracy for \"" << input_filename << "\" (gamma=" << gamma << "):" << std::endl
+              << "  ensemble defect " << accuracy.ensemble_defect
+              << " (normalized " << accuracy.ensemble_defect / RealT(solution.GetLength()) << ")" << std::endl
+              << "  sensitivity " << accuracy.sensitivity << ", PPV " << accuracy.ppv
+              << ", F1 " << accuracy.f1 << ", MCC " << accuracy.mcc << std::endl
+              << "  MEA objective " << accuracy.mea_objective << std::endl;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationEngine::WritePrediction()
+//
+// Write a predicted structure, and the posteriors currently held by
+// the inference engine, to the requested destinations (or the
+// structure to standard output if none), appending the given suffix
+// to each output filename.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ComputationEngine<RealT>::WritePrediction(const SStruct &solution,
+                                               const std::string &input_filename,
+                                               const RealT gamma,
+                                               const std::string &suffix)
+{
     if (options.GetStringValue("output_parens_destination") != "")
     {
-        const std::string filename = MakeOutputFilename(descriptions[nonshared.index].input_filename,
+        const std::string filename = MakeOutputFilename(input_filename,
                                                         options.GetStringValue("output_parens_destination"),
                                                         options.GetRealValue("gamma") < 0,
-                                                        shared.gamma);
+                                                        gamma) + suffix;
         std::ofstream outfile(filename.c_str());
         if (outfile.fail()) Error("Unable to open output parens file '%s' for writing.", filename.c_str());
-        solution->WriteParens(outfile);
+        solution.WriteParens(outfile);
         outfile.close();
     }
   
     if (options.GetStringValue("output_bpseq_destination") != "")
     {
-        const std::string filename = MakeOutputFilename(descriptions[nonshared.index].input_filename,
+        const std::string filename = MakeOutputFilename(input_filename,
                                                         options.GetStringValue("output_bpseq_destination"),
                                                         options.GetRealValue("gamma") < 0,
-                                                        shared.gamma);
+                                                        gamma) + suffix;
         std::ofstream outfile(filename.c_str());
         if (outfile.fail()) Error("Unable to open output bpseq file '%s' for writing.", filename.c_str());
-        solution->WriteBPSEQ(outfile);
+        solution.WriteBPSEQ(outfile);
         outfile.close();
     }
     
     if (options.GetStringValue("output_posteriors_destination") != "")
     {
-        const std::string filename = MakeOutputFilename(descriptions[nonshared.index].input_filename,
+        const std::string filename = MakeOutputFilename(input_filename,
                                                         options.GetStringValue("output_posteriors_destination"),
                                                         options.GetRealValue("gamma") < 0,
-                                                        shared.gamma);
-        RealT *posterior = inference_engine.GetPosterior(options.GetRealValue("output_posteriors_cutoff"));
-        SparseMatrix<RealT> sparse(posterior, sstruct.GetLength()+1, RealT(0));
-        delete [] posterior;
+                                                        gamma) + suffix;
+        SparseMatrix<RealT> *sparse = NULL;
+        if (inference_engine.UsesSparseTables())
+        {
+            std::vector<std::vector<std::pair<int,RealT> > > pairs;
+            inference_engine.GetPosterior(pairs, options.GetRealValue("output_posteriors_cutoff"));
+            std::map<std::pair<int,int>, RealT> entries;
+            for (size_t j = 0; j < pairs.size(); j++)
+                for (size_t i = 0; i < pairs[j].size(); i++)
+                    entries[std::make_pair(pairs[j][i].first, int(j))] = pairs[j][i].second;
+            sparse = new SparseMatrix<RealT>(entries, solution.GetLength()+1, solution.GetLength()+1, RealT(0));
+        }
+        else
+        {
+            RealT *posterior = inference_engine.GetPosterior(options.GetRealValue("output_posteriors_cutoff"));
+            sparse = new SparseMatrix<RealT>(posterior, solution.GetLength()+1, RealT(0));
+            delete [] posterior;
+        }
         std::ofstream outfile(filename.c_str());
         if (outfile.fail()) Error("Unable to open output posteriors file '%s' for writing.", filename.c_str());
-        sparse.PrintSparseBPSEQ(outfile, sstruct.GetSequences()[0]);
+        sparse->PrintSparseBPSEQ(outfile, solution.GetSequences()[0]);
         outfile.close();
+        delete sparse;
     }
     
     if (options.GetStringValue("output_parens_destination") == "" &&
@@ -1339,10 +1993,10 @@ void ComputationEngine<RealT>::Predict(std::vector<RealT> &result,
         options.GetStringValue("output_posteriors_destination") == "")
     {
         WriteProgressMessage("");
-        solution->WriteParens(std::cout);
+        if (!ensemble_values.empty())
+            std::cout << "Prediction of " << (suffix != "" ? suffix.substr(1) : std::string("ensemble")) << ":" << std::endl;
+        solution.WriteParens(std::cout);
     }
-    
-    delete solution;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -37,6 +37,18 @@ class ComputationWrapper
 
     std::vector<double> cached_function_gammamle;
     std::vector<double> cached_gradient_gammamle;
+
+    std::vector<int> cached_bound_units;
+    std::vector<RealT> cached_bound_C;
+    RealT cached_bound;
+
+    // parsability of each input file (-1 if not yet checked)
+    std::vector<int> cached_parsable;
+
+    // number of max-margin evaluations, for scheduling exact inference
+    int working_set_evaluations;
+
+    void SetUpNonsmoothComputation(bool toggle_use_nonsmooth, ProcessingType command);
     
 public:
     
@@ -65,6 +77,18 @@ public:
     std::vector<RealT> ComputeGammaMLEScalingFactor(const std::vector<int> &units, const std::vector<RealT> &w, int evidence_cpd_id1, int evidence_cpd_id2, int which_data);
 
     std::vector<RealT> ComputeHessianVectorProduct(const std::vector<int> &units, const std::vector<RealT> &w, const std::vector<RealT> &v, bool toggle_use_loss, RealT log_base);
+    std::vector<RealT> ComputeHessianDiagonal(const std::vector<int> &units, const std::vector<RealT> &w, bool toggle_use_loss, RealT log_base);
+
+    // function values at several step lengths along a direction, in one pass
+    int GetLineSearchWidth(const std::vector<int> &units) const;
+    std::vector<RealT> ComputeFunctionAlongDirection(const std::vector<int> &units, const std::vector<RealT> &w, const std::vector<RealT> &d, const std::vector<RealT> &steps, bool toggle_use_nonsmooth, bool toggle_use_loss, RealT log_base, RealT hyperparam_data);
+
+    // separate gradient for each work unit, keyed by unit index
+    std::map<int, std::vector<RealT> > ComputeExampleGradientsSE(const std::vector<int> &units, const std::vector<RealT> &w, bool toggle_use_loss, RealT log_base, RealT hyperparam_data);
+    std::map<int, std::vector<RealT> > ComputeExampleStatisticsSE(const std::vector<int> &units, const std::vector<RealT> &w, RealT log_base, RealT hyperparam_data);
+
+    // gradient and function value over units, with the function value over holdout units computed in the same pass
+    std::vector<RealT> ComputeGradientWithHoldoutSE(const std::vector<int> &units, const std::vector<int> &holdout, const std::vector<RealT> &w, bool toggle_use_loss, RealT log_base, RealT hyperparam_data, RealT &function, RealT &holdout_function);
     
     // for debugging
     void SanityCheckGradient(const std::vector<int> &units, const std::vector<RealT> &w);
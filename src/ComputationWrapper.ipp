@@ -13,7 +13,9 @@
 
 template<class RealT>
 ComputationWrapper<RealT>::ComputationWrapper(ComputationEngine<RealT> &computation_engine) :
-    computation_engine(computation_engine)
+    computation_engine(computation_engine),
+    cached_bound(0),
+    working_set_evaluations(0)
 { 
 }
 
@@ -50,12 +52,8 @@ RealT ComputationWrapper<RealT>::ComputeSolutionNormBound(const std::vector<int>
 {
     Assert(computation_engine.IsMasterNode(), "Routine should only be called by master process.");
 
-    static std::vector<int> cached_units;
-    static std::vector<RealT> cached_C;
-    static RealT cached_bound = 0;
-
     // check cache
-    if (cached_units != units || cached_C != C)
+    if (cached_bound_units != units || cached_bound_C != C)
     {
         // set up computation        
         shared_info.command = COMPUTE_SOLUTION_NORM_BOUND;
@@ -74,8 +72,8 @@ RealT ComputationWrapper<RealT>::ComputeSolutionNormBound(const std::vector<int>
         std::cerr << "Solution norm bound: " << cached_bound << std::endl;
 
         // save cache
-        cached_units = units;
-        cached_C = C;
+        cached_bound_units = units;
+        cached_bound_C = C;
     }
     
     return cached_bound;
@@ -120,7 +118,10 @@ RealT ComputationWrapper<RealT>::ComputeGradientNormBound(const std::vector<int>
 // ComputationWrapper::FilterNonparsable()
 //
 // Filter a vector of units, removing any units whose supplied
-// structures are not parsable.
+// structures are not parsable.  Fully known structures are checked
+// directly in linear time; constrained Viterbi parsing is only
+// distributed for partially known structures.  Results are cached
+// for each input file.
 //////////////////////////////////////////////////////////////////////
 
 template<class RealT>
@@ -128,23 +129,50 @@ std::vector<int> ComputationWrapper<RealT>::FilterNonparsable(const std::vector<
 {
     Assert(computation_engine.IsMasterNode(), "Routine should only be called by master process.");
 
-    std::vector<RealT> parsable;
+    const std::vector<FileDescription> &descriptions = GetDescriptions();
+    if (cached_parsable.size() != descriptions.size())
+        cached_parsable.assign(descriptions.size(), -1);
 
-    shared_info.command = CHECK_PARSABILITY;
-        
-    nonshared_info.resize(units.size());
+    // check fully known structures directly
+    nonshared_info.clear();
     for (size_t i = 0; i < units.size(); i++)
     {
-        nonshared_info[i].index = units[i];
+        Assert(units[i] >= 0 && units[i] < int(descriptions.size()), "Out-of-bounds index.");
+        if (cached_parsable[units[i]] >= 0) continue;
+        
+        const SStruct &sstruct = descriptions[units[i]].sstruct;
+        const std::vector<int> &mapping = sstruct.GetMapping();
+        if (std::find(mapping.begin() + 1, mapping.end(), SStruct::UNKNOWN) == mapping.end())
+        {
+            cached_parsable[units[i]] = (GetInferenceEngine().IsParsable(sstruct) ? 1 : 0);
+        }
+        else
+        {
+            nonshared_info.push_back(NonSharedInfo());
+            nonshared_info.back().index = units[i];
+        }
+    }
+
+    // fall back on parsing for the rest
+    if (nonshared_info.size() > 0)
+    {
+        std::vector<RealT> result;
+        std::map<int, std::vector<RealT> > parsable;
+        
+        shared_info.command = CHECK_PARSABILITY;
+        computation_engine.DistributeComputation(result, parsable, shared_info, nonshared_info);
+        
+        for (size_t i = 0; i < nonshared_info.size(); i++)
+        {
+            typename std::map<int, std::vector<RealT> >::const_iterator iter = parsable.find(nonshared_info[i].index);
+            cached_parsable[nonshared_info[i].index] = (iter != parsable.end() && !iter->second.empty() && iter->second[0] > 0) ? 1 : 0;
+        }
     }
-    
-    computation_engine.DistributeComputation(parsable, shared_info, nonshared_info);
 
     std::vector<int> ret;
     for (size_t i = 0; i < units.size(); i++)
     {
-        Assert(units[i] >= 0 && units[i] < int(parsable.size()), "Out-of-bounds index.");
-        if (parsable[units[i]])
+        if (cached_parsable[units[i]])
         {
             ret.push_back(units[i]);
         }
@@ -181,6 +209,7 @@ RealT ComputationWrapper<RealT>::ComputeLoss(const std::vector<int> &units,
     }
     shared_info.use_loss = true;
     shared_info.log_base = log_base;
+    shared_info.gamma = GetOptions().GetRealValue("gamma");
     
     nonshared_info.resize(units.size());
     for (size_t i = 0; i < units.size(); i++)
@@ -259,6 +288,269 @@ RealT ComputationWrapper<RealT>::ComputeFunction(const std::vector<int> &units,
 */
 }
 
+//////////////////////////////////////////////////////////////////////
+// ComputationWrapper::GetLineSearchWidth()
+//
+// Number of trial step lengths that can be evaluated at once without
+// leaving the pass longer than a single function evaluation, i.e.,
+// the number of compute nodes per work unit.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+int ComputationWrapper<RealT>::GetLineSearchWidth(const std::vector<int> &units) const
+{
+    if (units.size() == 0) return 1;
+    const int num_compute_nodes = computation_engine.GetNumNodes() - 1;
+    return std::max(1, std::min(MAX_LINE_SEARCH_WIDTH, num_compute_nodes / int(units.size())));
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationWrapper::ComputeFunctionAlongDirection()
+//
+// Compute the function value at w + t*d for each t in steps.  Each
+// (work unit, step length) pair is distributed separately, so all
+// step lengths are evaluated in a single pass.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+std::vector<RealT> ComputationWrapper<RealT>::ComputeFunctionAlongDirection(const std::vector<int> &units,
+                                                                            const std::vector<RealT> &w,
+                                                                            const std::vector<RealT> &d,
+                                                                            const std::vector<RealT> &steps,
+                                                                            bool toggle_use_nonsmooth,
+                                                                            bool toggle_use_loss,
+                                                                            RealT log_base,
+                                                                            RealT hyperparam_data)
+{
+#if STOCHASTIC_GRADIENT
+    Error("Should not get here.");
+#endif
+
+    Assert(computation_engine.IsMasterNode(), "Routine should only be called by master process.");
+    if (int(w.size()) > SHARED_PARAMETER_SIZE) Error("SHARED_PARAMETER_SIZE in Config.hpp too small; increase to at least %d.", int(w.size()));
+    Assert(w.size() == d.size(), "Direction vector size does not match parameters.");
+    Assert(int(steps.size()) <= MAX_LINE_SEARCH_WIDTH, "Too many step lengths for a single pass.");
+
+    // set up computation
+    shared_info.command = COMPUTE_FUNCTION_ALONG_DIRECTION;
+    for (size_t i = 0; i < w.size(); i++)
+    {
+        shared_info.w[i] = w[i];
+        shared_info.v[i] = d[i];
+    }
+    for (size_t j = 0; j < steps.size(); j++)
+    {
+        shared_info.steps[j] = steps[j];
+    }
+    shared_info.use_nonsmooth = toggle_use_nonsmooth;
+    shared_info.use_loss = toggle_use_loss;
+    shared_info.log_base = log_base;
+    shared_info.hyperparam_data = hyperparam_data;
+    shared_info.update_working_set = false;
+    shared_info.use_working_set = false;
+
+    nonshared_info.resize(units.size() * steps.size());
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        for (size_t j = 0; j < steps.size(); j++)
+        {
+            nonshared_info[i * steps.size() + j].index = units[i];
+            nonshared_info[i * steps.size() + j].step = int(j);
+        }
+    }
+
+    // perform computation
+    std::vector<RealT> unused;
+    std::map<int, std::vector<RealT> > values;
+    computation_engine.DistributeComputation(unused, values, shared_info, nonshared_info);
+    Assert(values.size() == units.size() * steps.size(), "Unexpected number of results.");
+
+    // sum over work units for each step length
+    std::vector<RealT> ret(steps.size());
+    for (typename std::map<int, std::vector<RealT> >::const_iterator iter = values.begin(); iter != values.end(); ++iter)
+    {
+        ret[iter->first % MAX_LINE_SEARCH_WIDTH] += iter->second[0];
+    }
+
+    return ret;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationWrapper::ComputeExampleGradientsSE()
+//
+// Compute the gradient of the negative log-likelihood separately
+// for each work unit.  Results are not cached.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+std::map<int, std::vector<RealT> > ComputationWrapper<RealT>::ComputeExampleGradientsSE(const std::vector<int> &units,
+                                                                                         const std::vector<RealT> &w,
+                                                                                         bool toggle_use_loss,
+                                                                                         RealT log_base,
+                                                                                         RealT hyperparam_data)
+{
+#if STOCHASTIC_GRADIENT
+    Error("Should not get here.");
+#endif
+
+    Assert(computation_engine.IsMasterNode(), "Routine should only be called by master process.");
+    if (int(w.size()) > SHARED_PARAMETER_SIZE) Error("SHARED_PARAMETER_SIZE in Config.hpp too small; increase to at least %d.", int(w.size()));
+
+    // set up computation
+    shared_info.command = COMPUTE_EXAMPLE_GRADIENT_SE;
+    for (size_t i = 0; i < w.size(); i++)
+    {
+        shared_info.w[i] = w[i];
+    }
+    shared_info.use_nonsmooth = false;
+    shared_info.use_loss = toggle_use_loss;
+    shared_info.log_base = log_base;
+    shared_info.hyperparam_data = hyperparam_data;
+    shared_info.update_working_set = false;
+    shared_info.use_working_set = false;
+
+    nonshared_info.resize(units.size());
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        nonshared_info[i].index = units[i];
+    }
+
+    // perform computation
+    std::vector<RealT> unused;
+    std::map<int, std::vector<RealT> > gradients;
+    computation_engine.DistributeComputation(unused, gradients, shared_info, nonshared_info);
+    Assert(gradients.size() == units.size(), "Unexpected number of results.");
+
+    return gradients;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationWrapper::ComputeExampleStatisticsSE()
+//
+// Compute, separately for each work unit, the gradient, function
+// value and estimated Hessian diagonal, concatenated in that order.
+// Results are not cached.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+std::map<int, std::vector<RealT> > ComputationWrapper<RealT>::ComputeExampleStatisticsSE(const std::vector<int> &units,
+                                                                                          const std::vector<RealT> &w,
+                                                                                          RealT log_base,
+                                                                                          RealT hyperparam_data)
+{
+#if STOCHASTIC_GRADIENT
+    Error("Should not get here.");
+#endif
+
+    Assert(computation_engine.IsMasterNode(), "Routine should only be called by master process.");
+    if (int(w.size()) > SHARED_PARAMETER_SIZE) Error("SHARED_PARAMETER_SIZE in Config.hpp too small; increase to at least %d.", int(w.size()));
+
+    // set up computation
+    shared_info.command = COMPUTE_EXAMPLE_STATISTICS_SE;
+    for (size_t i = 0; i < w.size(); i++)
+    {
+        shared_info.w[i] = w[i];
+    }
+    shared_info.use_nonsmooth = false;
+    shared_info.use_loss = true;
+    shared_info.log_base = log_base;
+    shared_info.hyperparam_data = hyperparam_data;
+    shared_info.update_working_set = false;
+    shared_info.use_working_set = false;
+
+    nonshared_info.resize(units.size());
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        nonshared_info[i].index = units[i];
+    }
+
+    // perform computation
+    std::vector<RealT> unused;
+    std::map<int, std::vector<RealT> > statistics;
+    computation_engine.DistributeComputation(unused, statistics, shared_info, nonshared_info);
+    Assert(statistics.size() == units.size(), "Unexpected number of results.");
+
+    return statistics;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputationWrapper::ComputeGradientWithHoldoutSE()
+//
+// Compute the gradient and function value as in ComputeGradientSE()
+// and ComputeFunctionSE(), and also the function value over a set of
+// holdout units.  The holdout units are
+// distributed after the training units in the same pass, so they
+// occupy compute nodes that would otherwise wait for the last
+// training units to finish.  The gradient cache is updated as usual.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+std::vector<RealT> ComputationWrapper<RealT>::ComputeGradientWithHoldoutSE(const std::vector<int> &units,
+                                                                           const std::vector<int> &holdout,
+                                                                           const std::vector<RealT> &w,
+                                                                           bool toggle_use_loss,
+                                                                           RealT log_base,
+                                                                           RealT hyperparam_data,
+                                                                           RealT &function,
+                                                                           RealT &holdout_function)
+{
+#if STOCHASTIC_GRADIENT
+    Error("Should not get here.");
+#endif
+
+    Assert(computation_engine.IsMasterNode(), "Routine should only be called by master process.");
+    if (int(w.size()) > SHARED_PARAMETER_SIZE) Error("SHARED_PARAMETER_SIZE in Config.hpp too small; increase to at least %d.", int(w.size()));
+
+    // set up computation
+    shared_info.command = COMPUTE_GRADIENT_WITH_HOLDOUT_SE;
+    for (size_t i = 0; i < w.size(); i++)
+    {
+        shared_info.w[i] = w[i];
+    }
+    shared_info.use_nonsmooth = false;
+    shared_info.use_loss = toggle_use_loss;
+    shared_info.log_base = log_base;
+    shared_info.hyperparam_data = hyperparam_data;
+    shared_info.update_working_set = false;
+    shared_info.use_working_set = false;
+
+    nonshared_info.resize(units.size() + holdout.size());
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        nonshared_info[i].index = units[i];
+        nonshared_info[i].holdout = false;
+    }
+    for (size_t i = 0; i < holdout.size(); i++)
+    {
+        nonshared_info[units.size() + i].index = holdout[i];
+        nonshared_info[units.size() + i].holdout = true;
+    }
+
+    // perform computation
+    std::map<int, std::vector<RealT> > values;
+    computation_engine.DistributeComputation(cached_gradient, values, shared_info, nonshared_info);
+    Assert(cached_gradient.size() == GetParameterManager().GetNumLogicalParameters() + 1, "Unexpected return value size.");
+    Assert(values.size() == holdout.size(), "Unexpected number of results.");
+
+    holdout_function = RealT(0);
+    for (typename std::map<int, std::vector<RealT> >::const_iterator iter = values.begin(); iter != values.end(); ++iter)
+    {
+        holdout_function += iter->second[0];
+    }
+
+    // replace cache
+    cached_units = units;
+    cached_w = w;
+    cached_toggle_use_nonsmooth = false;
+    cached_toggle_use_loss = toggle_use_loss;
+    cached_function.clear();
+    cached_function.push_back(cached_gradient.back());
+    cached_gradient.pop_back();
+
+    function = cached_function[0];
+    return cached_gradient;
+}
+
 //////////////////////////////////////////////////////////////////////
 // ComputationWrapper::ComputeGradient()
 //
@@ -480,7 +772,7 @@ RealT ComputationWrapper<RealT>::ComputeFunctionSE(const std::vector<int> &units
         cached_function.size() == 0)
     {
         // set up computation
-        shared_info.command = COMPUTE_FUNCTION_SE;
+        SetUpNonsmoothComputation(toggle_use_nonsmooth, COMPUTE_FUNCTION_SE);
         for (size_t i = 0; i < w.size(); i++)
         {
             shared_info.w[i] = w[i];
@@ -542,7 +834,7 @@ std::vector<RealT> ComputationWrapper<RealT>::ComputeGradientSE(const std::vecto
         cached_gradient.size() == 0)
     {
         // set up computation
-        shared_info.command = COMPUTE_GRADIENT_SE;
+        SetUpNonsmoothComputation(toggle_use_nonsmooth, COMPUTE_GRADIENT_SE);
         for (size_t i = 0; i < w.size(); i++)
         {
             shared_info.w[i] = w[i];
@@ -576,6 +868,36 @@ std::vector<RealT> ComputationWrapper<RealT>::ComputeGradientSE(const std::vecto
     return cached_gradient;
 }
 
+//////////////////////////////////////////////////////////////////////
+// ComputationWrapper::SetUpNonsmoothComputation()
+//
+// Choose the command for a function or gradient computation.  The
+// max-margin objective is not supported by the EM computation, so
+// it is computed as in supervised training.  With --workingset N,
+// max-margin objectives are computed from each example's working set
+// of violating structures, running exact loss-augmented inference
+// only on every Nth evaluation.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ComputationWrapper<RealT>::SetUpNonsmoothComputation(bool toggle_use_nonsmooth, ProcessingType command)
+{
+    shared_info.command = command;
+    shared_info.update_working_set = false;
+    shared_info.use_working_set = false;
+    if (!toggle_use_nonsmooth) return;
+
+    shared_info.command = (command == COMPUTE_FUNCTION_SE ? COMPUTE_FUNCTION : COMPUTE_GRADIENT);
+
+    const int refresh = GetOptions().GetIntValue("working_set_refresh");
+    if (refresh > 0)
+    {
+        shared_info.update_working_set = true;
+        shared_info.use_working_set = (working_set_evaluations % refresh != 0);
+        working_set_evaluations++;
+    }
+}
+
 //////////////////////////////////////////////////////////////////////
 // ComputationWrapper::ComputeGammaMLEFunction()
 //
@@ -773,7 +1095,7 @@ bool ComputationWrapper<RealT>::FindZerosInData(const std::vector<int> &units, i
 
     Assert(computation_engine.IsMasterNode(), "Routine should only be called by master process.");
 
-    std::vector<RealT> parsable;
+    std::vector<RealT> num_with_zeros;
     shared_info.command = CHECK_ZEROS_IN_DATA;
         
     nonshared_info.resize(units.size());
@@ -785,18 +1107,10 @@ bool ComputationWrapper<RealT>::FindZerosInData(const std::vector<int> &units, i
     shared_info.id_pairing = evidence_cpd_id2;
     shared_info.which_data = which_data;
 
-    computation_engine.DistributeComputation(parsable, shared_info, nonshared_info);
+    computation_engine.DistributeComputation(num_with_zeros, shared_info, nonshared_info);
 
-    bool hasZeros = false;
-    for (size_t i = 0; i < units.size(); i++)
-    {
-        Assert(units[i] >= 0 && units[i] < int(parsable.size()), "Out-of-bounds index.");
-        if (parsable[units[i]]>0)  // if this sequence has a zero, set the return value to true and break
-        {
-            hasZeros = true;
-            break;
-        }
-    }
+    // number of sequences containing a zero, summed over all units
+    bool hasZeros = (!num_with_zeros.empty() && num_with_zeros[0] > 0);
     
     return hasZeros;
 }
@@ -848,6 +1162,46 @@ std::vector<RealT> ComputationWrapper<RealT>::ComputeHessianVectorProduct(const
     return ret;
 }
 
+//////////////////////////////////////////////////////////////////////
+// ComputationWrapper::ComputeHessianDiagonal()
+//
+// Compute an estimate of the diagonal of the Hessian, for use as a
+// preconditioner.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+std::vector<RealT> ComputationWrapper<RealT>::ComputeHessianDiagonal(const std::vector<int> &units,
+                                                                     const std::vector<RealT> &w,
+                                                                     bool toggle_use_loss,
+                                                                     RealT log_base)
+{
+    Assert(computation_engine.IsMasterNode(), "Routine should only be called by master process.");
+    if (int(w.size()) > SHARED_PARAMETER_SIZE) Error("SHARED_PARAMETER_SIZE in Config.hpp too small; increase to at least %d.", int(w.size()));
+    if (GetOptions().GetBoolValue("viterbi_parsing")) Error("Hessian diagonal should not be needed when using Viterbi parsing.");
+
+    std::vector<RealT> ret;
+
+    shared_info.command = COMPUTE_HESSIAN_DIAGONAL;
+    for (size_t i = 0; i < w.size(); i++)
+    {
+        shared_info.w[i] = w[i];
+    }
+    shared_info.use_nonsmooth = false;
+    shared_info.use_loss = toggle_use_loss;
+    shared_info.log_base = log_base;
+    
+    nonshared_info.resize(units.size());
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        nonshared_info[i].index = units[i];
+    }
+    
+    computation_engine.DistributeComputation(ret, shared_info, nonshared_info);
+    Assert(ret.size() == GetParameterManager().GetNumLogicalParameters(), "Unexpected return value size.");
+
+    return ret;
+}
+
 
 //////////////////////////////////////////////////////////////////////
 // ComputationWrapper::Predict()
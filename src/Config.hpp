@@ -32,12 +32,51 @@ const int SHARED_PARAMETER_SIZE = 5000;
 // use candidate list optimization for Viterbi parsing
 #define CANDIDATE_LIST                             1
 
+// skip multiloop splits with zero FM1 weight in the outside and
+// posterior passes of the partition function
+#define SPARSE_PARTITION_FUNCTION                  1
+
+// sum multiloop splits a tile at a time in the inside passes of the
+// partition function; a tile's splits are summed in double precision
+// rather than one Fast_LogPlusEquals at a time, so results differ
+// slightly from the unblocked sums (in single precision prediction on
+// 300-500 nt, posteriors by up to 1e-4 and log Z by about 1e-4,
+// against a total single precision error of about 3e-3 in the
+// posteriors)
+#define BLOCKED_MULTI_SPLITS                       1
+const int MULTI_SPLIT_BLOCK = 32;
+
 // use unrolled computation for single branch loops
 #define FAST_SINGLE_BRANCH_LOOPS                   1
 
 // use caching algorithm for fast helix length scores
 #define FAST_HELIX_LENGTHS                         1
 
+// cost model for budgeted prediction (--timebudget, --memorybudget):
+// seconds per unit of work for exact (L^3), span-limited (L*W and
+// L*W^2), beam-pruned (L*B) and the shared quadratic (L^2) work, and
+// the number of dense L*L/2 tables, of values per beam state and of
+// megabytes used regardless of the sequence
+const double BUDGET_EXACT_TIME = 7.2e-9;
+const double BUDGET_SPAN_LINEAR_TIME = 7.0e-6;
+const double BUDGET_SPAN_TIME = 1.3e-8;
+const double BUDGET_BEAM_TIME = 2.8e-5;
+const double BUDGET_QUADRATIC_TIME = 1.0e-7;
+const double BUDGET_DENSE_TABLES = 13;
+const double BUDGET_BEAM_DENSE_TABLES = 2;
+const double BUDGET_BEAM_STATE_SIZE = 18;
+const double BUDGET_BASE_MEMORY = 6;
+
+// narrowest span and range of beam widths used when degrading
+const int BUDGET_MIN_SPAN = 100;
+const int BUDGET_MIN_BEAM = 20;
+const int BUDGET_MAX_BEAM = 100;
+
+// runs shorter than this (in seconds) do not refine the cost model;
+// weight of each measured run in the refined throughput
+const double BUDGET_MIN_MEASURED_TIME = 0.05;
+const double BUDGET_SPEED_UPDATE = 0.5;
+
 //////////////////////////////////////////////////////////////////////
 // Options related to training mode configuration
 //////////////////////////////////////////////////////////////////////
@@ -70,6 +109,15 @@ const int NUM_CCCP_STEPS = 5;
 // during training
 #define SMOOTH_MAX_MARGIN                          0
 
+// maximum number of violating structures kept for each training
+// example when training with a working set (see --workingset)
+const int WORKING_SET_SIZE = 10;
+
+// maximum number of step lengths evaluated at once by the L-BFGS line
+// search when there are more compute nodes than training examples
+// (1 to always search sequentially)
+const int MAX_LINE_SEARCH_WIDTH = 4;
+
 //////////////////////////////////////////////////////////////////////
 // (B) Regularization type
 //////////////////////////////////////////////////////////////////////
@@ -105,6 +153,10 @@ const int NUM_CCCP_STEPS = 5;
 // starting regularization parameter
 const double INITIAL_LOG_C = 5.0;
 
+// precondition the conjugate gradient solves for Hessian-vector
+// products with a diagonal estimate of the Hessian
+#define CG_DIAGONAL_PRECONDITIONER                 1
+
 //////////////////////////////////////////////////////////////////////
 // (C3) majorization-minimization-options
 //////////////////////////////////////////////////////////////////////
@@ -234,9 +286,14 @@ const bool VERBOSE_LOCAL = false;  // debugging statements in local functions (d
 
 /////////////////////////////////////////////////////////////////////
 // (G) BMRM stuff
+//
+// BMRM_AVAILABLE selects the bundle method (rather than the
+// subgradient method) for max-margin training.  BUNDLE_MAX_SIZE
+// bounds the number of cutting planes kept; older inactive planes
+// are dropped and, if necessary, the rest are aggregated.
 //////////////////////////////////////////////////////////////////////
 
 #define BMRM_AVAILABLE                              0
-// #define DAIFLETCHER
+const int BUNDLE_MAX_SIZE = 50;
 
 #endif
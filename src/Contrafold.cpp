@@ -105,9 +105,12 @@ void Usage(const Options &options)
               << "  --viterbi                use Viterbi instead of posterior decoding for prediction, " << std::endl
               << "                           or max-margin instead of log-likelihood for training" << std::endl
               << "  --noncomplementary       allow non-{AU,CG,GU} pairs" << std::endl
+              << "  --pincores               pin each process to a core so its tables stay on the local NUMA node" << std::endl
+              << "  --hugepages              use transparent huge pages for dynamic programming tables" << std::endl
               << std::endl 
               << "Additional arguments for 'predict' mode:" << std::endl
-              << "  --params FILENAME        use particular model parameters" << std::endl
+              << "  --params FILENAME        use particular model parameters; if given more than once, predict with each" << std::endl
+              << "                           model in turn and decode the posteriors averaged over all models" << std::endl
               << "  --constraints            use existing constraints (requires BPSEQ or FASTA format input)" << std::endl
               << "  --evidence               use experimental evidence (requires BPSEQ format input)" << std::endl
               << "  --centroid               use centroid estimator (as opposed to MEA estimator)" << std::endl
@@ -121,6 +124,13 @@ void Usage(const Options &options)
               << "  --posteriors CUTOFF OUTFILEORDIR" << std::endl
               << "                           write posterior pairing probabilities to file or directory" << std::endl
               << "  --partition              compute the partition function or Viterbi score only" << std::endl
+              << "  --accuracy               report ensemble defect and expected accuracy of each prediction" << std::endl
+              << "  --beam WIDTH             use approximate linear-time inference, keeping WIDTH states of each" << std::endl
+              << "                           type per position (default: exact inference)" << std::endl
+              << "  --maxspan W              only allow base-pairs (i,j) with j-i <= W (default: no limit)" << std::endl
+              << "  --timebudget SECONDS     per-sequence time budget; use exact, span-limited or beam-pruned" << std::endl
+              << "                           inference, whichever is most accurate within the budget" << std::endl
+              << "  --memorybudget MB        per-sequence memory budget, as for --timebudget" << std::endl
               << std::endl
               << "Additional arguments for training (many input files may be specified):" << std::endl
               << "  --examplefile            read list of input files from provided text file (instead of as arguments)" << std::endl
@@ -128,12 +138,21 @@ void Usage(const Options &options)
               << "  --holdout F              use fraction F of training data for holdout cross-validation" << std::endl
               << "  --regularize C           perform BFGS training, using a single regularization coefficient C" << std::endl
               << "  --maxiter N              for single regularization coefficient the max number of iterations" << std::endl
+              << "  --workingset N           for max-margin (--viterbi) training, reuse cached violating structures and" << std::endl
+              << "                           run exact inference only every N evaluations" << std::endl
+              << "  --earlystop K            with --holdout, evaluate the holdout set every K iterations and keep the" << std::endl
+              << "                           best iterate (with --regularize, train once on the remaining data)" << std::endl
+              << "  --patience P             with --earlystop, stop after P evaluations without improvement (default 5)" << std::endl
+              << "  --statistics F           save per-example statistics to file F; if F exists, refresh the model by" << std::endl
+              << "                           training only on new or changed examples" << std::endl
               << "  --hyperparam_data K      weight on data-only examples" << std::endl
               << "  --initweights w          for single regularization coefficient an initial set of weights" << std::endl
               << "  --numdatasources n       the number of data sources for em-train" << std::endl
               << "  --batchsize b            mini-batch size for stochastic gradient training" << std::endl
               << "  --s0 s0                  stepsize for SGD is s0/(1+iter)^s1" << std::endl
               << "  --s1 s1                  stepsize for SGD is s0/(1+iter)^s1" << std::endl
+              << "  --sgdmethod M            stochastic gradient variant: sgd (default), or saga or svrg to keep one" << std::endl
+              << "                           gradient per example and reduce variance (use with a constant stepsize, s1 = 0)" << std::endl
               << std::endl;
     exit(0);
 }
@@ -173,8 +192,11 @@ void ParseArguments(int argc,
     options.SetRealValue("log_base", 1.0);
     options.SetBoolValue("viterbi_parsing", false);
     options.SetBoolValue("allow_noncomplementary", false);
+    options.SetBoolValue("pin_cores", false);
+    options.SetBoolValue("use_huge_pages", false);
 
     options.SetStringValue("parameter_filename", "");
+    options.SetIntValue("num_parameter_files", 0);
     options.SetBoolValue("use_constraints", false);
     options.SetBoolValue("centroid_estimator", false);
     options.SetBoolValue("use_evidence", false);
@@ -184,6 +206,11 @@ void ParseArguments(int argc,
     options.SetRealValue("output_posteriors_cutoff", 0);
     options.SetStringValue("output_posteriors_destination", "");
     options.SetBoolValue("partition_function_only", false);
+    options.SetBoolValue("output_expected_accuracy", false);
+    options.SetIntValue("beam_width", 0);
+    options.SetIntValue("max_span", 0);
+    options.SetRealValue("time_budget", 0);
+    options.SetRealValue("memory_budget", 0);
 
     options.SetBoolValue("gradient_sanity_check", false);
     options.SetRealValue("holdout_ratio", 0);
@@ -191,12 +218,17 @@ void ParseArguments(int argc,
 
     options.SetStringValue("train_examplefile", "");
     options.SetIntValue("train_max_iter", TRAIN_MAX_ITER_DEFAULT);
+    options.SetIntValue("working_set_refresh", 0);
+    options.SetIntValue("early_stop_interval", 0);
+    options.SetIntValue("early_stop_patience", 5);
+    options.SetStringValue("train_statistics_filename", "");
     options.SetStringValue("train_initweights_filename", "");
     options.SetStringValue("train_priorweights_filename", "");
     options.SetIntValue("num_data_sources",0);
     options.SetIntValue("batch_size", 1);
     options.SetRealValue("s0", 0.0001);
     options.SetRealValue("s1", 0);
+    options.SetStringValue("sgd_method", "sgd");
     options.SetRealValue("hyperparam_data",HYPERPARAM_DATA_DEFAULT);
 
     // check for sufficient arguments
@@ -254,12 +286,23 @@ void ParseArguments(int argc,
             {
                 options.SetBoolValue("allow_noncomplementary", true);
             }
+            else if (!strcmp(argv[argno], "--pincores"))
+            {
+                options.SetBoolValue("pin_cores", true);
+            }
+            else if (!strcmp(argv[argno], "--hugepages"))
+            {
+                options.SetBoolValue("use_huge_pages", true);
+            }
             
             // prediction options
             else if (!strcmp(argv[argno], "--params"))
             {
                 if (argno == argc - 1) Error("Must specify FILENAME after --params.");
-                options.SetStringValue("parameter_filename", argv[++argno]);
+                const int num_parameter_files = options.GetIntValue("num_parameter_files");
+                if (num_parameter_files == 0) options.SetStringValue("parameter_filename", argv[argno+1]);
+                options.SetStringValue(SPrintF("parameter_filename_%d", num_parameter_files), argv[++argno]);
+                options.SetIntValue("num_parameter_files", num_parameter_files + 1);
             }
             else if (!strcmp(argv[argno], "--constraints"))
             {
@@ -305,6 +348,50 @@ void ParseArguments(int argc,
             {
                 options.SetBoolValue("partition_function_only", true);
             }
+            else if (!strcmp(argv[argno], "--accuracy"))
+            {
+                options.SetBoolValue("output_expected_accuracy", true);
+            }
+            else if (!strcmp(argv[argno], "--beam"))
+            {
+                if (argno == argc - 1) Error("Must specify beam width WIDTH after --beam.");
+                int value;
+                if (!ConvertToNumber(argv[++argno], value))
+                    Error("Unable to parse beam width after --beam.");
+                if (value <= 0)
+                    Error("Beam width after --beam should be positive.");
+                options.SetIntValue("beam_width", value);
+            }
+            else if (!strcmp(argv[argno], "--maxspan"))
+            {
+                if (argno == argc - 1) Error("Must specify maximum base-pair span W after --maxspan.");
+                int value;
+                if (!ConvertToNumber(argv[++argno], value))
+                    Error("Unable to parse maximum base-pair span after --maxspan.");
+                if (value < 4)
+                    Error("Maximum base-pair span after --maxspan should be at least 4.");
+                options.SetIntValue("max_span", value);
+            }
+            else if (!strcmp(argv[argno], "--timebudget"))
+            {
+                if (argno == argc - 1) Error("Must specify time budget SECONDS after --timebudget.");
+                double value;
+                if (!ConvertToNumber(argv[++argno], value))
+                    Error("Unable to parse time budget after --timebudget.");
+                if (value <= 0)
+                    Error("Time budget after --timebudget should be positive.");
+                options.SetRealValue("time_budget", value);
+            }
+            else if (!strcmp(argv[argno], "--memorybudget"))
+            {
+                if (argno == argc - 1) Error("Must specify memory budget MB after --memorybudget.");
+                double value;
+                if (!ConvertToNumber(argv[++argno], value))
+                    Error("Unable to parse memory budget after --memorybudget.");
+                if (value <= 0)
+                    Error("Memory budget after --memorybudget should be positive.");
+                options.SetRealValue("memory_budget", value);
+            }
             
             // training options
             else if (!strcmp(argv[argno], "--examplefile"))
@@ -346,6 +433,41 @@ void ParseArguments(int argc,
                     Error("Max number of iterations should not be negative.");
                 options.SetIntValue("train_max_iter", value);
             }
+            else if (!strcmp(argv[argno], "--workingset"))
+            {
+                if (argno == argc - 1) Error("Must specify number of evaluations between exact inference passes after --workingset.");
+                int value;
+                if (!ConvertToNumber(argv[++argno], value))
+                    Error("Unable to parse number of evaluations after --workingset.");
+                if (value <= 0)
+                    Error("Number of evaluations after --workingset should be positive.");
+                options.SetIntValue("working_set_refresh", value);
+            }
+            else if (!strcmp(argv[argno], "--earlystop"))
+            {
+                if (argno == argc - 1) Error("Must specify number of iterations between holdout evaluations after --earlystop.");
+                int value;
+                if (!ConvertToNumber(argv[++argno], value))
+                    Error("Unable to parse number of iterations after --earlystop.");
+                if (value <= 0)
+                    Error("Number of iterations after --earlystop should be positive.");
+                options.SetIntValue("early_stop_interval", value);
+            }
+            else if (!strcmp(argv[argno], "--patience"))
+            {
+                if (argno == argc - 1) Error("Must specify number of holdout evaluations after --patience.");
+                int value;
+                if (!ConvertToNumber(argv[++argno], value))
+                    Error("Unable to parse number of evaluations after --patience.");
+                if (value <= 0)
+                    Error("Number of evaluations after --patience should be positive.");
+                options.SetIntValue("early_stop_patience", value);
+            }
+            else if (!strcmp(argv[argno], "--statistics"))
+            {
+                if (argno == argc - 1) Error("Must specify filename of example statistics after --statistics.");
+                options.SetStringValue("train_statistics_filename", argv[++argno]);
+            }
             else if (!strcmp(argv[argno], "--hyperparam_data"))
             {
                 if (argno == argc - 1) Error("Must specify a value after --hyperparam_data.");
@@ -408,6 +530,14 @@ void ParseArguments(int argc,
                     Error("Stepsize parameter should not be negative.");
                 options.SetRealValue("s1", value);
             }
+            else if (!strcmp(argv[argno], "--sgdmethod"))
+            {
+                if (argno == argc - 1) Error("Must specify stochastic gradient variant after --sgdmethod.");
+                const std::string value = argv[++argno];
+                if (value != "sgd" && value != "saga" && value != "svrg")
+                    Error("Unknown stochastic gradient variant \"%s\"; expected sgd, saga or svrg.", value.c_str());
+                options.SetStringValue("sgd_method", value);
+            }
             else
             {
                 Error("Unknown option \"%s\" specified.  Run program without any arguments to see command-line options.", argv[argno]);
@@ -428,8 +558,10 @@ void ParseArguments(int argc,
 
     if (options.GetStringValue("train_examplefile") != "")
     {
-        std::ifstream examplefile(options.GetStringValue("train_examplefile").c_str());
-        if (examplefile.fail()) Error("Unable to open training example file: %s", options.GetStringValue("train_examplefile").c_str());
+        std::string contents;
+        if (!ReadFileContents(options.GetStringValue("train_examplefile"), contents))
+            Error("Unable to open training example file: %s", options.GetStringValue("train_examplefile").c_str());
+        std::istringstream examplefile(contents);
 
         std::string s;
         while (std::getline(examplefile, s))
@@ -460,6 +592,12 @@ void ParseArguments(int argc,
     {
         if (options.GetIntValue("train_max_iter") != TRAIN_MAX_ITER_DEFAULT)
             Error("The --maxiter flag is not used outside of training mode.");
+        if (options.GetIntValue("working_set_refresh") != 0)
+            Error("The --workingset flag is not used outside of training mode.");
+        if (options.GetIntValue("early_stop_interval") != 0)
+            Error("The --earlystop flag is not used outside of training mode.");
+        if (options.GetStringValue("train_statistics_filename") != "")
+            Error("The --statistics flag is not used outside of training mode.");
     }
 
     // check to make sure that arguments make sense
@@ -489,9 +627,32 @@ void ParseArguments(int argc,
             Error("The --posteriors option cannot be used in training mode.");
         if (options.GetBoolValue("partition_function_only"))
             Error("The --partition flag cannot be used in training mode.");
+        if (options.GetIntValue("beam_width") != 0)
+            Error("The --beam option cannot be used in training mode.");
+        if (options.GetIntValue("max_span") != 0)
+            Error("The --maxspan option cannot be used in training mode.");
+        if (options.GetRealValue("time_budget") != 0 || options.GetRealValue("memory_budget") != 0)
+            Error("The --timebudget and --memorybudget options cannot be used in training mode.");
         if (options.GetRealValue("regularization_coefficient") != REGULARIZATION_DEFAULT &&
-            options.GetRealValue("holdout_ratio") > 0)
-            Error("The --holdout and --regularize options cannot be specified simultaneously.");
+            options.GetRealValue("holdout_ratio") > 0 &&
+            options.GetIntValue("early_stop_interval") == 0)
+            Error("The --holdout and --regularize options cannot be specified simultaneously (except with --earlystop).");
+        if (options.GetIntValue("early_stop_interval") != 0)
+        {
+            if (options.GetRealValue("holdout_ratio") <= 0)
+                Error("The --earlystop flag requires a holdout set (--holdout).");
+            if (options.GetBoolValue("viterbi_parsing") || options.GetStringValue("training_mode") != "supervised")
+                Error("The --earlystop flag is only supported for L-BFGS (train) training.");
+        }
+        if (options.GetStringValue("train_statistics_filename") != "")
+        {
+            if (options.GetRealValue("holdout_ratio") > 0)
+                Error("The --statistics and --holdout options cannot be specified simultaneously.");
+            if (options.GetBoolValue("viterbi_parsing") || options.GetStringValue("training_mode") != "supervised")
+                Error("The --statistics flag is only supported for L-BFGS (train) training.");
+        }
+        if (options.GetIntValue("working_set_refresh") != 0 && !options.GetBoolValue("viterbi_parsing"))
+            Error("The --workingset flag requires max-margin (--viterbi) training.");
     }
     else
     {
@@ -514,6 +675,20 @@ void ParseArguments(int argc,
         if (options.GetBoolValue("viterbi_parsing") &&
             options.GetStringValue("output_posteriors_destination") != "")
             Error("The --posteriors option cannot be used with Viterbi parsing.");
+        if (options.GetIntValue("num_parameter_files") > 1)
+        {
+            if (options.GetBoolValue("viterbi_parsing"))
+                Error("Prediction with several --params files requires posterior decoding (no --viterbi).");
+            if (options.GetBoolValue("partition_function_only"))
+                Error("The --partition flag cannot be used with several --params files.");
+        }
+        if (options.GetRealValue("time_budget") != 0 || options.GetRealValue("memory_budget") != 0)
+        {
+            if (options.GetIntValue("beam_width") != 0 || options.GetIntValue("max_span") != 0)
+                Error("The --timebudget and --memorybudget options choose the inference mode themselves (no --beam or --maxspan).");
+            if (options.GetIntValue("num_parameter_files") > 1)
+                Error("The --timebudget and --memorybudget options cannot be used with several --params files.");
+        }
     }
 }
 
@@ -666,7 +841,8 @@ void RunTrainingMode(const Options &options,
 
     // decide between using a fixed regularization parameter or
     // using cross-validation to determine regularization parameters
-    if (options.GetRealValue("holdout_ratio") <= 0)
+    if (options.GetRealValue("holdout_ratio") <= 0 ||
+        (options.GetIntValue("early_stop_interval") > 0 && options.GetRealValue("regularization_coefficient") != REGULARIZATION_DEFAULT))
     {
         std::vector<RealT> regularization_coefficients(parameter_manager.GetNumParameterGroups(), options.GetRealValue("regularization_coefficient"));
         if (options.GetStringValue("training_mode") == "em") {
@@ -678,6 +854,10 @@ void RunTrainingMode(const Options &options,
                 Error("Using em-sgd with multiple hyperparameters is not supported");
             regularization_coefficients[1] = 0;
             optimization_wrapper.TrainSGD(units, w, regularization_coefficients);   
+	} else if (options.GetStringValue("train_statistics_filename") != "") {
+            optimization_wrapper.TrainIncremental(units, w, w0, regularization_coefficients, options.GetStringValue("train_statistics_filename"));
+	} else if (options.GetIntValue("early_stop_interval") > 0) {
+            optimization_wrapper.TrainWithEarlyStopping(units, w, w0, regularization_coefficients);
 	} else {
 	    // Don't regularize evidence CPD parameters
             optimization_wrapper.Train(units, w, w0, regularization_coefficients);
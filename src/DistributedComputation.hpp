@@ -80,6 +80,15 @@
 //     ensure that the compute nodes stop running.
 //
 // That's it!
+//
+// Some computations produce one small value per work unit (e.g., a
+// flag or a bound for each training example) rather than a sum.
+// Instead of returning a vector with one entry per work unit, which
+// would be summed across all units, DoComputation() may call
+// AddKeyedResult(key, value) to report a short vector under a key of
+// its choice (typically the unit index).  Keyed results are gathered
+// separately, and the master node receives them from the overload of
+// DistributeComputation() taking a std::map argument.
 //////////////////////////////////////////////////////////////////////
 
 #ifndef DISTRIBUTEDCOMPUTATION_HPP
@@ -89,6 +98,7 @@
 #include <mpi.h>
 #endif
 
+#include <map>
 #include "Utilities.hpp"
 
 //////////////////////////////////////////////////////////////////////
@@ -103,6 +113,7 @@ class DistributedComputationBase
     bool toggle_verbose;
     double processing_time;
     double total_time;
+    double prev_reporting_time;
     int id;
     int num_procs;
 
@@ -111,12 +122,18 @@ class DistributedComputationBase
     virtual ompi_datatype_t *GetResultMPIDataType() = 0;
 #endif
 
+    // keyed results reported by work units on this node
+    std::map<int, std::vector<RealT> > keyed_result;
+
 protected:
     
     // perform individual computations
     virtual void DoComputation(std::vector<RealT> &result,
                                const SharedData &shared_data,
                                const NonSharedData &nonshared_data) = 0;
+
+    // report a per-unit result (to be called from DoComputation())
+    void AddKeyedResult(int key, const std::vector<RealT> &value) { keyed_result[key] = value; }
     
 public:
     
@@ -132,6 +149,10 @@ public:
     void DistributeComputation(std::vector<RealT> &result,
                                const SharedData &shared_data,
                                const std::vector<NonSharedData> &nonshared_data);
+    void DistributeComputation(std::vector<RealT> &result,
+                               std::map<int, std::vector<RealT> > &all_keyed_results,
+                               const SharedData &shared_data,
+                               const std::vector<NonSharedData> &nonshared_data);
 
     // some simple routines for dealing with node IDs
     bool IsComputeNode() const { return id != 0; }
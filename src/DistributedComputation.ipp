@@ -13,6 +13,7 @@ enum CommandType
     CommandType_SendResultSize,
     CommandType_SendResult, 
     CommandType_ClearResult,
+    CommandType_SendKeyedResult,
     CommandType_Quit
 };
 
@@ -28,6 +29,7 @@ DistributedComputationBase<RealT, SharedData, NonSharedData>::DistributedComputa
     toggle_verbose(toggle_verbose),
     processing_time(0),
     total_time(0),
+    prev_reporting_time(0),
     id(0),
     num_procs(1)
 {
@@ -134,7 +136,29 @@ void DistributedComputationBase<RealT, SharedData, NonSharedData>::RunAsComputeN
             
             case CommandType_ClearResult:
                 result.clear();
+                keyed_result.clear();
                 break;
+
+            case CommandType_SendKeyedResult:
+            {
+                // flatten keyed results into keys, lengths and values
+                std::vector<int> header;
+                std::vector<RealT> values;
+                for (typename std::map<int, std::vector<RealT> >::const_iterator iter = keyed_result.begin(); iter != keyed_result.end(); ++iter)
+                {
+                    header.push_back(iter->first);
+                    header.push_back(int(iter->second.size()));
+                    values.insert(values.end(), iter->second.begin(), iter->second.end());
+                }
+                keyed_result.clear();
+
+                // send to main node
+                int sizes[2] = { int(header.size()), int(values.size()) };
+                MPI_Send(sizes, 2, MPI_INT, 0, 0, MPI_COMM_WORLD);
+                if (sizes[0] > 0) MPI_Send(&header[0], sizes[0], MPI_INT, 0, 0, MPI_COMM_WORLD);
+                if (sizes[1] > 0) MPI_Send(&values[0], sizes[1], GetResultMPIDataType(), 0, 0, MPI_COMM_WORLD);
+            }
+            break;
                 
             case CommandType_Quit:
                 return;
@@ -170,7 +194,9 @@ void DistributedComputationBase<RealT, SharedData, NonSharedData>::StopComputeNo
 //
 // Distribute computation tasks among all nodes (other than 0) if
 // MULTI is defined; work units are allocated starting from largest
-// unit size to smallest unit size.
+// unit size to smallest unit size.  Results of all units are summed
+// into result; keyed results (see AddKeyedResult()) are gathered into
+// all_keyed_results, or discarded by the first overload.
 //////////////////////////////////////////////////////////////////////
 
 const int NOT_ALLOCATED = -1;
@@ -180,6 +206,16 @@ template<class RealT, class SharedData, class NonSharedData>
 void DistributedComputationBase<RealT, SharedData, NonSharedData>::DistributeComputation(std::vector<RealT> &result,
                                                                                          const SharedData &shared_data,
                                                                                          const std::vector<NonSharedData> &nonshared_data)
+{
+    std::map<int, std::vector<RealT> > all_keyed_results;
+    DistributeComputation(result, all_keyed_results, shared_data, nonshared_data);
+}
+
+template<class RealT, class SharedData, class NonSharedData>
+void DistributedComputationBase<RealT, SharedData, NonSharedData>::DistributeComputation(std::vector<RealT> &result,
+                                                                                         std::map<int, std::vector<RealT> > &all_keyed_results,
+                                                                                         const SharedData &shared_data,
+                                                                                         const std::vector<NonSharedData> &nonshared_data)
 {
     Assert(id == 0, "Routine should only be called by master process.");
     Assert(nonshared_data.size() > 0, "Must submit at least one work description for processing.");
@@ -188,6 +224,7 @@ void DistributedComputationBase<RealT, SharedData, NonSharedData>::DistributeCom
     size_t units_complete = 0;
 
     result.clear();
+    all_keyed_results.clear();
     
 #ifdef MULTI
     size_t num_procs_in_use = 1;
@@ -242,7 +279,6 @@ void DistributedComputationBase<RealT, SharedData, NonSharedData>::DistributeCom
         
         // write progress message (at most 1 update per second)
         double current_time = GetSystemTime();
-        static double prev_reporting_time = 0;
         if (current_time - prev_reporting_time > 1)
         {
             prev_reporting_time = current_time;
@@ -285,12 +321,33 @@ void DistributedComputationBase<RealT, SharedData, NonSharedData>::DistributeCom
         if (toggle_verbose) WriteProgressMessage("Receiving accumulated results from processors.");
         MPI_Reduce(MPI_IN_PLACE, &result[0], size, GetResultMPIDataType(), MPI_SUM, 0, MPI_COMM_WORLD);
     }
-   
+
+    // gather keyed results from each processor
+    if (toggle_verbose) WriteProgressMessage("Receiving keyed results from processors.");
+    command = CommandType_SendKeyedResult;
+    for (int proc = 1; proc < num_procs; proc++)
+    {
+        MPI_Send(&command, 1, MPI_INT, proc, 0, MPI_COMM_WORLD);
+
+        int sizes[2];
+        MPI_Recv(sizes, 2, MPI_INT, proc, 0, MPI_COMM_WORLD, &status);
+        std::vector<int> header(sizes[0]);
+        std::vector<RealT> values(sizes[1]);
+        if (sizes[0] > 0) MPI_Recv(&header[0], sizes[0], MPI_INT, proc, 0, MPI_COMM_WORLD, &status);
+        if (sizes[1] > 0) MPI_Recv(&values[0], sizes[1], GetResultMPIDataType(), proc, 0, MPI_COMM_WORLD, &status);
+
+        for (size_t i = 0, k = 0; i < header.size(); i += 2)
+        {
+            all_keyed_results[header[i]].assign(values.begin() + k, values.begin() + k + header[i+1]);
+            k += header[i+1];
+        }
+    }
 
 #else
     
     // retrieve one result at a time, and accumulate
     std::vector<RealT> partial_result;    
+    keyed_result.clear();
     if (toggle_verbose) WriteProgressMessage("Starting first work unit.");
     for (size_t j = 0; j < nonshared_data.size(); j++)
     {
@@ -308,7 +365,6 @@ void DistributedComputationBase<RealT, SharedData, NonSharedData>::DistributeCom
         
         // write progress message (at most 1 update per second)
         double current_time = GetSystemTime();
-        static double prev_reporting_time = 0;
         if (current_time - prev_reporting_time > 1)
         {
             prev_reporting_time = current_time;
@@ -316,6 +372,9 @@ void DistributedComputationBase<RealT, SharedData, NonSharedData>::DistributeCom
             if (toggle_verbose) WriteProgressMessage(SPrintF("%u/%u work units allocated, %d%% complete.", units_complete, nonshared_data.size(), percent_complete));
         }
     }
+
+    all_keyed_results.swap(keyed_result);
+    keyed_result.clear();
     
 #endif
     
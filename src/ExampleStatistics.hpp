@@ -0,0 +1,92 @@
+//////////////////////////////////////////////////////////////////////
+// ExampleStatistics.hpp
+//
+// Per-example statistics saved by a training run, so that a later
+// run can refresh the model with new examples without revisiting
+// the old ones.  For each example, the statistics are its function
+// value f, gradient g (expected feature counts, including the
+// evidence sufficient statistics terms) and an estimate h of the
+// Hessian diagonal, all taken at some expansion point p.  Around p,
+// the example's contribution to the objective is approximated by
+//
+//     f + g'*(w - p) + 0.5 * sum_j h[j] * (w[j] - p[j])^2
+//
+// Examples are identified by file name and a checksum of the file
+// contents, so that an example whose file has changed is treated as
+// new.  Different examples may have different expansion points.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef EXAMPLESTATISTICS_HPP
+#define EXAMPLESTATISTICS_HPP
+
+#include <string>
+#include <vector>
+#include <set>
+#include <utility>
+#include "Utilities.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// struct ExampleStatistic
+//
+// Statistics for a single example; the gradient and curvature are
+// stored sparsely as (index, value) pairs.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+struct ExampleStatistic
+{
+    std::string filename;
+    unsigned int checksum;
+    int point;
+    RealT function;
+    std::vector<std::pair<int,RealT> > gradient;
+    std::vector<std::pair<int,RealT> > curvature;
+
+    ~ExampleStatistic();
+};
+
+//////////////////////////////////////////////////////////////////////
+// class ExampleStatistics
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+class ExampleStatistics
+{
+    int num_parameters;
+    std::vector<std::vector<RealT> > points;
+    std::vector<ExampleStatistic<RealT> > examples;
+
+public:
+
+    ExampleStatistics(int num_parameters);
+
+    // checksum of the contents of an input file
+    static unsigned int ComputeChecksum(const std::string &filename);
+
+    // file I/O
+    void Read(const std::string &filename);
+    void Write(const std::string &filename) const;
+
+    // add statistics for examples computed at w; each vector holds
+    // the gradient, the function value and the curvature, in order
+    int AddPoint(const std::vector<RealT> &w);
+    void AddExample(const std::string &filename, unsigned int checksum, int point, const std::vector<RealT> &statistics);
+
+    // look up or drop examples; Retain drops every example whose file
+    // is not listed and returns the number dropped
+    bool IsCurrent(const std::string &filename, unsigned int checksum) const;
+    void Remove(const std::string &filename);
+    int Retain(const std::set<std::string> &filenames);
+
+    // quadratic approximation of all stored examples, written as
+    // 0.5 * sum_j curvature[j] * w[j]^2 + slope'*w + constant
+    void ComputeApproximation(std::vector<RealT> &curvature, std::vector<RealT> &slope, RealT &constant) const;
+
+    // getters
+    int GetNumExamples() const { return int(examples.size()); }
+    const std::vector<RealT> &GetLastPoint() const;
+};
+
+#include "ExampleStatistics.ipp"
+
+#endif
@@ -0,0 +1,285 @@
+//////////////////////////////////////////////////////////////////////
+// ExampleStatistics.ipp
+//
+// The statistics file is plain text:
+//
+//     points P N
+//     point <N values>                      (P lines)
+//     example <filename> <checksum> <point> <function>
+//     gradient K <K index-value pairs>
+//     curvature K <K index-value pairs>    (one triple per example)
+//
+// where N is the number of parameters.
+//////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////
+// ExampleStatistic::~ExampleStatistic()
+//
+// Destructor.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+ExampleStatistic<RealT>::~ExampleStatistic()
+{}
+
+//////////////////////////////////////////////////////////////////////
+// ExampleStatistics::ExampleStatistics()
+//
+// Constructor.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+ExampleStatistics<RealT>::ExampleStatistics(int num_parameters) :
+    num_parameters(num_parameters)
+{}
+
+//////////////////////////////////////////////////////////////////////
+// ExampleStatistics::ComputeChecksum()
+//
+// FNV-1a hash of the file contents.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+unsigned int ExampleStatistics<RealT>::ComputeChecksum(const std::string &filename)
+{
+    std::ifstream infile(filename.c_str(), std::ios::binary);
+    if (infile.fail()) Error(("Could not open file \"" + filename + "\" for reading.").c_str());
+
+    unsigned int checksum = 2166136261u;
+    char c;
+    while (infile.get(c))
+    {
+        checksum ^= (unsigned char) c;
+        checksum *= 16777619u;
+    }
+    return checksum;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ExampleStatistics::Read()
+//
+// Read statistics from a file, replacing any currently stored.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ExampleStatistics<RealT>::Read(const std::string &filename)
+{
+    std::ifstream infile(filename.c_str());
+    if (infile.fail()) Error(("Could not open file \"" + filename + "\" for reading.").c_str());
+
+    std::string token;
+    int num_points, n;
+    if (!(infile >> token >> num_points >> n) || token != "points" || num_points < 0)
+        Error("Malformed statistics file: %s", filename.c_str());
+    if (n != num_parameters)
+        Error("Statistics file %s has %d parameters (expected %d).", filename.c_str(), n, num_parameters);
+
+    points.assign(num_points, std::vector<RealT>(num_parameters));
+    for (int i = 0; i < num_points; i++)
+    {
+        if (!(infile >> token) || token != "point") Error("Malformed statistics file: %s", filename.c_str());
+        for (int j = 0; j < num_parameters; j++)
+            if (!(infile >> points[i][j])) Error("Malformed statistics file: %s", filename.c_str());
+    }
+
+    examples.clear();
+    while (infile >> token)
+    {
+        if (token != "example") Error("Malformed statistics file: %s", filename.c_str());
+        examples.push_back(ExampleStatistic<RealT>());
+        ExampleStatistic<RealT> &example = examples.back();
+        if (!(infile >> example.filename >> example.checksum >> example.point >> example.function) ||
+            example.point < 0 || example.point >= num_points)
+            Error("Malformed statistics file: %s", filename.c_str());
+
+        for (int k = 0; k < 2; k++)
+        {
+            std::vector<std::pair<int,RealT> > &entries = (k == 0 ? example.gradient : example.curvature);
+            int num_entries;
+            if (!(infile >> token >> num_entries) || token != (k == 0 ? "gradient" : "curvature") || num_entries < 0)
+                Error("Malformed statistics file: %s", filename.c_str());
+            entries.resize(num_entries);
+            for (int j = 0; j < num_entries; j++)
+                if (!(infile >> entries[j].first >> entries[j].second) || entries[j].first < 0 || entries[j].first >= num_parameters)
+                    Error("Malformed statistics file: %s", filename.c_str());
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// ExampleStatistics::Write()
+//
+// Write statistics to a file.  Expansion points no longer used by
+// any example are dropped; the rest keep their order.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ExampleStatistics<RealT>::Write(const std::string &filename) const
+{
+    std::vector<int> renumbered(points.size(), -1);
+    for (size_t i = 0; i < examples.size(); i++)
+        renumbered[examples[i].point] = 0;
+    int num_points = 0;
+    for (size_t i = 0; i < points.size(); i++)
+        if (renumbered[i] == 0) renumbered[i] = num_points++;
+
+    std::ofstream outfile(filename.c_str());
+    if (outfile.fail()) Error(("Could not open file \"" + filename + "\" for writing.").c_str());
+    outfile << std::setprecision(10);
+
+    outfile << "points " << num_points << " " << num_parameters << std::endl;
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        if (renumbered[i] == -1) continue;
+        const std::vector<RealT> &point = points[i];
+        outfile << "point";
+        for (size_t j = 0; j < point.size(); j++)
+            outfile << " " << point[j];
+        outfile << std::endl;
+    }
+
+    for (size_t i = 0; i < examples.size(); i++)
+    {
+        const ExampleStatistic<RealT> &example = examples[i];
+        outfile << "example " << example.filename << " " << example.checksum << " "
+                << renumbered[example.point] << " " << example.function << std::endl;
+        for (int k = 0; k < 2; k++)
+        {
+            const std::vector<std::pair<int,RealT> > &entries = (k == 0 ? example.gradient : example.curvature);
+            outfile << (k == 0 ? "gradient " : "curvature ") << entries.size();
+            for (size_t j = 0; j < entries.size(); j++)
+                outfile << " " << entries[j].first << " " << entries[j].second;
+            outfile << std::endl;
+        }
+    }
+    outfile.close();
+}
+
+//////////////////////////////////////////////////////////////////////
+// ExampleStatistics::AddPoint()
+// ExampleStatistics::AddExample()
+//
+// Add an expansion point, and the statistics of an example computed
+// there.  Any previous statistics for the same file are replaced.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+int ExampleStatistics<RealT>::AddPoint(const std::vector<RealT> &w)
+{
+    Assert(int(w.size()) == num_parameters, "Incorrect number of parameters.");
+    points.push_back(w);
+    return int(points.size()) - 1;
+}
+
+template<class RealT>
+void ExampleStatistics<RealT>::AddExample(const std::string &filename, unsigned int checksum, int point, const std::vector<RealT> &statistics)
+{
+    Assert(int(statistics.size()) == 2 * num_parameters + 1, "Unexpected statistics size.");
+    Assert(point >= 0 && point < int(points.size()), "Unknown expansion point.");
+
+    Remove(filename);
+    examples.push_back(ExampleStatistic<RealT>());
+    ExampleStatistic<RealT> &example = examples.back();
+    example.filename = filename;
+    example.checksum = checksum;
+    example.point = point;
+    example.function = statistics[num_parameters];
+    for (int j = 0; j < num_parameters; j++)
+    {
+        if (statistics[j] != RealT(0)) example.gradient.push_back(std::make_pair(j, statistics[j]));
+        if (statistics[num_parameters + 1 + j] != RealT(0)) example.curvature.push_back(std::make_pair(j, statistics[num_parameters + 1 + j]));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// ExampleStatistics::IsCurrent()
+// ExampleStatistics::Remove()
+// ExampleStatistics::Retain()
+//
+// Check whether statistics are stored for the given version of a
+// file, or drop those for a file or for all files not listed.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+bool ExampleStatistics<RealT>::IsCurrent(const std::string &filename, unsigned int checksum) const
+{
+    for (size_t i = 0; i < examples.size(); i++)
+        if (examples[i].filename == filename) return examples[i].checksum == checksum;
+    return false;
+}
+
+template<class RealT>
+void ExampleStatistics<RealT>::Remove(const std::string &filename)
+{
+    for (size_t i = 0; i < examples.size(); i++)
+    {
+        if (examples[i].filename == filename)
+        {
+            examples.erase(examples.begin() + i);
+            return;
+        }
+    }
+}
+
+template<class RealT>
+int ExampleStatistics<RealT>::Retain(const std::set<std::string> &filenames)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < examples.size(); i++)
+    {
+        if (filenames.count(examples[i].filename) == 0) continue;
+        if (kept != i) examples[kept] = examples[i];
+        kept++;
+    }
+    const int dropped = int(examples.size() - kept);
+    examples.resize(kept);
+    return dropped;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ExampleStatistics::ComputeApproximation()
+//
+// Sum the quadratic approximations of all stored examples.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void ExampleStatistics<RealT>::ComputeApproximation(std::vector<RealT> &curvature, std::vector<RealT> &slope, RealT &constant) const
+{
+    curvature.assign(num_parameters, RealT(0));
+    slope.assign(num_parameters, RealT(0));
+    constant = RealT(0);
+
+    for (size_t i = 0; i < examples.size(); i++)
+    {
+        const ExampleStatistic<RealT> &example = examples[i];
+        const std::vector<RealT> &point = points[example.point];
+        constant += example.function;
+        for (size_t j = 0; j < example.gradient.size(); j++)
+        {
+            const int k = example.gradient[j].first;
+            slope[k] += example.gradient[j].second;
+            constant -= example.gradient[j].second * point[k];
+        }
+        for (size_t j = 0; j < example.curvature.size(); j++)
+        {
+            const int k = example.curvature[j].first;
+            const RealT h = example.curvature[j].second;
+            curvature[k] += h;
+            slope[k] -= h * point[k];
+            constant += RealT(0.5) * h * point[k] * point[k];
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// ExampleStatistics::GetLastPoint()
+//
+// Most recently added expansion point.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+const std::vector<RealT> &ExampleStatistics<RealT>::GetLastPoint() const
+{
+    Assert(points.size() > 0, "No expansion points stored.");
+    return points.back();
+}
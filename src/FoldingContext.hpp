@@ -0,0 +1,128 @@
+//////////////////////////////////////////////////////////////////////
+// FoldingContext.hpp
+//
+// Embeddable interface for folding in-memory sequences.  A
+// FoldingModel holds a set of parameter values and is immutable once
+// constructed, so a single model may be shared among any number of
+// threads.  Each thread creates its own FoldingContext from the
+// model; a context owns its InferenceEngine and dynamic programming
+// matrices, and may be reused for many sequences without
+// reallocating.  Results are written into caller-provided buffers.
+//
+// A context must not be used by more than one thread at a time.
+// Errors in the input are reported through Error(), as elsewhere.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FOLDINGCONTEXT_HPP
+#define FOLDINGCONTEXT_HPP
+
+#include <string>
+#include <vector>
+#include "Config.hpp"
+#include "SStruct.hpp"
+#include "InferenceEngine.hpp"
+#include "ParameterManager.hpp"
+#include "Utilities.hpp"
+
+// default parameters (see Defaults.ipp)
+template<class RealT>
+std::vector<RealT> GetDefaultComplementaryValues();
+template<class RealT>
+std::vector<RealT> GetDefaultNoncomplementaryValues();
+template<class RealT>
+std::vector<RealT> GetDefaultProfileValues();
+
+//////////////////////////////////////////////////////////////////////
+// class FoldingModel
+//
+// Read-only parameter set shared by folding contexts.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+class FoldingModel
+{
+    bool allow_noncomplementary;
+    int num_data_sources;
+    std::vector<RealT> values;
+
+public:
+
+    // constructors: built-in defaults, parameter file, or explicit values
+    FoldingModel(bool allow_noncomplementary);
+    FoldingModel(const std::string &parameter_filename, bool allow_noncomplementary, int num_data_sources);
+    FoldingModel(const std::vector<RealT> &values, bool allow_noncomplementary, int num_data_sources);
+
+    // getters
+    bool GetAllowNoncomplementary() const { return allow_noncomplementary; }
+    int GetNumDataSources() const { return num_data_sources; }
+    const std::vector<RealT> &GetValues() const { return values; }
+};
+
+//////////////////////////////////////////////////////////////////////
+// class FoldingContext
+//
+// Per-thread folding state.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+class FoldingContext
+{
+    const FoldingModel<RealT> &model;
+    ParameterManager<RealT> parameter_manager;
+    InferenceEngine<RealT> inference_engine;
+    SStruct sstruct;
+    bool use_evidence;
+    bool inside_done;
+    bool posterior_done;
+
+    // disallow copying; the parameter manager points into the engine
+    FoldingContext(const FoldingContext &rhs);
+    FoldingContext &operator=(const FoldingContext &rhs);
+
+    void RunPosterior();
+    void WriteMapping(const std::vector<int> &mapping, int *buffer) const;
+
+public:
+
+    // constructor and destructor
+    FoldingContext(const FoldingModel<RealT> &model);
+    ~FoldingContext();
+
+    // load a raw sequence, or a previously parsed SStruct (which may
+    // carry evidence for the model's data sources)
+    void LoadSequence(const std::string &sequence);
+    void LoadSequence(const SStruct &sstruct);
+
+    // buffer sizes for the current sequence: mappings have
+    // GetLength()+1 entries (1-based, entry 0 unused); posterior
+    // matrices have GetPosteriorSize() entries in upper-triangular
+    // order (see InferenceEngine)
+    int GetLength() const { return sstruct.GetLength(); }
+    int GetPosteriorSize() const { return inference_engine.GetPosteriorSize(); }
+
+    // request transparent huge pages for the dynamic programming
+    // matrices; contexts are NUMA-local if created and used by a
+    // thread pinned to one node
+    void UseHugePages(bool toggle) { inference_engine.UseHugePages(toggle); }
+
+    // Viterbi (maximum scoring) structure; returns its score
+    RealT Fold(int *mapping);
+
+    // log partition coefficient
+    RealT ComputeLogPartitionCoefficient();
+
+    // base-pairing posterior probabilities
+    void ComputePosterior(RealT *posterior, RealT posterior_cutoff = RealT(0));
+
+    // maximum expected accuracy and centroid decoding
+    void PredictMEA(int *mapping, RealT gamma);
+    void PredictCentroid(int *mapping, RealT gamma);
+
+    // ensemble defect and expected accuracy of a mapping, such as one
+    // returned by the decoding routines above
+    ExpectedAccuracy<RealT> ComputeExpectedAccuracy(const int *mapping, RealT gamma);
+};
+
+#include "FoldingContext.ipp"
+
+#endif
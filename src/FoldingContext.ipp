@@ -0,0 +1,214 @@
+//////////////////////////////////////////////////////////////////////
+// FoldingContext.ipp
+//////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////
+// FoldingModel::FoldingModel()
+//
+// Constructors.  The parameter file is parsed using a temporary
+// inference engine, which is needed to define the parameter names.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+FoldingModel<RealT>::FoldingModel(bool allow_noncomplementary) :
+    allow_noncomplementary(allow_noncomplementary),
+    num_data_sources(0)
+{
+#if PROFILE
+    values = GetDefaultProfileValues<RealT>();
+#else
+    if (allow_noncomplementary)
+        values = GetDefaultNoncomplementaryValues<RealT>();
+    else
+        values = GetDefaultComplementaryValues<RealT>();
+#endif
+}
+
+template<class RealT>
+FoldingModel<RealT>::FoldingModel(const std::string &parameter_filename, bool allow_noncomplementary, int num_data_sources) :
+    allow_noncomplementary(allow_noncomplementary),
+    num_data_sources(num_data_sources)
+{
+    ParameterManager<RealT> parameter_manager;
+    InferenceEngine<RealT> inference_engine(allow_noncomplementary, num_data_sources);
+    inference_engine.RegisterParameters(parameter_manager);
+    parameter_manager.ReadFromFile(parameter_filename, values);
+}
+
+template<class RealT>
+FoldingModel<RealT>::FoldingModel(const std::vector<RealT> &values, bool allow_noncomplementary, int num_data_sources) :
+    allow_noncomplementary(allow_noncomplementary),
+    num_data_sources(num_data_sources),
+    values(values)
+{}
+
+//////////////////////////////////////////////////////////////////////
+// FoldingContext::FoldingContext()
+// FoldingContext::~FoldingContext()
+//
+// Constructor and destructor.  Parameter values are loaded once
+// here; loading a new sequence does not disturb them.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+FoldingContext<RealT>::FoldingContext(const FoldingModel<RealT> &model) :
+    model(model),
+    inference_engine(model.GetAllowNoncomplementary(), model.GetNumDataSources()),
+    use_evidence(false),
+    inside_done(false),
+    posterior_done(false)
+{
+    inference_engine.RegisterParameters(parameter_manager);
+    inference_engine.LoadValues(model.GetValues());
+}
+
+template<class RealT>
+FoldingContext<RealT>::~FoldingContext()
+{}
+
+//////////////////////////////////////////////////////////////////////
+// FoldingContext::LoadSequence()
+//
+// Load a sequence for subsequent queries.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void FoldingContext<RealT>::LoadSequence(const std::string &sequence)
+{
+    sstruct.LoadFromSequence("", sequence, model.GetNumDataSources());
+    LoadSequence(sstruct);
+}
+
+template<class RealT>
+void FoldingContext<RealT>::LoadSequence(const SStruct &sstruct)
+{
+    if (&sstruct != &this->sstruct) this->sstruct = sstruct;
+    use_evidence = (model.GetNumDataSources() > 0 && this->sstruct.HasEvidence());
+    inside_done = posterior_done = false;
+
+    inference_engine.LoadSequence(this->sstruct);
+    inference_engine.UpdateEvidenceStructures();
+}
+
+//////////////////////////////////////////////////////////////////////
+// FoldingContext::RunPosterior()
+//
+// Run inside, outside and posterior computations if not already
+// done for the current sequence.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void FoldingContext<RealT>::RunPosterior()
+{
+    if (posterior_done) return;
+    if (use_evidence)
+    {
+        if (!inside_done) inference_engine.ComputeInsideESS();
+        inference_engine.ComputeOutsideESS();
+        inference_engine.ComputePosteriorESS();
+    }
+    else
+    {
+        if (!inside_done) inference_engine.ComputeInside();
+        inference_engine.ComputeOutside();
+        inference_engine.ComputePosterior();
+    }
+    inside_done = posterior_done = true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// FoldingContext::WriteMapping()
+//
+// Copy a mapping into a caller-provided buffer.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void FoldingContext<RealT>::WriteMapping(const std::vector<int> &mapping, int *buffer) const
+{
+    for (size_t i = 0; i < mapping.size(); i++)
+        buffer[i] = mapping[i];
+}
+
+//////////////////////////////////////////////////////////////////////
+// FoldingContext::Fold()
+//
+// Compute the Viterbi structure and return its score.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+RealT FoldingContext<RealT>::Fold(int *mapping)
+{
+    if (use_evidence) Error("Viterbi parsing is not supported with evidence yet");
+    inference_engine.ComputeViterbi();
+    WriteMapping(inference_engine.PredictPairingsViterbi(), mapping);
+    return inference_engine.GetViterbiScore();
+}
+
+//////////////////////////////////////////////////////////////////////
+// FoldingContext::ComputeLogPartitionCoefficient()
+//
+// Run the inside algorithm and return the log partition
+// coefficient.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+RealT FoldingContext<RealT>::ComputeLogPartitionCoefficient()
+{
+    if (use_evidence)
+    {
+        if (!inside_done) inference_engine.ComputeInsideESS();
+        inside_done = true;
+        return inference_engine.ComputeLogPartitionCoefficientESS();
+    }
+    if (!inside_done) inference_engine.ComputeInside();
+    inside_done = true;
+    return inference_engine.ComputeLogPartitionCoefficient();
+}
+
+//////////////////////////////////////////////////////////////////////
+// FoldingContext::ComputePosterior()
+//
+// Write base-pairing posteriors below the cutoff as zero.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void FoldingContext<RealT>::ComputePosterior(RealT *posterior, RealT posterior_cutoff)
+{
+    RunPosterior();
+    inference_engine.GetPosterior(posterior, posterior_cutoff);
+}
+
+//////////////////////////////////////////////////////////////////////
+// FoldingContext::PredictMEA()
+// FoldingContext::PredictCentroid()
+//
+// Posterior decoding with the given sensitivity/specificity
+// tradeoff.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void FoldingContext<RealT>::PredictMEA(int *mapping, RealT gamma)
+{
+    RunPosterior();
+    WriteMapping(inference_engine.PredictPairingsPosterior(gamma), mapping);
+}
+
+template<class RealT>
+void FoldingContext<RealT>::PredictCentroid(int *mapping, RealT gamma)
+{
+    RunPosterior();
+    WriteMapping(inference_engine.PredictPairingsPosteriorCentroid(gamma), mapping);
+}
+
+//////////////////////////////////////////////////////////////////////
+// FoldingContext::ComputeExpectedAccuracy()
+//
+// Evaluate a mapping against the base-pairing posteriors.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+ExpectedAccuracy<RealT> FoldingContext<RealT>::ComputeExpectedAccuracy(const int *mapping, RealT gamma)
+{
+    RunPosterior();
+    return inference_engine.ComputeExpectedAccuracy(std::vector<int>(mapping, mapping + GetLength() + 1), gamma);
+}
@@ -6,6 +6,7 @@
 #define INFERENCEENGINE_HPP
 
 #include <queue>
+#include <unordered_map>
 #include <vector>
 #include <string>
 #include "Config.hpp"
@@ -14,6 +15,24 @@
 #include "Utilities.hpp"
 #include "LogSpace.hpp"
 
+//////////////////////////////////////////////////////////////////////
+// struct ExpectedAccuracy
+//
+// Accuracy of a predicted structure, in expectation over the
+// posterior distribution (see ComputeExpectedAccuracy()).
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+struct ExpectedAccuracy
+{
+    RealT ensemble_defect;      // expected number of mispredicted positions
+    RealT sensitivity;
+    RealT ppv;
+    RealT f1;
+    RealT mcc;
+    RealT mea_objective;        // objective of PredictPairingsPosterior()
+};
+
 //////////////////////////////////////////////////////////////////////
 // class InferenceEngine
 //////////////////////////////////////////////////////////////////////
@@ -27,6 +46,8 @@ class InferenceEngine
     unsigned char char_mapping[256];
     int is_complementary[M+1][M+1];
     bool cache_initialized;
+    bool use_huge_pages;
+    int max_span;
     ParameterManager<RealT> *parameter_manager;
     
     int num_data_sources;
@@ -39,13 +60,34 @@ class InferenceEngine
     // sequence data
     std::vector<int> s, offset;
 #if PROFILE
+    // alignment with identical rows merged (weights summed), stored
+    // column-major as A[i*num_unique_sequences+k]; identical columns
+    // share a column class
+    int num_unique_sequences;
     std::vector<int> A;
     std::vector<RealT> weights;
+    std::vector<int> column_class;
+    int num_column_classes;
+    std::map<const std::pair<RealT,RealT> *, std::unordered_map<long long, RealT> > profile_score_memo;
+
+    // slot of each allowed pair in the pairwise profile score tables
+    // (see BuildProfileIndex), or 0 for disallowed pairs
+    std::vector<int> profile_pair_index;
 #endif
     std::vector<int> allow_unpaired_position;
     std::vector<int> allow_unpaired, allow_paired;
     std::vector<RealT> loss_unpaired_position;
+#if defined(HAMMING_LOSS)
     std::vector<RealT> loss_unpaired, loss_paired;
+#endif
+
+    // with sparse tables (see UseSparseTables()), allow_unpaired and
+    // allow_paired are not allocated; ranges and pairs are checked
+    // against the constrained partner of each position (or UNKNOWN)
+    // and the number of letters 1..i that may not be unpaired
+    bool sparse_tables;
+    std::vector<int> constraint_mapping;
+    std::vector<int> forced_paired;
 
     enum TRACEBACK_TYPE {
 #if PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR
@@ -96,6 +138,74 @@ class InferenceEngine
     
     std::vector<RealT> posterior;
 
+    // posteriors of sparse tables, as the pairs (i,P(i,j)) with
+    // nonzero probability, by right end j and sorted by i
+    std::vector<std::vector<std::pair<int,RealT> > > sparse_posterior;
+
+#if BLOCKED_MULTI_SPLITS
+    // blocked multiloop split sums (see SumMultiSplitsBlocked()): FM
+    // rows and FM1 columns in blocks of MULTI_SPLIT_BLOCK, scaled and
+    // exponentiated, and the split sums of the current row block; row
+    // k of the packed FM holds columns k..k+multi_split_band only
+    std::vector<double> multi_split_rows, multi_split_row_scale;
+    std::vector<double> multi_split_columns, multi_split_column_scale;
+    std::vector<int> multi_split_row_offset;
+    std::vector<int> multi_split_rows_packed;
+    std::vector<RealT> multi_split_sums;
+    int multi_split_band, multi_split_block, multi_split_columns_end, multi_split_sums_end;
+#endif
+
+    // beam-pruned inference (see ComputeInsideBeam()); states are
+    // listed in the order in which each column is computed
+    enum BEAM_STATE_TYPE {
+        BEAM_FB,
+        BEAM_FM,
+        BEAM_FM2,
+        BEAM_FH,
+#if PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR
+        BEAM_FN,
+        BEAM_FE,
+#endif
+        BEAM_FC,
+        NUM_BEAM_STATE_TYPES
+    };
+
+    enum BEAM_TRACEBACK_TYPE {
+        BEAM_TB_HAIRPIN,
+        BEAM_TB_SINGLE,
+        BEAM_TB_MULTI,
+        BEAM_TB_LOOP,
+        BEAM_TB_STACKING,
+        BEAM_TB_HELIX,
+        BEAM_TB_PAIRED,
+        BEAM_TB_BRANCHES,
+        BEAM_TB_BIFURCATION,
+        BEAM_TB_UNPAIRED,
+        NUM_BEAM_TRACEBACK_TYPES
+    };
+
+    enum BEAM_MODE { BEAM_VITERBI, BEAM_INSIDE, BEAM_OUTSIDE };
+
+    struct BeamState
+    {
+        int i;
+        int traceback;
+        RealT inside;                                // Viterbi score in BEAM_VITERBI mode
+        RealT outside;
+
+        bool operator<(const BeamState &rhs) const { return i < rhs.i; }
+    };
+
+    int beam_width;
+    int beam_mode;
+    bool beam_use_evidence;
+    std::vector<std::vector<BeamState> > beam[NUM_BEAM_STATE_TYPES];   // kept states, by type and column, sorted by i
+    std::vector<BeamState> beam_column;              // column under construction
+    std::vector<BeamState> *beam_target;             // states receiving edges
+    std::vector<int> beam_index;                     // position of each i in *beam_target, or -1
+    std::vector<std::vector<int> > beam_hairpins;    // hairpins to be extended, by column
+    std::vector<std::vector<int> > beam_order;       // FM states of each column, best first (Viterbi only)
+
     // parameters
 
     std::vector<std::vector<double> > score_unpaired_position;
@@ -188,8 +298,11 @@ class InferenceEngine
     std::pair<RealT,RealT> score_external_paired;
 #endif
 
-    std::vector<std::vector<std::vector<std::vector<std::pair<RealT,RealT> > > > > log_score_evidence;
-    // a vector of: std::pair<RealT,RealT> log_score_evidence_dms[2][M][2];  // dim0: k or theta and dim1: A,C,G,T and dim2: paired (0),unpaired (1)
+    // evidence gamma parameters, laid out as
+    // log_score_evidence[num_data_sources][2][M][2], with dimensions data
+    // source, k or theta, A,C,G,T and paired (0), unpaired (1); see
+    // EvidenceIndex()
+    std::vector<std::pair<RealT,RealT> > log_score_evidence;
     
 #if PROFILE
 
@@ -243,7 +356,19 @@ class InferenceEngine
 
     // cache
     std::pair<RealT,RealT> cache_score_single[C_MAX_SINGLE_LENGTH+1][C_MAX_SINGLE_LENGTH+1];
-    std::vector<std::pair<RealT,RealT> > cache_score_helix_sums;
+#if FAST_HELIX_LENGTHS
+    // helix partial sums for a band of rows (see ExtendHelixSums)
+    std::vector<RealT> cache_score_helix_sums;
+    int helix_sums_rows;
+    int helix_sums_low;
+    int helix_sums_high;
+    bool helix_sums_evidence;
+
+    void ResetHelixSums(bool use_evidence);
+    void ExtendHelixSums(int low, int high);
+    RealT ScoreHelixSumsTerm(int i, int j) const;
+    RealT ScoreHelixSums(int i, int j, int m) const;
+#endif
 
     void FillScores(typename std::vector<std::pair<RealT, RealT> >::iterator begin, typename std::vector<std::pair<RealT, RealT> >::iterator end, RealT value);
     void FillCounts(typename std::vector<std::pair<RealT, RealT> >::iterator begin, typename std::vector<std::pair<RealT, RealT> >::iterator end, RealT value);
@@ -269,6 +394,45 @@ class InferenceEngine
     int EncodeTraceback(int i, int j) const;
     std::pair<int,int> DecodeTraceback(int s) const;
 
+    // largest j-i of a matrix entry (i,j) that can lie inside an
+    // allowed base-pair; entries beyond it are left at their initial
+    // values
+    int MaxEntrySpan() const { return max_span > 0 ? std::min(max_span-1, L) : L; }
+
+    // whether letters i+1..j may all be unpaired, and whether letters
+    // i and j may pair
+    bool AllowUnpaired(int i, int j) const { return sparse_tables ? forced_paired[i] == forced_paired[j] : allow_unpaired[offset[i]+j] != 0; }
+    bool AllowPaired(int i, int j) const { return sparse_tables ? ComputeAllowPaired(i,j) : allow_paired[offset[i]+j] != 0; }
+    bool ComputeAllowPaired(int i, int j) const;
+
+    template<class T> void AllocateTable(std::vector<T> &table, int size, const T &value);
+    void FillMultiSplitCandidates(std::vector<int> &candidates, const std::vector<RealT> &FM1, int i) const;
+#if BLOCKED_MULTI_SPLITS
+    void ResetMultiSplitBlocks();
+    void PackMultiSplitRows(const std::vector<RealT> &FM, int k0);
+    void PackMultiSplitColumns(const std::vector<RealT> &FM1, int i0, int k0);
+    void ComputeMultiSplitTile(const std::vector<RealT> &FM1, const std::vector<RealT> &FM, int i0, int j0);
+    RealT SumMultiSplitsBlocked(const std::vector<RealT> &FM1, const std::vector<RealT> &FM, int i, int j);
+#endif
+
+    RealT BeamScoreBasePair(int i, int j) const;
+    RealT BeamScoreHairpin(int i, int j) const;
+    RealT BeamScoreHelix(int i, int j, int m) const;
+    RealT BeamScoreSingle(int i, int j, int p, int q) const;
+    RealT BeamScoreMultiUnpaired(int i) const;
+    RealT BeamScoreExternalUnpaired(int i) const;
+    RealT BeamEdge(int i, RealT score, BeamState *a, BeamState *b, int traceback);
+    void BeamExtendHairpin(int i, int j);
+    void BeamBifurcations(int j);
+    void BeamColumn(int type, int j);
+    void BeamPrune(int type, int j);
+    void BeamExternal(int j);
+    void BeamAddPosterior(int i, int j, RealT probability);
+    void BeamFinishPosterior(int j);
+    void ComputeBeam(int mode);
+    const BeamState *FindBeamState(int type, int i, int j) const;
+
+
     std::vector<RealT> GetCounts();
     void ClearCounts();
     void InitializeCache();
@@ -300,6 +464,16 @@ class InferenceEngine
 
 
 #if PROFILE
+    void BuildProfileIndex();
+
+    // slots in the pairwise profile score tables: the pair (i,j), the
+    // single-branch loop closed by (i,j+1), and the junction at (i,j)
+    // as used by ScoreJunctionA() and ScoreJunctionB(), which lies
+    // inside the pair (i,j+1) if i <= j and outside the pair (j+1,i)
+    // otherwise
+    int ProfilePairIndex(int i, int j) const { return i < j ? profile_pair_index[offset[i]+j] : 0; }
+    int ProfileLoopIndex(int i, int j) const { return i <= j && j < L ? profile_pair_index[offset[i]+j+1] : 0; }
+    int ProfileJunctionIndex(int i, int j) const { return i <= j ? 2*ProfileLoopIndex(i,j) : 2*profile_pair_index[offset[j+1]+i]+1; }
     void ComputeProfileScore(RealT &profile_score, const int *pos, int dimensions, std::pair<RealT,RealT> *table);
     void ConvertProfileCount(const RealT &profile_score, const int *pos, int dimensions, std::pair<RealT,RealT> *table);
 #endif
@@ -318,13 +492,32 @@ public:
     
     // load parameter values                        
     void LoadValues(const std::vector<RealT> &values);
+
+    // request transparent huge pages for the dynamic programming matrices
+    void UseHugePages(bool toggle) { use_huge_pages = toggle; }
+
+    // forbid base-pairs (i,j) with j-i > span in sequences loaded
+    // afterwards (span = 0 for no limit); the dynamic programming
+    // matrices are then filled only within this band
+    void UseMaxSpan(int span) { max_span = span; }
+
+    // for beam-pruned inference of sequences loaded afterwards, keep
+    // the constraints per position and the posteriors sparse instead
+    // of allocating O(L^2) tables; exact inference is then unavailable
+    void UseSparseTables(bool toggle) { sparse_tables = toggle; }
+    bool UsesSparseTables() const { return sparse_tables; }
     
     // load loss function
     void UseLoss(const std::vector<int> &true_mapping, RealT example_loss);
+    RealT ComputeLoss(const std::vector<int> &true_mapping, const std::vector<int> &solution, RealT example_loss) const;
 
     // use constraints
     void UseConstraints(const std::vector<int> &true_mapping);
 
+    // check whether a fully known structure can be parsed (does not
+    // require the sequence to be loaded)
+    bool IsParsable(const SStruct &sstruct) const;
+
     // Viterbi inference
     void ComputeViterbi();
     RealT GetViterbiScore() const;
@@ -339,7 +532,22 @@ public:
     void ComputePosterior();
     std::vector<int> PredictPairingsPosterior(const RealT gamma) const;
     std::vector<int> PredictPairingsPosteriorCentroid(const RealT gamma) const;
+    std::vector<int> PredictPairingsPosteriorSparse(const RealT gamma, const bool centroid) const;
+    ExpectedAccuracy<RealT> ComputeExpectedAccuracy(const std::vector<int> &mapping, const RealT gamma) const;
     RealT *GetPosterior(const RealT posterior_cutoff) const;
+    void GetPosterior(RealT *ret, const RealT posterior_cutoff) const;
+    void GetPosterior(std::vector<std::vector<std::pair<int,RealT> > > &ret, const RealT posterior_cutoff) const;
+    void LoadPosterior(const std::vector<RealT> &values);
+    void LoadPosterior(const std::vector<std::vector<std::pair<int,RealT> > > &values);
+    int GetLength() const { return L; }
+    int GetPosteriorSize() const { return SIZE; }
+
+    // beam-pruned inference; GetViterbiScore() and
+    // ComputeLogPartitionCoefficient() apply as for exact inference
+    void ComputeViterbiBeam(int beam_width, bool use_evidence = false);
+    std::vector<int> PredictPairingsViterbiBeam() const;
+    void ComputeInsideBeam(int beam_width, bool use_evidence = false);
+    void ComputePosteriorBeam();
     
     // EM inference
     void ComputeInsideESS();
@@ -359,7 +567,8 @@ public:
     int AreZerosInSeqPairing(int id_base, int id_pairings, int which_base);  
     int AreZerosInSeq(int id_base, int which_base);  
 
-    std::pair<RealT,RealT>* GetLogScoreEvidence(int i, int j, int k, int which_data) { return &log_score_evidence[which_data][i][j][k]; }
+    int EvidenceIndex(int which_data, int i, int j, int k) const { return ((which_data * 2 + i) * M + j) * 2 + k; }
+    std::pair<RealT,RealT>* GetLogScoreEvidence(int i, int j, int k, int which_data) { return &log_score_evidence[EvidenceIndex(which_data,i,j,k)]; }
     
     double LogGammaProb(RealT data, int which_data, int isUnpaired, int seq);
     void UpdateEvidenceStructures(int which_data);
@@ -191,8 +191,8 @@ RealT InferenceEngine<RealT>::ScoreUnpairedEvidence(int i, int j) const
 
 #if PARAMS_HELIX_STACKING
 #if PROFILE
-#define ScoreHelixStacking(i,j) profile_score_helix_stacking[i*(L+1)+j].first
-#define CountHelixStacking(i,j,v) { profile_score_helix_stacking[i*(L+1)+j].second += (v); }
+#define ScoreHelixStacking(i,j) profile_score_helix_stacking[ProfilePairIndex(i,j)].first
+#define CountHelixStacking(i,j,v) { profile_score_helix_stacking[ProfilePairIndex(i,j)].second += (v); }
 #else
 #define ScoreHelixStacking(i,j) score_helix_stacking[s[i]][s[j]][s[i+1]][s[j-1]].first
 #define CountHelixStacking(i,j,v) { score_helix_stacking[s[i]][s[j]][s[i+1]][s[j-1]].second += (v); }
@@ -290,9 +290,11 @@ bool InferenceEngine<RealT>::IsComplementary(int i, int j) const
     RealT complementary_weight = 0;
     RealT total_weight = 0;
 
-    for (int k = 0; k < N; k++)
+    const int *col_i = &A[i*num_unique_sequences];
+    const int *col_j = &A[j*num_unique_sequences];
+    for (int k = 0; k < num_unique_sequences; k++)
     {
-        if (is_complementary[A[k*(L+1)+i]][A[k*(L+1)+j]]) complementary_weight += weights[k];
+        if (is_complementary[col_i[k]][col_j[k]]) complementary_weight += weights[k];
         total_weight += weights[k];
     }
 
@@ -310,6 +312,8 @@ template<class RealT>
 InferenceEngine<RealT>::InferenceEngine(bool allow_noncomplementary, const int num_data_sources) :
     allow_noncomplementary(allow_noncomplementary),
     cache_initialized(false),
+    use_huge_pages(false),
+    max_span(0),
     parameter_manager(NULL),
     num_data_sources(num_data_sources),
     L(0),
@@ -317,6 +321,15 @@ InferenceEngine<RealT>::InferenceEngine(bool allow_noncomplementary, const int n
 #if PROFILE
     , N(0)
     , SIZE2(0)
+    , num_unique_sequences(0)
+    , num_column_classes(0)
+#endif
+    , sparse_tables(false)
+#if FAST_HELIX_LENGTHS
+    , helix_sums_rows(1)
+    , helix_sums_low(0)
+    , helix_sums_high(-1)
+    , helix_sums_evidence(false)
 #endif
 
 {
@@ -340,25 +353,22 @@ InferenceEngine<RealT>::InferenceEngine(bool allow_noncomplementary, const int n
         is_complementary[char_mapping[BYTE('C')]][char_mapping[BYTE('G')]] = 
         is_complementary[char_mapping[BYTE('G')]][char_mapping[BYTE('C')]] = 1;
 
-    log_score_evidence.resize(num_data_sources);
+    log_score_evidence.resize(num_data_sources * 2 * M * 2);
 
     score_unpaired_position.resize(num_data_sources);
     score_paired_position.resize(num_data_sources);
     score_unpaired_position_raw.resize(num_data_sources);
     score_paired_position_raw.resize(num_data_sources);
 
-    for (int i = 0; i < num_data_sources; i++)
-    {
-        log_score_evidence[i].resize(2);
-        for (int j = 0; j < 2; j++)
-        {
-            log_score_evidence[i][j].resize(M);
-            for (int k = 0; k < M; k++)
-            {
-                log_score_evidence[i][j][k].resize(2);
-            }
-        }
-    }
+#if FAST_HELIX_LENGTHS
+    // the helix partial sums band must cover every row read while
+    // filling one block of rows of the inside matrices
+#if BLOCKED_MULTI_SPLITS
+    while (helix_sums_rows < D_MAX_HELIX_LENGTH + MULTI_SPLIT_BLOCK) helix_sums_rows *= 2;
+#else
+    while (helix_sums_rows < D_MAX_HELIX_LENGTH + 1) helix_sums_rows *= 2;
+#endif
+#endif
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -925,7 +935,7 @@ void InferenceEngine<RealT>::RegisterParameters(ParameterManager<RealT> &paramet
                     sprintf(buffer, "log_score_evidence%d_theta_%c%d", num_data_sources_current,alphabet[i1],i2);
                 }
 
-                parameter_manager.AddParameterMapping(buffer, &log_score_evidence[num_data_sources_current][i0][i1][i2]);
+                parameter_manager.AddParameterMapping(buffer, &log_score_evidence[EvidenceIndex(num_data_sources_current,i0,i1,i2)]);
             }
         }
     }
@@ -937,8 +947,8 @@ void InferenceEngine<RealT>::RegisterParameters(ParameterManager<RealT> &paramet
 template<class RealT>
 double InferenceEngine<RealT>::LogGammaProb(RealT data, int which_data, int isUnpaired, int seq)
 {
-    RealT k = exp(log_score_evidence[which_data][0][seq][isUnpaired].first);
-    RealT theta = exp(log_score_evidence[which_data][1][seq][isUnpaired].first);
+    RealT k = exp(log_score_evidence[EvidenceIndex(which_data,0,seq,isUnpaired)].first);
+    RealT theta = exp(log_score_evidence[EvidenceIndex(which_data,1,seq,isUnpaired)].first);
 
     if (data < DATA_LOW_THRESH)
         return log(DATA_LOW_THRESH);
@@ -967,28 +977,32 @@ void InferenceEngine<RealT>::LoadSequence(const SStruct &sstruct)
 #endif
 
     
-    // allocate memory
+    // allocate memory; with sparse tables, the O(L^2) constraint
+    // tables are released instead
     s.resize(L+1);
-#if PROFILE
-    A.resize(N*(L+1));
-    weights.resize(N);
-#endif
     offset.resize(L+1);
     allow_unpaired_position.resize(L+1);
-    allow_unpaired.resize(SIZE);
-    allow_paired.resize(SIZE);
+    if (sparse_tables)
+    {
+        std::vector<int>().swap(allow_unpaired);
+        std::vector<int>().swap(allow_paired);
+        std::vector<RealT>().swap(posterior);
+    }
+    else
+    {
+        allow_unpaired.resize(SIZE);
+        allow_paired.resize(SIZE);
+    }
+    constraint_mapping.assign(L+1, SStruct::UNKNOWN);
+    forced_paired.assign(L+1, 0);
     loss_unpaired_position.resize(L+1);
+#if defined(HAMMING_LOSS)
     loss_unpaired.resize(SIZE);
     loss_paired.resize(SIZE);
+#endif
         
 #if PROFILE
 
-#if PARAMS_BASE_PAIR
-    profile_score_base_pair.clear();                 profile_score_base_pair.resize(SIZE2);
-#endif
-#if PARAMS_TERMINAL_MISMATCH
-    profile_score_terminal_mismatch.clear();         profile_score_terminal_mismatch.resize(SIZE2);
-#endif
 #if PARAMS_HAIRPIN_3_NUCLEOTIDES
     profile_score_hairpin_3_nucleotides.clear();     profile_score_hairpin_3_nucleotides.resize(L+1);
 #endif
@@ -1007,31 +1021,14 @@ void InferenceEngine<RealT>::LoadSequence(const SStruct &sstruct)
     profile_score_bulge_0x3_nucleotides.clear();     profile_score_bulge_0x3_nucleotides.resize(L+1);
     profile_score_bulge_3x0_nucleotides.clear();     profile_score_bulge_3x0_nucleotides.resize(L+1);
 #endif
-#if PARAMS_INTERNAL_1x1_NUCLEOTIDES
-    profile_score_internal_1x1_nucleotides.clear();  profile_score_internal_1x1_nucleotides.resize(SIZE2);
-#endif
-#if PARAMS_INTERNAL_1x2_NUCLEOTIDES
-    profile_score_internal_1x2_nucleotides.clear();  profile_score_internal_1x2_nucleotides.resize(SIZE2);
-    profile_score_internal_2x1_nucleotides.clear();  profile_score_internal_2x1_nucleotides.resize(SIZE2);
-#endif
-#if PARAMS_INTERNAL_2x2_NUCLEOTIDES
-    profile_score_internal_2x2_nucleotides.clear();  profile_score_internal_2x2_nucleotides.resize(SIZE2);
-#endif
-#if PARAMS_HELIX_STACKING
-    profile_score_helix_stacking.clear();            profile_score_helix_stacking.resize(SIZE2);
-#endif
-#if PARAMS_HELIX_CLOSING
-    profile_score_helix_closing.clear();             profile_score_helix_closing.resize(SIZE2);
-#endif
-#if PARAMS_DANGLE
-    profile_score_dangle_left.clear();               profile_score_dangle_left.resize(SIZE2);
-    profile_score_dangle_right.clear();              profile_score_dangle_right.resize(SIZE2);
-#endif
 
 #endif
 
 #if FAST_HELIX_LENGTHS
-    cache_score_helix_sums.clear();                  cache_score_helix_sums.resize((2*L+1)*L);
+    // the beam-pruned sweeps sum helices directly
+    cache_score_helix_sums.clear();                  cache_score_helix_sums.resize(sparse_tables ? 0 : helix_sums_rows*(L+1));
+    helix_sums_low = 0;
+    helix_sums_high = -1;
 #endif
 
     // convert sequences to index representation
@@ -1043,17 +1040,57 @@ void InferenceEngine<RealT>::LoadSequence(const SStruct &sstruct)
     }
 
 #if PROFILE
+    // merge identical aligned sequences, summing their weights; the
+    // profile scores are linear in the weights, so this is exact
     const std::vector<std::string> &alignment = sstruct.GetSequences();
+    const std::vector<double> sequence_weights = sstruct.ComputePositionBasedSequenceWeights();
+    std::map<std::string, int> row_index;
+    std::vector<std::string> rows;
+    weights.clear();
     for (int k = 0; k < N; k++)
     {
-        A[k*(L+1)+0] = BYTE(alphabet.size());
+        std::string row(L+1, char(alphabet.size()));
         for (int i = 1; i <= L; i++)
+            row[i] = char(char_mapping[BYTE(alignment[k][i])]);
+        
+        std::map<std::string, int>::iterator iter = row_index.find(row);
+        if (iter == row_index.end())
         {
-            A[k*(L+1)+i] = char_mapping[BYTE(alignment[k][i])];
+            row_index[row] = int(rows.size());
+            rows.push_back(row);
+            weights.push_back(RealT(sequence_weights[k]));
+        }
+        else
+        {
+            weights[iter->second] += RealT(sequence_weights[k]);
         }
     }
+    num_unique_sequences = int(rows.size());
+
+    // store columns contiguously, and assign identical columns to
+    // the same column class
+    A.resize(num_unique_sequences*(L+1));
+    column_class.resize(L+1);
+    std::map<std::string, int> column_index;
+    for (int i = 0; i <= L; i++)
+    {
+        std::string column(num_unique_sequences, char(0));
+        for (int k = 0; k < num_unique_sequences; k++)
+            column[k] = rows[k][i];
+        std::copy(column.begin(), column.end(), A.begin() + i*num_unique_sequences);
 
-    weights = ConvertVector<RealT>(sstruct.ComputePositionBasedSequenceWeights());
+        std::map<std::string, int>::iterator iter = column_index.find(column);
+        if (iter == column_index.end())
+        {
+            column_class[i] = int(column_index.size());
+            column_index[column] = column_class[i];
+        }
+        else
+        {
+            column_class[i] = iter->second;
+        }
+    }
+    num_column_classes = int(column_index.size());
 #endif
     
     // compute indexing scheme for upper triangular arrays;
@@ -1066,37 +1103,31 @@ void InferenceEngine<RealT>::LoadSequence(const SStruct &sstruct)
         loss_unpaired_position[i] = RealT(0);
     }
 
-    // allow all ranges to be unpaired, and all pairs of letters
-    // to be paired; set the respective losses to zero    
-    for (int i = 0; i < SIZE; i++)
-    {
-        allow_unpaired[i] = 1;
-        allow_paired[i] = 1;
-        loss_unpaired[i] = RealT(0);
-        loss_paired[i] = RealT(0);
-    }
-
-    // prevent the non-letter before each sequence from pairing with anything;
-    // also prevent each letter from pairing with itself
-    for (int i = 0; i <= L; i++)
-    {
-        allow_paired[offset[0]+i] = 0;
-        allow_paired[offset[i]+i] = 0;
-    }
-
-    // enforce complementarity of base-pairings
-    if (!allow_noncomplementary)
+    // allow all ranges to be unpaired, and all complementary pairs
+    // of letters within the maximum span to be paired (see
+    // ComputeAllowPaired()); set the respective losses to zero
+    if (!sparse_tables)
     {
-        // for each pair of non-complementary letters in the sequence, disallow the pairing
-        for (int i = 1; i <= L; i++)
+        for (int i = 0; i <= L; i++)
         {
-            for (int j = i+1; j <= L; j++)
+            for (int j = i; j <= L; j++)
             {
-                if (!IsComplementary(i,j))
-                    allow_paired[offset[i]+j] = 0;
+                allow_unpaired[offset[i]+j] = 1;
+                allow_paired[offset[i]+j] = ComputeAllowPaired(i,j);
             }
         }
     }
+#if defined(HAMMING_LOSS)
+    for (int i = 0; i < SIZE; i++)
+    {
+        loss_unpaired[i] = RealT(0);
+        loss_paired[i] = RealT(0);
+    }
+#endif
+
+#if PROFILE
+    BuildProfileIndex();
+#endif
 
 #if PARAMS_EVIDENCE
     for (int i = 0; i < num_data_sources; i++)
@@ -1254,16 +1285,21 @@ void InferenceEngine<RealT>::InitializeCache()
     {
         for (int j = 0; j <= L; j++)
         {
+            const int pair_index = ProfilePairIndex(i,j);
+            const int loop_index = ProfileLoopIndex(i,j);
+            const int junction_index = ProfileJunctionIndex(i,j);
 #if PARAMS_BASE_PAIR
+            if (pair_index)
             {
                 const int pos[2] = {i, j};
-                ComputeProfileScore(profile_score_base_pair[i*(L+1)+j].first, pos, 2, reinterpret_cast<std::pair<RealT,RealT> *>(score_base_pair));
+                ComputeProfileScore(profile_score_base_pair[pair_index].first, pos, 2, reinterpret_cast<std::pair<RealT,RealT> *>(score_base_pair));
             }
 #endif
 #if PARAMS_TERMINAL_MISMATCH
+            if (junction_index > 1)
             {
                 const int pos[4] = {i, j+1, i+1, j};
-                ComputeProfileScore(profile_score_terminal_mismatch[i*(L+1)+j].first, pos, 4, reinterpret_cast<std::pair<RealT,RealT> *>(score_terminal_mismatch));
+                ComputeProfileScore(profile_score_terminal_mismatch[junction_index].first, pos, 4, reinterpret_cast<std::pair<RealT,RealT> *>(score_terminal_mismatch));
             }
 #endif
 #if PARAMS_HAIRPIN_3_NUCLEOTIDES
@@ -1317,70 +1353,69 @@ void InferenceEngine<RealT>::InitializeCache()
             }
 #endif            
 #if PARAMS_INTERNAL_1x1_NUCLEOTIDES
+            if (loop_index)
             {
                 const int pos[2] = {i+1, j};
-                ComputeProfileScore(profile_score_internal_1x1_nucleotides[i*(L+1)+j].first, pos, 2, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_1x1_nucleotides));
+                ComputeProfileScore(profile_score_internal_1x1_nucleotides[loop_index].first, pos, 2, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_1x1_nucleotides));
             }
 #endif            
 #if PARAMS_INTERNAL_1x2_NUCLEOTIDES
+            if (loop_index)
             {
                 const int pos[3] = {i+1, j-1, j};
-                ComputeProfileScore(profile_score_internal_1x2_nucleotides[i*(L+1)+j].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_1x2_nucleotides));
+                ComputeProfileScore(profile_score_internal_1x2_nucleotides[loop_index].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_1x2_nucleotides));
             }
+            if (loop_index)
             {
                 const int pos[3] = {i+1, i+2, j};
-                ComputeProfileScore(profile_score_internal_2x1_nucleotides[i*(L+1)+j].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_2x1_nucleotides));
+                ComputeProfileScore(profile_score_internal_2x1_nucleotides[loop_index].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_2x1_nucleotides));
             }
 #endif            
 #if PARAMS_INTERNAL_2x2_NUCLEOTIDES
+            if (loop_index)
             {
                 const int pos[4] = {i+1, i+2, j-1, j};
-                ComputeProfileScore(profile_score_internal_2x2_nucleotides[i*(L+1)+j].first, pos, 4, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_2x2_nucleotides));
+                ComputeProfileScore(profile_score_internal_2x2_nucleotides[loop_index].first, pos, 4, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_2x2_nucleotides));
             }
 #endif     
 #if PARAMS_HELIX_STACKING
+            if (pair_index)
             {
                 const int pos[4] = {i, j, i+1, j-1};
-                ComputeProfileScore(profile_score_helix_stacking[i*(L+1)+j].first, pos, 4, reinterpret_cast<std::pair<RealT,RealT> *>(score_helix_stacking));
+                ComputeProfileScore(profile_score_helix_stacking[pair_index].first, pos, 4, reinterpret_cast<std::pair<RealT,RealT> *>(score_helix_stacking));
             }
 #endif
 #if PARAMS_HELIX_CLOSING
+            if (junction_index > 1)
             {
                 const int pos[2] = {i, j+1};
-                ComputeProfileScore(profile_score_helix_closing[i*(L+1)+j].first, pos, 2, reinterpret_cast<std::pair<RealT,RealT> *>(score_helix_closing));
+                ComputeProfileScore(profile_score_helix_closing[junction_index].first, pos, 2, reinterpret_cast<std::pair<RealT,RealT> *>(score_helix_closing));
             }
 #endif
 #if PARAMS_DANGLE
+            if (junction_index > 1)
             {
                 const int pos[3] = {i, j+1, i+1};
-                ComputeProfileScore(profile_score_dangle_left[i*(L+1)+j].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_dangle_left));
+                ComputeProfileScore(profile_score_dangle_left[junction_index].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_dangle_left));
             }
+            if (junction_index > 1)
             {
                 const int pos[3] = {i, j+1, j};
-                ComputeProfileScore(profile_score_dangle_right[i*(L+1)+j].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_dangle_right));
+                ComputeProfileScore(profile_score_dangle_right[junction_index].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_dangle_right));
             }
 #endif
         }
     }
 
+    // the memoized scores are only valid for the current parameters
+    profile_score_memo.clear();
+
 #endif
 
 #if FAST_HELIX_LENGTHS
-    // precompute helix partial sums
-    FillScores(cache_score_helix_sums.begin(), cache_score_helix_sums.end(), RealT(0));
-    for (int i = L; i >= 1; i--)
-    {
-        for (int j = i+3; j <= L; j++)
-        {
-            cache_score_helix_sums[(i+j)*L+j-i].first = cache_score_helix_sums[(i+j)*L+j-i-2].first;
-            if (allow_paired[offset[i+1]+j-1])
-            {
-                cache_score_helix_sums[(i+j)*L+j-i].first += ScoreBasePair(i+1,j-1);
-                if (allow_paired[offset[i]+j])
-                    cache_score_helix_sums[(i+j)*L+j-i].first += ScoreHelixStacking(i,j);
-            }
-        }
-    }
+    // helix partial sums are filled in as the dynamic programming
+    // sweeps reach them
+    ResetHelixSums(false);
 #endif
 
 }
@@ -1493,16 +1528,21 @@ void InferenceEngine<RealT>::InitializeCacheESS()
     {
         for (int j = 0; j <= L; j++)
         {
+            const int pair_index = ProfilePairIndex(i,j);
+            const int loop_index = ProfileLoopIndex(i,j);
+            const int junction_index = ProfileJunctionIndex(i,j);
 #if PARAMS_BASE_PAIR
+            if (pair_index)
             {
                 const int pos[2] = {i, j};
-                ComputeProfileScore(profile_score_base_pair[i*(L+1)+j].first, pos, 2, reinterpret_cast<std::pair<RealT,RealT> *>(score_base_pair));
+                ComputeProfileScore(profile_score_base_pair[pair_index].first, pos, 2, reinterpret_cast<std::pair<RealT,RealT> *>(score_base_pair));
             }
 #endif
 #if PARAMS_TERMINAL_MISMATCH
+            if (junction_index > 1)
             {
                 const int pos[4] = {i, j+1, i+1, j};
-                ComputeProfileScore(profile_score_terminal_mismatch[i*(L+1)+j].first, pos, 4, reinterpret_cast<std::pair<RealT,RealT> *>(score_terminal_mismatch));
+                ComputeProfileScore(profile_score_terminal_mismatch[junction_index].first, pos, 4, reinterpret_cast<std::pair<RealT,RealT> *>(score_terminal_mismatch));
             }
 #endif
 #if PARAMS_HAIRPIN_3_NUCLEOTIDES
@@ -1556,70 +1596,69 @@ void InferenceEngine<RealT>::InitializeCacheESS()
             }
 #endif
 #if PARAMS_INTERNAL_1x1_NUCLEOTIDES
+            if (loop_index)
             {
                 const int pos[2] = {i+1, j};
-                ComputeProfileScore(profile_score_internal_1x1_nucleotides[i*(L+1)+j].first, pos, 2, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_1x1_nucleotides));
+                ComputeProfileScore(profile_score_internal_1x1_nucleotides[loop_index].first, pos, 2, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_1x1_nucleotides));
             }
 #endif
 #if PARAMS_INTERNAL_1x2_NUCLEOTIDES
+            if (loop_index)
             {
                 const int pos[3] = {i+1, j-1, j};
-                ComputeProfileScore(profile_score_internal_1x2_nucleotides[i*(L+1)+j].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_1x2_nucleotides));
+                ComputeProfileScore(profile_score_internal_1x2_nucleotides[loop_index].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_1x2_nucleotides));
             }
+            if (loop_index)
             {
                 const int pos[3] = {i+1, i+2, j};
-                ComputeProfileScore(profile_score_internal_2x1_nucleotides[i*(L+1)+j].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_2x1_nucleotides));
+                ComputeProfileScore(profile_score_internal_2x1_nucleotides[loop_index].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_2x1_nucleotides));
             }
 #endif
 #if PARAMS_INTERNAL_2x2_NUCLEOTIDES
+            if (loop_index)
             {
                 const int pos[4] = {i+1, i+2, j-1, j};
-                ComputeProfileScore(profile_score_internal_2x2_nucleotides[i*(L+1)+j].first, pos, 4, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_2x2_nucleotides));
+                ComputeProfileScore(profile_score_internal_2x2_nucleotides[loop_index].first, pos, 4, reinterpret_cast<std::pair<RealT,RealT> *>(score_internal_2x2_nucleotides));
             }
 #endif
 #if PARAMS_HELIX_STACKING
+            if (pair_index)
             {
                 const int pos[4] = {i, j, i+1, j-1};
-                ComputeProfileScore(profile_score_helix_stacking[i*(L+1)+j].first, pos, 4, reinterpret_cast<std::pair<RealT,RealT> *>(score_helix_stacking));
+                ComputeProfileScore(profile_score_helix_stacking[pair_index].first, pos, 4, reinterpret_cast<std::pair<RealT,RealT> *>(score_helix_stacking));
             }
 #endif
 #if PARAMS_HELIX_CLOSING
+            if (junction_index > 1)
             {
                 const int pos[2] = {i, j+1};
-                ComputeProfileScore(profile_score_helix_closing[i*(L+1)+j].first, pos, 2, reinterpret_cast<std::pair<RealT,RealT> *>(score_helix_closing));
+                ComputeProfileScore(profile_score_helix_closing[junction_index].first, pos, 2, reinterpret_cast<std::pair<RealT,RealT> *>(score_helix_closing));
             }
 #endif
 #if PARAMS_DANGLE
+            if (junction_index > 1)
             {
                 const int pos[3] = {i, j+1, i+1};
-                ComputeProfileScore(profile_score_dangle_left[i*(L+1)+j].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_dangle_left));
+                ComputeProfileScore(profile_score_dangle_left[junction_index].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_dangle_left));
             }
+            if (junction_index > 1)
             {
                 const int pos[3] = {i, j+1, j};
-                ComputeProfileScore(profile_score_dangle_right[i*(L+1)+j].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_dangle_right));
+                ComputeProfileScore(profile_score_dangle_right[junction_index].first, pos, 3, reinterpret_cast<std::pair<RealT,RealT> *>(score_dangle_right));
             }
 #endif
         }
     }
+
+    // the memoized scores are only valid for the current parameters
+    profile_score_memo.clear();
     
 #endif
     
 #if FAST_HELIX_LENGTHS
-    // precompute helix partial sums
-    FillScores(cache_score_helix_sums.begin(), cache_score_helix_sums.end(), RealT(0));
-    for (int i = L; i >= 1; i--)
-    {
-        for (int j = i+3; j <= L; j++)
-        {
-            cache_score_helix_sums[(i+j)*L+j-i].first = cache_score_helix_sums[(i+j)*L+j-i-2].first;
-            if (allow_paired[offset[i+1]+j-1])
-            {
-                cache_score_helix_sums[(i+j)*L+j-i].first += ScoreBasePairEvidence(i+1,j-1);
-                if (allow_paired[offset[i]+j])
-                    cache_score_helix_sums[(i+j)*L+j-i].first += ScoreHelixStacking(i,j);
-            }
-        }
-    }
+    // helix partial sums are filled in as the dynamic programming
+    // sweeps reach them
+    ResetHelixSums(true);
 #endif
     
 }
@@ -1627,6 +1666,59 @@ void InferenceEngine<RealT>::InitializeCacheESS()
 
 #if PROFILE
 
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::BuildProfileIndex()
+//
+// Assign storage for the pairwise profile scores.  Only pairs that
+// may pair (see AllowPaired()) are stored, in upper triangular order; the
+// junction tables hold two entries per pair, one for each side of
+// the pair.  Slot 0 (and 1 for the junction tables) is shared by all
+// disallowed pairs and always scores zero.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::BuildProfileIndex()
+{
+    profile_pair_index.assign(SIZE, 0);
+    int num_pairs = 0;
+    
+    for (int i = 1; i <= L; i++)
+    {
+        for (int j = i+1; j <= L; j++)
+        {
+            if (AllowPaired(i,j))
+                profile_pair_index[offset[i]+j] = ++num_pairs;
+        }
+    }
+
+#if PARAMS_BASE_PAIR
+    profile_score_base_pair.clear();                 profile_score_base_pair.resize(num_pairs+1);
+#endif
+#if PARAMS_TERMINAL_MISMATCH
+    profile_score_terminal_mismatch.clear();         profile_score_terminal_mismatch.resize(2*(num_pairs+1));
+#endif
+#if PARAMS_INTERNAL_1x1_NUCLEOTIDES
+    profile_score_internal_1x1_nucleotides.clear();  profile_score_internal_1x1_nucleotides.resize(num_pairs+1);
+#endif
+#if PARAMS_INTERNAL_1x2_NUCLEOTIDES
+    profile_score_internal_1x2_nucleotides.clear();  profile_score_internal_1x2_nucleotides.resize(num_pairs+1);
+    profile_score_internal_2x1_nucleotides.clear();  profile_score_internal_2x1_nucleotides.resize(num_pairs+1);
+#endif
+#if PARAMS_INTERNAL_2x2_NUCLEOTIDES
+    profile_score_internal_2x2_nucleotides.clear();  profile_score_internal_2x2_nucleotides.resize(num_pairs+1);
+#endif
+#if PARAMS_HELIX_STACKING
+    profile_score_helix_stacking.clear();            profile_score_helix_stacking.resize(num_pairs+1);
+#endif
+#if PARAMS_HELIX_CLOSING
+    profile_score_helix_closing.clear();             profile_score_helix_closing.resize(2*(num_pairs+1));
+#endif
+#if PARAMS_DANGLE
+    profile_score_dangle_left.clear();               profile_score_dangle_left.resize(2*(num_pairs+1));
+    profile_score_dangle_right.clear();              profile_score_dangle_right.resize(2*(num_pairs+1));
+#endif
+}
+
 //////////////////////////////////////////////////////////////////////
 // InferenceEngine::ComputeProfileScore()
 //
@@ -1638,31 +1730,49 @@ void InferenceEngine<RealT>::ComputeProfileScore(RealT &profile_score, const int
 {
     profile_score = 0;
 
-    // consider all sequences
-    for (int k = 0; k < N; k++)
+    // patterns extending past either end never match
+    const int *col[4];
+    long long key = 0, num_keys = 1;
+    for (int d = 0; d < dimensions; d++)
+    {
+        if (pos[d] < 1 || pos[d] > L) return;
+        col[d] = &A[pos[d]*num_unique_sequences];
+        key = key * num_column_classes + column_class[pos[d]];
+        num_keys *= num_column_classes;
+    }
+
+    // the score depends only on the column classes involved, so
+    // reuse the result for any earlier identical column tuple; this
+    // is only worth the memory when tuples can recur, i.e., when
+    // there are fewer possible tuples than table entries
+    std::unordered_map<long long, RealT> *memo = NULL;
+    if (num_keys <= SIZE2)
+    {
+        memo = &profile_score_memo[table];
+        typename std::unordered_map<long long, RealT>::iterator iter = memo->find(key);
+        if (iter != memo->end())
+        {
+            profile_score = iter->second;
+            return;
+        }
+    }
+
+    // consider all distinct sequences
+    const int gap = int(alphabet.size());
+    for (int k = 0; k < num_unique_sequences; k++)
     {
         bool valid = true;
         int index = 0;
-        int *seq = &A[k*(L+1)];
-        
-        // extract letters of the pattern for the current sequence
-        for (int d = 0; valid && d < dimensions; d++)
+        for (int d = 0; d < dimensions; d++)
         {
-            if (pos[d] < 1 || pos[d] > L)
-                valid = false;
-            else
-            {
-                BYTE c = seq[pos[d]];
-                if (c == BYTE(alphabet.size()))
-                    valid = false;
-                else
-                    index = index * (M+1) + c;
-            }
+            const int c = col[d][k];
+            valid &= (c != gap);
+            index = index * (M+1) + c;
         }
-
-        // add contribution of pattern to score
         if (valid) profile_score += weights[k] * table[index].first;
     }
+
+    if (memo) (*memo)[key] = profile_score;
 }
 
 #endif
@@ -1689,6 +1799,271 @@ void InferenceEngine<RealT>::LoadValues(const std::vector<RealT> &values)
     }
 }
 
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::AllocateTable()
+//
+// Clear and resize a dynamic programming matrix.  The calling thread
+// touches every entry, so the pages are placed on its NUMA node.
+// With huge pages enabled, storage is reserved and advised before
+// being touched so that the kernel can back it with huge pages.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+template<class T>
+void InferenceEngine<RealT>::AllocateTable(std::vector<T> &table, int size, const T &value)
+{
+    table.clear();
+    if (use_huge_pages && table.capacity() < size_t(size))
+    {
+        std::vector<T>().swap(table);
+        table.reserve(size);
+        AdviseHugePages(table.data(), sizeof(T) * size_t(size));
+    }
+    table.resize(size, value);
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::FillMultiSplitCandidates()
+//
+// List the k > i for which FM1[i,k] is nonzero, in increasing order.
+// Only these k contribute to the sum over splits in FM2[i,j].
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::FillMultiSplitCandidates(std::vector<int> &candidates, const std::vector<RealT> &FM1, int i) const
+{
+    candidates.clear();
+    for (int k = i+1; k <= L; k++)
+        if (FM1[offset[i]+k] > RealT(NEG_INF/2)) candidates.push_back(k);
+}
+
+#if BLOCKED_MULTI_SPLITS
+
+//////////////////////////////////////////////////////////////////////
+// Blocked multiloop split sums
+//
+// The sums FM2[i,j] = SUM (i<k<j : FM1[i,k] + FM[k,j]) are a
+// triangular matrix product in the (log-sum-exp, +) semiring.  The
+// positions are divided into blocks of MULTI_SPLIT_BLOCK, and for
+// row block I and column block J, the splits k in the blocks lying
+// strictly between them are summed for the whole tile at once.
+// Each MULTI_SPLIT_BLOCK x MULTI_SPLIT_BLOCK piece of FM1 and FM is
+// exponentiated once, after subtracting the maximum of each of its
+// rows (FM1) or columns (FM), so that the sum over a block of k is
+// an ordinary matrix product.  Should that product underflow, the
+// splits in the block are summed directly.  The remaining splits,
+// with k in the row or column block of (i,j) itself, are also
+// summed directly.
+//
+// A tile needs FM1[i,k] for all i in I and k before J, and FM[k,j]
+// for all k after I and j in J.  ComputeInside() and
+// ComputeInsideESS() therefore fill a block of rows at a time,
+// column by column; other callers may visit cells in any order in
+// which the row blocks are finished one after the other.
+//////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::ResetMultiSplitBlocks()
+//
+// Discard blocks packed from a previous pass.  Must be called before
+// each pass that uses SumMultiSplitsBlocked().  Under a span limit,
+// tiles only reach MaxEntrySpan()+MULTI_SPLIT_BLOCK columns past the
+// split, so only that band of each packed row is kept.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::ResetMultiSplitBlocks()
+{
+    const int num_blocks = L / MULTI_SPLIT_BLOCK + 1;
+    
+    multi_split_band = std::min(L, MaxEntrySpan() + MULTI_SPLIT_BLOCK);
+    multi_split_row_offset.resize(L+1);
+    int size = 0;
+    for (int k = 0; k <= L; k++)
+    {
+        multi_split_row_offset[k] = size - k;
+        size += std::min(L, k + multi_split_band) - k + 1;
+    }
+    
+    AllocateTable(multi_split_rows, size, 0.0);
+    multi_split_row_scale.resize(num_blocks * (MULTI_SPLIT_BLOCK + multi_split_band));
+    multi_split_columns.resize(MULTI_SPLIT_BLOCK * (L+1));
+    multi_split_column_scale.resize(MULTI_SPLIT_BLOCK * num_blocks);
+    multi_split_rows_packed.assign(num_blocks, 0);
+    multi_split_sums.resize(MULTI_SPLIT_BLOCK * (L+1));
+    multi_split_block = -1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::PackMultiSplitRows()
+// InferenceEngine::PackMultiSplitColumns()
+//
+// Scale and exponentiate the rows k0 <= k < k0+MULTI_SPLIT_BLOCK of
+// FM (within the band), or the columns k0 <= k < k0+MULTI_SPLIT_BLOCK
+// of FM1 in the current row block i0.  Row scales are indexed by j-k0.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::PackMultiSplitRows(const std::vector<RealT> &FM, int k0)
+{
+    const int k1 = std::min(k0 + MULTI_SPLIT_BLOCK, L+1);
+    double *scale = &multi_split_row_scale[(k0 / MULTI_SPLIT_BLOCK) * (MULTI_SPLIT_BLOCK + multi_split_band)] - k0;
+    
+    for (int j = k0; j <= std::min(L, k1-1 + multi_split_band); j++)
+    {
+        scale[j] = double(NEG_INF);
+        for (int k = std::max(k0, j - multi_split_band); k < std::min(k1, j+1); k++)
+            scale[j] = std::max(scale[j], double(FM[offset[k]+j]));
+    }
+    
+    for (int k = k0; k < k1; k++)
+    {
+        double *row = &multi_split_rows[multi_split_row_offset[k]];
+        for (int j = k; j <= std::min(L, k + multi_split_band); j++)
+        {
+            const double value = double(FM[offset[k]+j]);
+            row[j] = (value > double(NEG_INF/2) ? exp(value - scale[j]) : 0.0);
+        }
+    }
+    
+    multi_split_rows_packed[k0 / MULTI_SPLIT_BLOCK] = 1;
+}
+
+template<class RealT>
+void InferenceEngine<RealT>::PackMultiSplitColumns(const std::vector<RealT> &FM1, int i0, int k0)
+{
+    const int num_blocks = L / MULTI_SPLIT_BLOCK + 1;
+    const int rows = std::min(MULTI_SPLIT_BLOCK, L+1-i0);
+    const int k1 = std::min(k0 + MULTI_SPLIT_BLOCK, L+1);
+    
+    for (int ii = 0; ii < rows; ii++)
+    {
+        const RealT *FM1_row = &FM1[offset[i0+ii]];
+        double *columns = &multi_split_columns[ii * (L+1)];
+        double &scale = multi_split_column_scale[ii * num_blocks + k0 / MULTI_SPLIT_BLOCK];
+        
+        scale = double(NEG_INF);
+        for (int k = k0; k < k1; k++)
+            scale = std::max(scale, double(FM1_row[k]));
+        for (int k = k0; k < k1; k++)
+            columns[k] = (FM1_row[k] > RealT(NEG_INF/2) ? exp(double(FM1_row[k]) - scale) : 0.0);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::ComputeMultiSplitTile()
+//
+// Sum the splits i0+MULTI_SPLIT_BLOCK <= k < j0 for all cells (i,j)
+// of the tile in row block i0 and column block j0.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::ComputeMultiSplitTile(const std::vector<RealT> &FM1, const std::vector<RealT> &FM, int i0, int j0)
+{
+    const int num_blocks = L / MULTI_SPLIT_BLOCK + 1;
+    const int rows = std::min(MULTI_SPLIT_BLOCK, L+1-i0);
+    const int columns = std::min(MULTI_SPLIT_BLOCK, L+1-j0);
+    double product[MULTI_SPLIT_BLOCK * MULTI_SPLIT_BLOCK];
+    
+    for (; multi_split_columns_end < j0; multi_split_columns_end += MULTI_SPLIT_BLOCK)
+        PackMultiSplitColumns(FM1, i0, multi_split_columns_end);
+    
+    for (int ii = 0; ii < rows; ii++)
+        std::fill(&multi_split_sums[ii * (L+1) + j0], &multi_split_sums[ii * (L+1) + j0] + columns, RealT(NEG_INF));
+    
+    for (int k0 = i0 + MULTI_SPLIT_BLOCK; k0 < j0; k0 += MULTI_SPLIT_BLOCK)
+    {
+        if (!multi_split_rows_packed[k0 / MULTI_SPLIT_BLOCK]) PackMultiSplitRows(FM, k0);
+        const double *row_scale = &multi_split_row_scale[(k0 / MULTI_SPLIT_BLOCK) * (MULTI_SPLIT_BLOCK + multi_split_band)] - k0;
+        
+        // product of the scaled pieces of FM1 and FM
+        
+        std::fill(product, product + MULTI_SPLIT_BLOCK * MULTI_SPLIT_BLOCK, 0.0);
+        for (int ii = 0; ii < rows; ii++)
+        {
+            const double *a = &multi_split_columns[ii * (L+1)];
+            double *c = &product[ii * MULTI_SPLIT_BLOCK];
+            for (int k = k0; k < k0 + MULTI_SPLIT_BLOCK; k++)
+            {
+                if (a[k] == 0.0) continue;
+                const double *b = &multi_split_rows[multi_split_row_offset[k]+j0];
+                for (int jj = 0; jj < columns; jj++)
+                    c[jj] += a[k] * b[jj];
+            }
+        }
+        
+        // undo scaling, or sum directly on underflow
+        
+        for (int ii = 0; ii < rows; ii++)
+        {
+            const int i = i0 + ii;
+            const double column_scale = multi_split_column_scale[ii * num_blocks + k0 / MULTI_SPLIT_BLOCK];
+            if (column_scale <= double(NEG_INF/2)) continue;
+            
+            for (int jj = 0; jj < columns; jj++)
+            {
+                const int j = j0 + jj;
+                RealT &sum = multi_split_sums[ii * (L+1) + j];
+                if (row_scale[j] <= double(NEG_INF/2)) continue;
+                
+                if (product[ii * MULTI_SPLIT_BLOCK + jj] >= 1e-290)
+                {
+                    Fast_LogPlusEquals(sum, RealT(log(product[ii * MULTI_SPLIT_BLOCK + jj]) + column_scale + row_scale[j]));
+                }
+                else
+                {
+                    for (int k = k0; k < k0 + MULTI_SPLIT_BLOCK; k++)
+                        Fast_LogPlusEquals(sum, FM1[offset[i]+k] + FM[offset[k]+j]);
+                }
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::SumMultiSplitsBlocked()
+//
+// Compute FM2[i,j] = SUM (i<k<j : FM1[i,k] + FM[k,j]), for j-i
+// within MaxEntrySpan().
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+RealT InferenceEngine<RealT>::SumMultiSplitsBlocked(const std::vector<RealT> &FM1, const std::vector<RealT> &FM, int i, int j)
+{
+    Assert(j - i <= MaxEntrySpan(), "Multiloop split sum outside the span limit.");
+    
+    const int i0 = i - i % MULTI_SPLIT_BLOCK;
+    const int j0 = j - j % MULTI_SPLIT_BLOCK;
+    const int k_near = std::min(i0 + MULTI_SPLIT_BLOCK, j);
+    RealT sum = RealT(NEG_INF);
+    
+    // splits in the blocks between those of i and j
+    
+    if (j0 >= i0 + 2*MULTI_SPLIT_BLOCK)
+    {
+        if (multi_split_block != i0)
+        {
+            multi_split_block = i0;
+            multi_split_columns_end = i0 + MULTI_SPLIT_BLOCK;
+            multi_split_sums_end = i0 + 2*MULTI_SPLIT_BLOCK;
+        }
+        for (; multi_split_sums_end <= j0; multi_split_sums_end += MULTI_SPLIT_BLOCK)
+            ComputeMultiSplitTile(FM1, FM, i0, multi_split_sums_end);
+        sum = multi_split_sums[(i - i0) * (L+1) + j];
+    }
+    
+    // splits in the blocks of i and j
+    
+    for (int k = i+1; k < k_near; k++)
+        Fast_LogPlusEquals(sum, FM1[offset[i]+k] + FM[offset[k]+j]);
+    for (int k = std::max(j0, k_near); k < j; k++)
+        Fast_LogPlusEquals(sum, FM1[offset[i]+k] + FM[offset[k]+j]);
+    
+    return sum;
+}
+
+#endif
+
 //////////////////////////////////////////////////////////////////////
 // InferenceEngine::GetCounts()
 //
@@ -1748,9 +2123,6 @@ void InferenceEngine<RealT>::ClearCounts()
         for (int l2 = 0; l2 <= C_MAX_SINGLE_LENGTH; l2++)
             cache_score_single[l1][l2].second = RealT(0);
     
-#if FAST_HELIX_LENGTHS
-    FillCounts(cache_score_helix_sums.begin(), cache_score_helix_sums.end(), RealT(0));
-#endif
 
     // clear counts for profiles
 #if PROFILE
@@ -1813,39 +2185,6 @@ void InferenceEngine<RealT>::ClearCounts()
 template<class RealT>
 void InferenceEngine<RealT>::FinalizeCounts()
 {
-#if FAST_HELIX_LENGTHS
-
-    // reverse helix partial sums    
-    std::vector<std::pair<RealT,RealT> > reverse_sums(cache_score_helix_sums);
-    
-    for (int i = 1; i <= L; i++)
-    {
-        for (int j = L; j >= i+3; j--)
-        {
-            // the "if" conditions here can be omitted
-            
-            if (allow_paired[offset[i+1]+j-1])
-            {
-                CountBasePair(i+1,j-1,reverse_sums[(i+j)*L+j-i].second);
-                if (allow_paired[offset[i]+j])
-                {
-                    CountHelixStacking(i,j,reverse_sums[(i+j)*L+j-i].second);
-                }
-                else
-                {
-                    Assert(Abs(double(reverse_sums[(i+j)*L+j-i].second)) < 1e-8, "Should be zero.");
-                }
-            }
-            else
-            {
-                Assert(Abs(double(reverse_sums[(i+j)*L+j-i-2].second)) < 1e-8, "Should be zero.");
-            }
-            
-            reverse_sums[(i+j)*L+j-i-2].second += reverse_sums[(i+j)*L+j-i].second;
-        }
-    }
-#endif
-
     // perform transformations
 #if PARAMS_BASE_PAIR_DIST
     for (int i = 0; i < D_MAX_BP_DIST_THRESHOLDS; i++)
@@ -1953,16 +2292,21 @@ void InferenceEngine<RealT>::FinalizeCounts()
     {
         for (int j = 0; j <= L; j++)
         {
+            const int pair_index = ProfilePairIndex(i,j);
+            const int loop_index = ProfileLoopIndex(i,j);
+            const int junction_index = ProfileJunctionIndex(i,j);
 #if PARAMS_BASE_PAIR
+            if (pair_index)
             {
                 const int pos[2] = {i, j};
-                ConvertProfileCount(profile_score_base_pair[i*(L+1)+j].second, pos, 2, reinterpret_cast<std::pair<RealT, RealT> *>(score_base_pair));
+                ConvertProfileCount(profile_score_base_pair[pair_index].second, pos, 2, reinterpret_cast<std::pair<RealT, RealT> *>(score_base_pair));
             }
 #endif
 #if PARAMS_TERMINAL_MISMATCH
+            if (junction_index > 1)
             {
                 const int pos[4] = {i, j+1, i+1, j};
-                ConvertProfileCount(profile_score_terminal_mismatch[i*(L+1)+j].second, pos, 4, reinterpret_cast<std::pair<RealT, RealT> *>(score_terminal_mismatch));
+                ConvertProfileCount(profile_score_terminal_mismatch[junction_index].second, pos, 4, reinterpret_cast<std::pair<RealT, RealT> *>(score_terminal_mismatch));
             }
 #endif
 #if PARAMS_HAIRPIN_3_NUCLEOTIDES
@@ -2016,47 +2360,55 @@ void InferenceEngine<RealT>::FinalizeCounts()
             }
 #endif            
 #if PARAMS_INTERNAL_1x1_NUCLEOTIDES
+            if (loop_index)
             {
                 const int pos[2] = {i+1, j};
-                ConvertProfileCount(profile_score_internal_1x1_nucleotides[i*(L+1)+j].second, pos, 2, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_1x1_nucleotides));
+                ConvertProfileCount(profile_score_internal_1x1_nucleotides[loop_index].second, pos, 2, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_1x1_nucleotides));
             }
 #endif            
 #if PARAMS_INTERNAL_1x2_NUCLEOTIDES
+            if (loop_index)
             {
                 const int pos[3] = {i+1, j-1, j};
-                ConvertProfileCount(profile_score_internal_1x2_nucleotides[i*(L+1)+j].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_1x2_nucleotides));
+                ConvertProfileCount(profile_score_internal_1x2_nucleotides[loop_index].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_1x2_nucleotides));
             }
+            if (loop_index)
             {
                 const int pos[3] = {i+1, i+2, j};
-                ConvertProfileCount(profile_score_internal_2x1_nucleotides[i*(L+1)+j].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_2x1_nucleotides));
+                ConvertProfileCount(profile_score_internal_2x1_nucleotides[loop_index].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_2x1_nucleotides));
             }
 #endif            
 #if PARAMS_INTERNAL_2x2_NUCLEOTIDES
+            if (loop_index)
             {
                 const int pos[4] = {i+1, i+2, j-1, j};
-                ConvertProfileCount(profile_score_internal_2x2_nucleotides[i*(L+1)+j].second, pos, 4, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_2x2_nucleotides));
+                ConvertProfileCount(profile_score_internal_2x2_nucleotides[loop_index].second, pos, 4, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_2x2_nucleotides));
             }
 #endif     
 #if PARAMS_HELIX_STACKING
+            if (pair_index)
             {
                 const int pos[4] = {i, j, i+1, j-1};
-                ConvertProfileCount(profile_score_helix_stacking[i*(L+1)+j].second, pos, 4, reinterpret_cast<std::pair<RealT, RealT> *>(score_helix_stacking));
+                ConvertProfileCount(profile_score_helix_stacking[pair_index].second, pos, 4, reinterpret_cast<std::pair<RealT, RealT> *>(score_helix_stacking));
             }
 #endif
 #if PARAMS_HELIX_CLOSING
+            if (junction_index > 1)
             {
                 const int pos[2] = {i, j+1};
-                ConvertProfileCount(profile_score_helix_closing[i*(L+1)+j].second, pos, 2, reinterpret_cast<std::pair<RealT, RealT> *>(score_helix_closing));
+                ConvertProfileCount(profile_score_helix_closing[junction_index].second, pos, 2, reinterpret_cast<std::pair<RealT, RealT> *>(score_helix_closing));
             }
 #endif
 #if PARAMS_DANGLE
+            if (junction_index > 1)
             {
                 const int pos[3] = {i, j+1, i+1};
-                ConvertProfileCount(profile_score_dangle_left[i*(L+1)+j].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_dangle_left));
+                ConvertProfileCount(profile_score_dangle_left[junction_index].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_dangle_left));
             }
+            if (junction_index > 1)
             {
                 const int pos[3] = {i, j+1, j};
-                ConvertProfileCount(profile_score_dangle_right[i*(L+1)+j].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_dangle_right));
+                ConvertProfileCount(profile_score_dangle_right[junction_index].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_dangle_right));
             }
 #endif
         }
@@ -2076,39 +2428,6 @@ void InferenceEngine<RealT>::FinalizeCounts()
 template<class RealT>
 void InferenceEngine<RealT>::FinalizeCountsESS()
 {
-#if FAST_HELIX_LENGTHS
-    
-    // reverse helix partial sums
-    std::vector<std::pair<RealT,RealT> > reverse_sums(cache_score_helix_sums);
-    
-    for (int i = 1; i <= L; i++)
-    {
-        for (int j = L; j >= i+3; j--)
-        {
-            // the "if" conditions here can be omitted
-            
-            if (allow_paired[offset[i+1]+j-1])
-            {
-                CountBasePairEvidence(i+1,j-1,reverse_sums[(i+j)*L+j-i].second);
-                if (allow_paired[offset[i]+j])
-                {
-                    CountHelixStacking(i,j,reverse_sums[(i+j)*L+j-i].second);
-                }
-                else
-                {
-                    Assert(Abs(double(reverse_sums[(i+j)*L+j-i].second)) < 1e-8, "Should be zero.");
-                }
-            }
-            else
-            {
-                Assert(Abs(double(reverse_sums[(i+j)*L+j-i-2].second)) < 1e-8, "Should be zero.");
-            }
-            
-            reverse_sums[(i+j)*L+j-i-2].second += reverse_sums[(i+j)*L+j-i].second;
-        }
-    }
-#endif
-    
     // perform transformations
 #if PARAMS_BASE_PAIR_DIST
     for (int i = 0; i < D_MAX_BP_DIST_THRESHOLDS; i++)
@@ -2216,16 +2535,21 @@ void InferenceEngine<RealT>::FinalizeCountsESS()
     {
         for (int j = 0; j <= L; j++)
         {
+            const int pair_index = ProfilePairIndex(i,j);
+            const int loop_index = ProfileLoopIndex(i,j);
+            const int junction_index = ProfileJunctionIndex(i,j);
 #if PARAMS_BASE_PAIR
+            if (pair_index)
             {
                 const int pos[2] = {i, j};
-                ConvertProfileCount(profile_score_base_pair[i*(L+1)+j].second, pos, 2, reinterpret_cast<std::pair<RealT, RealT> *>(score_base_pair));
+                ConvertProfileCount(profile_score_base_pair[pair_index].second, pos, 2, reinterpret_cast<std::pair<RealT, RealT> *>(score_base_pair));
             }
 #endif
 #if PARAMS_TERMINAL_MISMATCH
+            if (junction_index > 1)
             {
                 const int pos[4] = {i, j+1, i+1, j};
-                ConvertProfileCount(profile_score_terminal_mismatch[i*(L+1)+j].second, pos, 4, reinterpret_cast<std::pair<RealT, RealT> *>(score_terminal_mismatch));
+                ConvertProfileCount(profile_score_terminal_mismatch[junction_index].second, pos, 4, reinterpret_cast<std::pair<RealT, RealT> *>(score_terminal_mismatch));
             }
 #endif
 #if PARAMS_HAIRPIN_3_NUCLEOTIDES
@@ -2279,47 +2603,55 @@ void InferenceEngine<RealT>::FinalizeCountsESS()
             }
 #endif
 #if PARAMS_INTERNAL_1x1_NUCLEOTIDES
+            if (loop_index)
             {
                 const int pos[2] = {i+1, j};
-                ConvertProfileCount(profile_score_internal_1x1_nucleotides[i*(L+1)+j].second, pos, 2, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_1x1_nucleotides));
+                ConvertProfileCount(profile_score_internal_1x1_nucleotides[loop_index].second, pos, 2, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_1x1_nucleotides));
             }
 #endif
 #if PARAMS_INTERNAL_1x2_NUCLEOTIDES
+            if (loop_index)
             {
                 const int pos[3] = {i+1, j-1, j};
-                ConvertProfileCount(profile_score_internal_1x2_nucleotides[i*(L+1)+j].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_1x2_nucleotides));
+                ConvertProfileCount(profile_score_internal_1x2_nucleotides[loop_index].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_1x2_nucleotides));
             }
+            if (loop_index)
             {
                 const int pos[3] = {i+1, i+2, j};
-                ConvertProfileCount(profile_score_internal_2x1_nucleotides[i*(L+1)+j].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_2x1_nucleotides));
+                ConvertProfileCount(profile_score_internal_2x1_nucleotides[loop_index].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_2x1_nucleotides));
             }
 #endif
 #if PARAMS_INTERNAL_2x2_NUCLEOTIDES
+            if (loop_index)
             {
                 const int pos[4] = {i+1, i+2, j-1, j};
-                ConvertProfileCount(profile_score_internal_2x2_nucleotides[i*(L+1)+j].second, pos, 4, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_2x2_nucleotides));
+                ConvertProfileCount(profile_score_internal_2x2_nucleotides[loop_index].second, pos, 4, reinterpret_cast<std::pair<RealT, RealT> *>(score_internal_2x2_nucleotides));
             }
 #endif
 #if PARAMS_HELIX_STACKING
+            if (pair_index)
             {
                 const int pos[4] = {i, j, i+1, j-1};
-                ConvertProfileCount(profile_score_helix_stacking[i*(L+1)+j].second, pos, 4, reinterpret_cast<std::pair<RealT, RealT> *>(score_helix_stacking));
+                ConvertProfileCount(profile_score_helix_stacking[pair_index].second, pos, 4, reinterpret_cast<std::pair<RealT, RealT> *>(score_helix_stacking));
             }
 #endif
 #if PARAMS_HELIX_CLOSING
+            if (junction_index > 1)
             {
                 const int pos[2] = {i, j+1};
-                ConvertProfileCount(profile_score_helix_closing[i*(L+1)+j].second, pos, 2, reinterpret_cast<std::pair<RealT, RealT> *>(score_helix_closing));
+                ConvertProfileCount(profile_score_helix_closing[junction_index].second, pos, 2, reinterpret_cast<std::pair<RealT, RealT> *>(score_helix_closing));
             }
 #endif
 #if PARAMS_DANGLE
+            if (junction_index > 1)
             {
                 const int pos[3] = {i, j+1, i+1};
-                ConvertProfileCount(profile_score_dangle_left[i*(L+1)+j].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_dangle_left));
+                ConvertProfileCount(profile_score_dangle_left[junction_index].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_dangle_left));
             }
+            if (junction_index > 1)
             {
                 const int pos[3] = {i, j+1, j};
-                ConvertProfileCount(profile_score_dangle_right[i*(L+1)+j].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_dangle_right));
+                ConvertProfileCount(profile_score_dangle_right[junction_index].second, pos, 3, reinterpret_cast<std::pair<RealT, RealT> *>(score_dangle_right));
             }
 #endif
         }
@@ -2340,29 +2672,28 @@ void InferenceEngine<RealT>::FinalizeCountsESS()
 template<class RealT>
 void InferenceEngine<RealT>::ConvertProfileCount(const RealT &profile_score, const int *pos, int dimensions, std::pair<RealT,RealT> *table)
 {
-    // consider all sequences
-    for (int k = 0; k < N; k++)
+    if (profile_score == RealT(0)) return;
+
+    // patterns extending past either end never match
+    const int *col[4];
+    for (int d = 0; d < dimensions; d++)
+    {
+        if (pos[d] < 1 || pos[d] > L) return;
+        col[d] = &A[pos[d]*num_unique_sequences];
+    }
+
+    // consider all distinct sequences
+    const int gap = int(alphabet.size());
+    for (int k = 0; k < num_unique_sequences; k++)
     {
         bool valid = true;
         int index = 0;
-        int *seq = &A[k*(L+1)];
-        
-        // extract letters of the pattern for the current sequence
-        for (int d = 0; valid && d < dimensions; d++)
+        for (int d = 0; d < dimensions; d++)
         {
-            if (pos[d] < 1 || pos[d] > L)
-                valid = false;
-            else
-            {
-                BYTE c = seq[pos[d]];
-                if (c == BYTE(alphabet.size()))
-                    valid = false;
-                else
-                    index = index * (M+1) + c;
-            }
+            const int c = col[d][k];
+            valid &= (c != gap);
+            index = index * (M+1) + c;
         }
-
-        // add contribution of pattern to score
         if (valid) table[index].second += weights[k] * profile_score;
     }
 }
@@ -2397,6 +2728,7 @@ void InferenceEngine<RealT>::UseLoss(const std::vector<int> &true_mapping, RealT
             ((i == 0 || true_mapping[i] == SStruct::UNKNOWN || true_mapping[i] == SStruct::UNPAIRED) ? RealT(0) : per_position_loss);
     }
 
+#if defined(HAMMING_LOSS)
     // now, compute the penalty for declaring ranges of positions to be unpaired;
     // also, compute the penalty for matching positions s[i] and s[j].
     for (int i = 0; i <= L; i++)
@@ -2413,6 +2745,32 @@ void InferenceEngine<RealT>::UseLoss(const std::vector<int> &true_mapping, RealT
                 ((i == 0 || true_mapping[j] == SStruct::UNKNOWN || true_mapping[j] == SStruct::UNPAIRED || true_mapping[j] == i) ? RealT(0) : per_position_loss);
         }
     }
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::ComputeLoss()
+//
+// Compute the loss of a solution directly, using the same per-position
+// loss as UseLoss().
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+RealT InferenceEngine<RealT>::ComputeLoss(const std::vector<int> &true_mapping, const std::vector<int> &solution, RealT example_loss) const
+{
+    Assert(true_mapping.size() == solution.size(), "Mappings of different length!");
+
+    int num_pairings = 0;
+    int num_errors = 0;
+    for (size_t i = 1; i < true_mapping.size(); i++)
+    {
+        if (true_mapping[i] == SStruct::UNKNOWN || true_mapping[i] == SStruct::UNPAIRED) continue;
+        ++num_pairings;
+        if (solution[i] != true_mapping[i]) ++num_errors;
+    }
+
+    if (num_errors == 0) return RealT(0);
+    return example_loss * RealT(num_errors) / RealT(num_pairings);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -2428,31 +2786,143 @@ void InferenceEngine<RealT>::UseConstraints(const std::vector<int> &true_mapping
     cache_initialized = false;
     
     // determine whether we allow each position to be unpaired
+    constraint_mapping = true_mapping;
     for (int i = 1; i <= L; i++)
     {
         allow_unpaired_position[i] =
             (true_mapping[i] == SStruct::UNKNOWN || 
              true_mapping[i] == SStruct::UNPAIRED);
+        forced_paired[i] = forced_paired[i-1] + !allow_unpaired_position[i];
     }
 
     // determine whether we allow ranges of positions to be unpaired;
     // also determine which base-pairings we allow
-    for (int i = 0; i <= L; i++)
+    if (!sparse_tables)
     {
-        allow_unpaired[offset[i]+i] = 1;
-        allow_paired[offset[i]+i] = 0;
-        for (int j = i+1; j <= L; j++)
+        for (int i = 0; i <= L; i++)
+        {
+            allow_unpaired[offset[i]+i] = 1;
+            allow_paired[offset[i]+i] = 0;
+            for (int j = i+1; j <= L; j++)
+            {
+                allow_unpaired[offset[i]+j] = 
+                    allow_unpaired[offset[i]+j-1] && 
+                    allow_unpaired_position[j];
+                allow_paired[offset[i]+j] = ComputeAllowPaired(i,j);
+            }
+        }
+    }
+
+#if PROFILE
+    BuildProfileIndex();
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::ComputeAllowPaired()
+//
+// Determine whether letters i < j may pair: both must be letters
+// that are complementary (unless noncomplementary pairs are
+// allowed), within the maximum span, and either unconstrained or
+// constrained to pair with each other.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+inline bool InferenceEngine<RealT>::ComputeAllowPaired(int i, int j) const
+{
+    return (i > 0 && i < j &&
+            (max_span == 0 || j-i <= max_span) &&
+            (constraint_mapping[i] == SStruct::UNKNOWN || constraint_mapping[i] == j) &&
+            (constraint_mapping[j] == SStruct::UNKNOWN || constraint_mapping[j] == i) &&
+#if PROFILE
+            (allow_noncomplementary || IsComplementary(i,j)));
+#else
+            (allow_noncomplementary || is_complementary[s[i]][s[j]]));
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::IsParsable()
+//
+// Determine whether a fully known structure can be generated by the
+// grammar, by walking its loop decomposition rather than running
+// constrained Viterbi parsing.  The structure must be nested, its
+// base-pairs must be complementary (unless noncomplementary pairs
+// are allowed), every hairpin must contain at least
+// C_MIN_HAIRPIN_LENGTH letters, and every loop closed by exactly one
+// inner base-pair may contain at most C_MAX_SINGLE_LENGTH unpaired
+// letters.  Runs in O(L) time (O(NL) for alignments).
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+bool InferenceEngine<RealT>::IsParsable(const SStruct &sstruct) const
+{
+    const std::vector<int> &mapping = sstruct.GetMapping();
+    const int length = sstruct.GetLength();
+
+#if PROFILE
+    const std::vector<std::string> &alignment = sstruct.GetSequences();
+    const std::vector<double> sequence_weights = sstruct.ComputePositionBasedSequenceWeights();
+    const int num_sequences = int(alignment.size());
+    RealT total_weight = 0;
+    for (int k = 0; k < num_sequences; k++)
+        total_weight += RealT(sequence_weights[k]);
+#else
+    const std::string &sequence = sstruct.GetSequences()[0];
+#endif
+
+    // for each open loop (the external loop at the bottom), the
+    // number of inner base-pairs and unpaired letters seen so far
+    std::vector<int> closing(1, 0);
+    std::vector<int> branches(1, 0);
+    std::vector<int> unpaired(1, 0);
+
+    for (int i = 1; i <= length; i++)
+    {
+        const int j = mapping[i];
+        Assert(j != SStruct::UNKNOWN, "Structure must be fully known.");
+
+        if (j == SStruct::UNPAIRED)
+        {
+            unpaired.back()++;
+            continue;
+        }
+        if (j < 1 || j > length || j == i || mapping[j] != i) return false;
+
+        // open a new loop
+        if (i < j)
         {
-            allow_unpaired[offset[i]+j] = 
-                allow_unpaired[offset[i]+j-1] && 
-                allow_unpaired_position[j];
-            allow_paired[offset[i]+j] =
-                (i > 0 &&
-                 (true_mapping[i] == SStruct::UNKNOWN || true_mapping[i] == j) &&
-                 (true_mapping[j] == SStruct::UNKNOWN || true_mapping[j] == i) &&
-                 (allow_noncomplementary || IsComplementary(i,j)));
+            if (!allow_noncomplementary)
+            {
+#if PROFILE
+                RealT complementary_weight = 0;
+                for (int k = 0; k < num_sequences; k++)
+                {
+                    if (is_complementary[char_mapping[BYTE(alignment[k][i])]][char_mapping[BYTE(alignment[k][j])]])
+                        complementary_weight += RealT(sequence_weights[k]);
+                }
+                if (complementary_weight / total_weight < std::min(RealT(num_sequences-1) / RealT(num_sequences), RealT(0.5))) return false;
+#else
+                if (!is_complementary[char_mapping[BYTE(sequence[i])]][char_mapping[BYTE(sequence[j])]]) return false;
+#endif
+            }
+            closing.push_back(i);
+            branches.push_back(0);
+            unpaired.push_back(0);
+            continue;
         }
+
+        // close the innermost loop, which must have been opened by j
+        if (closing.back() != j) return false;
+        if (branches.back() == 0 && unpaired.back() < C_MIN_HAIRPIN_LENGTH) return false;
+        if (branches.back() == 1 && unpaired.back() > C_MAX_SINGLE_LENGTH) return false;
+        closing.pop_back();
+        branches.pop_back();
+        unpaired.pop_back();
+        branches.back()++;
     }
+
+    return closing.size() == 1;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -2492,15 +2962,15 @@ inline RealT InferenceEngine<RealT>::ScoreJunctionA(int i, int j) const
         RealT(0)
 #if PARAMS_HELIX_CLOSING
 #if PROFILE
-        + profile_score_helix_closing[i*(L+1)+j].first
+        + profile_score_helix_closing[ProfileJunctionIndex(i,j)].first
 #else                                          
         + score_helix_closing[s[i]][s[j+1]].first
 #endif
 #endif
 #if PARAMS_DANGLE
 #if PROFILE
-        + (i < L ? profile_score_dangle_left[i*(L+1)+j].first : RealT(0))
-        + (j > 0 ? profile_score_dangle_right[i*(L+1)+j].first : RealT(0))
+        + (i < L ? profile_score_dangle_left[ProfileJunctionIndex(i,j)].first : RealT(0))
+        + (j > 0 ? profile_score_dangle_right[ProfileJunctionIndex(i,j)].first : RealT(0))
 #else
         + (i < L ? score_dangle_left[s[i]][s[j+1]][s[i+1]].first : RealT(0))
         + (j > 0 ? score_dangle_right[s[i]][s[j+1]][s[j]].first : RealT(0))
@@ -2516,15 +2986,15 @@ inline void InferenceEngine<RealT>::CountJunctionA(int i, int j, RealT value)
     
 #if PARAMS_HELIX_CLOSING
 #if PROFILE
-    profile_score_helix_closing[i*(L+1)+j].second += value;
+    profile_score_helix_closing[ProfileJunctionIndex(i,j)].second += value;
 #else
     score_helix_closing[s[i]][s[j+1]].second += value;
 #endif
 #endif
 #if PARAMS_DANGLE
 #if PROFILE
-    if (i < L) profile_score_dangle_left[i*(L+1)+j].second += value;
-    if (j > 0) profile_score_dangle_right[i*(L+1)+j].second += value;
+    if (i < L) profile_score_dangle_left[ProfileJunctionIndex(i,j)].second += value;
+    if (j > 0) profile_score_dangle_right[ProfileJunctionIndex(i,j)].second += value;
 #else                                                               
     if (i < L) score_dangle_left[s[i]][s[j+1]][s[i+1]].second += value;
     if (j > 0) score_dangle_right[s[i]][s[j+1]][s[j]].second += value;
@@ -2567,14 +3037,14 @@ inline RealT InferenceEngine<RealT>::ScoreJunctionB(int i, int j) const
     return RealT(0)
 #if PARAMS_HELIX_CLOSING
 #if PROFILE
-        + profile_score_helix_closing[i*(L+1)+j].first
+        + profile_score_helix_closing[ProfileJunctionIndex(i,j)].first
 #else
         + score_helix_closing[s[i]][s[j+1]].first
 #endif
 #endif
 #if PARAMS_TERMINAL_MISMATCH
 #if PROFILE
-        + profile_score_terminal_mismatch[i*(L+1)+j].first
+        + profile_score_terminal_mismatch[ProfileJunctionIndex(i,j)].first
 #else                                           
         + score_terminal_mismatch[s[i]][s[j+1]][s[i+1]][s[j]].first
 #endif
@@ -2589,14 +3059,14 @@ inline void InferenceEngine<RealT>::CountJunctionB(int i, int j, RealT value)
     
 #if PARAMS_HELIX_CLOSING
 #if PROFILE
-    profile_score_helix_closing[i*(L+1)+j].second += value;
+    profile_score_helix_closing[ProfileJunctionIndex(i,j)].second += value;
 #else
     score_helix_closing[s[i]][s[j+1]].second += value;
 #endif
 #endif
 #if PARAMS_TERMINAL_MISMATCH
 #if PROFILE
-    profile_score_terminal_mismatch[i*(L+1)+j].second += value;
+    profile_score_terminal_mismatch[ProfileJunctionIndex(i,j)].second += value;
 #else
     score_terminal_mismatch[s[i]][s[j+1]][s[i+1]][s[j]].second += value;
 #endif
@@ -2625,7 +3095,7 @@ inline RealT InferenceEngine<RealT>::ScoreBasePair(int i, int j) const
 #endif
 #if PARAMS_BASE_PAIR
 #if PROFILE
-        + profile_score_base_pair[i*(L+1)+j].first
+        + profile_score_base_pair[ProfilePairIndex(i,j)].first
 #else
         + score_base_pair[s[i]][s[j]].first
 #endif
@@ -2643,7 +3113,7 @@ inline void InferenceEngine<RealT>::CountBasePair(int i, int j, RealT value)
     
 #if PARAMS_BASE_PAIR
 #if PROFILE
-    profile_score_base_pair[i*(L+1)+j].second += value;
+    profile_score_base_pair[ProfilePairIndex(i,j)].second += value;
 #else
     score_base_pair[s[i]][s[j]].second += value;
 #endif
@@ -2774,6 +3244,114 @@ inline void InferenceEngine<RealT>::CountHairpin(int i, int j, RealT value)
 #endif
 }
 
+#if FAST_HELIX_LENGTHS
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::ResetHelixSums()
+// InferenceEngine::ExtendHelixSums()
+//
+// Helix scores are computed as differences of partial sums along
+// the diagonals i+j = constant, where
+//
+//     P(i,j) = P(i+1,j-1) + ScoreHelixSumsTerm(i,j),
+//
+// so that the helix of length m starting at (i,j) scores
+// P(i+1,j) - P(i+m,j-m+1).  Only the helix_sums_rows most recently
+// filled rows are kept, in a ring indexed by i; each sweep extends
+// the band one row (or block of rows) at a time, downward for the
+// inside-style sweeps and upward for the outside sweeps.  Each
+// diagonal's sums are only defined up to a constant, which cancels
+// in the differences, so a band can start at any row.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::ResetHelixSums(bool use_evidence)
+{
+    helix_sums_low = 0;
+    helix_sums_high = -1;
+    helix_sums_evidence = use_evidence;
+}
+
+template<class RealT>
+void InferenceEngine<RealT>::ExtendHelixSums(int low, int high)
+{
+    high = std::min(high, L);
+    Assert(0 <= low && low <= high && high - low < helix_sums_rows, "Helix partial sums band invalid.");
+
+    const int mask = helix_sums_rows - 1;
+    if (helix_sums_low > helix_sums_high || high < helix_sums_low - 1 || helix_sums_high + 1 < low)
+    {
+        RealT *row = &cache_score_helix_sums[(high & mask) * (L+1)];
+        std::fill(row, row + L+1, RealT(0));
+        helix_sums_low = helix_sums_high = high;
+    }
+
+    // extend downward
+    while (helix_sums_low > low)
+    {
+        const int i = --helix_sums_low;
+        if (helix_sums_high - i >= helix_sums_rows) helix_sums_high--;
+        RealT *row = &cache_score_helix_sums[(i & mask) * (L+1)];
+        const RealT *next = &cache_score_helix_sums[((i+1) & mask) * (L+1)];
+        row[i] = row[std::min(i+1, L)] = RealT(0);
+        for (int j = i+2; j <= L; j++)
+            row[j] = next[j-1] + ScoreHelixSumsTerm(i,j);
+    }
+
+    // extend upward
+    while (helix_sums_high < high)
+    {
+        const int i = ++helix_sums_high;
+        if (i - helix_sums_low >= helix_sums_rows) helix_sums_low++;
+        RealT *row = &cache_score_helix_sums[(i & mask) * (L+1)];
+        const RealT *prev = &cache_score_helix_sums[((i-1) & mask) * (L+1)];
+        for (int j = i; j < L; j++)
+            row[j] = prev[j+1] - ScoreHelixSumsTerm(i-1,j+1);
+        row[L] = RealT(0);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::ScoreHelixSumsTerm()
+//
+// Score of the base-pair x[i+1]-x[j-1] together with its stacking on
+// x[i]-x[j], as accumulated in the helix partial sums.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+inline RealT InferenceEngine<RealT>::ScoreHelixSumsTerm(int i, int j) const
+{
+    if (i < 1 || j - i < 3 || !AllowPaired(i+1,j-1)) return RealT(0);
+    RealT ret = helix_sums_evidence ? ScoreBasePairEvidence(i+1,j-1) : ScoreBasePair(i+1,j-1);
+    if (AllowPaired(i,j)) ret += ScoreHelixStacking(i,j);
+    return ret;
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::ScoreHelixSums()
+//
+// Stacking and base-pair scores of a helix of length m starting at
+// positions i and j (see ScoreHelix), from the partial sums band
+// when it covers the helix and summed directly otherwise.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+inline RealT InferenceEngine<RealT>::ScoreHelixSums(int i, int j, int m) const
+{
+    if (helix_sums_low <= i+1 && i+m <= helix_sums_high)
+    {
+        const int mask = helix_sums_rows - 1;
+        return cache_score_helix_sums[((i+1) & mask) * (L+1) + j] - cache_score_helix_sums[((i+m) & mask) * (L+1) + j-m+1];
+    }
+
+    RealT ret = RealT(0);
+    for (int k = 1; k < m; k++)
+        ret += ScoreHelixSumsTerm(i+k,j-k+1);
+    return ret;
+}
+
+#endif
+
 //////////////////////////////////////////////////////////////////////
 // InferenceEngine::ScoreHelix()
 // InferenceEngine::CountHelix()
@@ -2809,7 +3387,7 @@ inline RealT InferenceEngine<RealT>::ScoreHelix(int i, int j, int m) const
 #if FAST_HELIX_LENGTHS
     
     return
-        cache_score_helix_sums[(i+j+1)*L+j-i-1].first - cache_score_helix_sums[(i+j+1)*L+j-i-m-m+1].first
+        ScoreHelixSums(i,j,m)
 #if PARAMS_HELIX_LENGTH
         + cache_score_helix_length[m].first
 #endif
@@ -2837,21 +3415,12 @@ inline void InferenceEngine<RealT>::CountHelix(int i, int j, int m, RealT value)
     Assert(0 <= i && i + 2 * m <= j && j <= L, "Helix boundaries invalid.");
     Assert(2 <= m && m <= D_MAX_HELIX_LENGTH, "Helix length invalid.");
     
-#if FAST_HELIX_LENGTHS
-    
-    cache_score_helix_sums[(i+j+1)*L+j-i-1].second += value;
-    cache_score_helix_sums[(i+j+1)*L+j-i-m-m+1].second -= value;
-    
-#else
-    
     for (int k = 1; k < m; k++)
     {
         CountHelixStacking(i+k,j-k+1,value);
         CountBasePair(i+k+1,j-k,value);
     }
     
-#endif
-    
 #if PARAMS_HELIX_LENGTH
     cache_score_helix_length[m].second += value;
 #endif
@@ -2894,7 +3463,7 @@ inline RealT InferenceEngine<RealT>::ScoreHelixEvidence(int i, int j, int m) con
 #if FAST_HELIX_LENGTHS
     
     return
-    cache_score_helix_sums[(i+j+1)*L+j-i-1].first - cache_score_helix_sums[(i+j+1)*L+j-i-m-m+1].first
+    ScoreHelixSums(i,j,m)
 #if PARAMS_HELIX_LENGTH
     + cache_score_helix_length[m].first
 #endif
@@ -2922,21 +3491,12 @@ inline void InferenceEngine<RealT>::CountHelixEvidence(int i, int j, int m, Real
     Assert(0 <= i && i + 2 * m <= j && j <= L, "Helix boundaries invalid.");
     Assert(2 <= m && m <= D_MAX_HELIX_LENGTH, "Helix length invalid.");
     
-#if FAST_HELIX_LENGTHS
-    
-    cache_score_helix_sums[(i+j+1)*L+j-i-1].second += value;
-    cache_score_helix_sums[(i+j+1)*L+j-i-m-m+1].second -= value;
-    
-#else
-    
     for (int k = 1; k < m; k++)
     {
         CountHelixStacking(i+k,j-k+1,value);
         CountBasePairEvidence(i+k+1,j-k,value);
     }
     
-#endif
-    
 #if PARAMS_HELIX_LENGTH
     cache_score_helix_length[m].second += value;
 #endif
@@ -3039,15 +3599,15 @@ inline RealT InferenceEngine<RealT>::ScoreSingleNucleotides(int i, int j, int p,
 #endif
 #if PARAMS_INTERNAL_1x1_NUCLEOTIDES
 #if PROFILE
-        + (l1 == 1 && l2 == 1 ? profile_score_internal_1x1_nucleotides[i*(L+1)+j].first : RealT(0))
+        + (l1 == 1 && l2 == 1 ? profile_score_internal_1x1_nucleotides[ProfileLoopIndex(i,j)].first : RealT(0))
 #else
         + (l1 == 1 && l2 == 1 ? score_internal_1x1_nucleotides[s[i+1]][s[j]].first : RealT(0))
 #endif
 #endif
 #if PARAMS_INTERNAL_1x2_NUCLEOTIDES
 #if PROFILE
-        + (l1 == 1 && l2 == 2 ? profile_score_internal_1x2_nucleotides[i*(L+1)+j].first : RealT(0))
-        + (l1 == 2 && l2 == 1 ? profile_score_internal_2x1_nucleotides[i*(L+1)+j].first : RealT(0))
+        + (l1 == 1 && l2 == 2 ? profile_score_internal_1x2_nucleotides[ProfileLoopIndex(i,j)].first : RealT(0))
+        + (l1 == 2 && l2 == 1 ? profile_score_internal_2x1_nucleotides[ProfileLoopIndex(i,j)].first : RealT(0))
 #else
         + (l1 == 1 && l2 == 2 ? score_internal_1x2_nucleotides[s[i+1]][s[j-1]][s[j]].first : RealT(0))
         + (l1 == 2 && l2 == 1 ? score_internal_2x1_nucleotides[s[i+1]][s[i+2]][s[j]].first : RealT(0))
@@ -3055,7 +3615,7 @@ inline RealT InferenceEngine<RealT>::ScoreSingleNucleotides(int i, int j, int p,
 #endif
 #if PARAMS_INTERNAL_2x2_NUCLEOTIDES
 #if PROFILE
-        + (l1 == 2 && l2 == 2 ? profile_score_internal_2x2_nucleotides[i*(L+1)+j].first : RealT(0))
+        + (l1 == 2 && l2 == 2 ? profile_score_internal_2x2_nucleotides[ProfileLoopIndex(i,j)].first : RealT(0))
 #else                                                                   
         + (l1 == 2 && l2 == 2 ? score_internal_2x2_nucleotides[s[i+1]][s[i+2]][s[j-1]][s[j]].first : RealT(0))
 #endif
@@ -3106,15 +3666,15 @@ inline void InferenceEngine<RealT>::CountSingleNucleotides(int i, int j, int p,
 #endif
 #if PARAMS_INTERNAL_1x1_NUCLEOTIDES
 #if PROFILE
-    if (l1 == 1 && l2 == 1) profile_score_internal_1x1_nucleotides[i*(L+1)+j].second += value;
+    if (l1 == 1 && l2 == 1) profile_score_internal_1x1_nucleotides[ProfileLoopIndex(i,j)].second += value;
 #else
     if (l1 == 1 && l2 == 1) score_internal_1x1_nucleotides[s[i+1]][s[j]].second += value;
 #endif
 #endif
 #if PARAMS_INTERNAL_1x2_NUCLEOTIDES
 #if PROFILE
-    if (l1 == 1 && l2 == 2) profile_score_internal_1x2_nucleotides[i*(L+1)+j].second += value;
-    if (l1 == 2 && l2 == 1) profile_score_internal_2x1_nucleotides[i*(L+1)+j].second += value;
+    if (l1 == 1 && l2 == 2) profile_score_internal_1x2_nucleotides[ProfileLoopIndex(i,j)].second += value;
+    if (l1 == 2 && l2 == 1) profile_score_internal_2x1_nucleotides[ProfileLoopIndex(i,j)].second += value;
 #else
     if (l1 == 1 && l2 == 2) score_internal_1x2_nucleotides[s[i+1]][s[j-1]][s[j]].second += value;
     if (l1 == 2 && l2 == 1) score_internal_2x1_nucleotides[s[i+1]][s[i+2]][s[j]].second += value;
@@ -3122,7 +3682,7 @@ inline void InferenceEngine<RealT>::CountSingleNucleotides(int i, int j, int p,
 #endif
 #if PARAMS_INTERNAL_2x2_NUCLEOTIDES
 #if PROFILE
-    if (l1 == 2 && l2 == 2) profile_score_internal_2x2_nucleotides[i*(L+1)+j].second += value;
+    if (l1 == 2 && l2 == 2) profile_score_internal_2x2_nucleotides[ProfileLoopIndex(i,j)].second += value;
 #else
     if (l1 == 2 && l2 == 2) score_internal_2x2_nucleotides[s[i+1]][s[i+2]][s[j-1]][s[j]].second += value;
 #endif
@@ -3270,6 +3830,7 @@ inline std::pair<int,int> InferenceEngine<RealT>::DecodeTraceback(int s) const
 template<class RealT>
 void InferenceEngine<RealT>::ComputeViterbi()
 {
+    Assert(!sparse_tables, "Exact inference requires the dense tables.");
     InitializeCache();
    
 #if SHOW_TIMINGS
@@ -3286,30 +3847,33 @@ void InferenceEngine<RealT>::ComputeViterbi()
     // initialization
 
     F5t.clear(); F5t.resize(L+1, -1);
-    FCt.clear(); FCt.resize(SIZE, -1);
-    FMt.clear(); FMt.resize(SIZE, -1);
-    FM1t.clear(); FM1t.resize(SIZE, -1);
+    AllocateTable(FCt, SIZE, -1);
+    AllocateTable(FMt, SIZE, -1);
+    AllocateTable(FM1t, SIZE, -1);
 
     F5v.clear(); F5v.resize(L+1, RealT(NEG_INF));
-    FCv.clear(); FCv.resize(SIZE, RealT(NEG_INF));
-    FMv.clear(); FMv.resize(SIZE, RealT(NEG_INF));
-    FM1v.clear(); FM1v.resize(SIZE, RealT(NEG_INF));
+    AllocateTable(FCv, SIZE, RealT(NEG_INF));
+    AllocateTable(FMv, SIZE, RealT(NEG_INF));
+    AllocateTable(FM1v, SIZE, RealT(NEG_INF));
     
 #if PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR
-    FEt.clear(); FEt.resize(SIZE, -1);
-    FNt.clear(); FNt.resize(SIZE, -1);
-    FEv.clear(); FEv.resize(SIZE, RealT(NEG_INF));
-    FNv.clear(); FNv.resize(SIZE, RealT(NEG_INF));
+    AllocateTable(FEt, SIZE, -1);
+    AllocateTable(FNt, SIZE, -1);
+    AllocateTable(FEv, SIZE, RealT(NEG_INF));
+    AllocateTable(FNv, SIZE, RealT(NEG_INF));
 #endif
     
     for (int i = L; i >= 0; i--)
     {
+#if FAST_HELIX_LENGTHS && (PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR)
+        ExtendHelixSums(i, i+D_MAX_HELIX_LENGTH-1);
+#endif
         
 #if CANDIDATE_LIST
         candidates.clear();
 #endif
         
-        for (int j = i; j <= L; j++)
+        for (int j = i; j <= std::min(L, i+MaxEntrySpan()); j++)
         {
             // FM2[i,j] = MAX (i<k<j : FM1[i,k] + FM[k,j])
 
@@ -4098,6 +4662,7 @@ std::vector<RealT> InferenceEngine<RealT>::ComputeViterbiFeatureCounts()
 template<class RealT>
 void InferenceEngine<RealT>::ComputeInside()
 {
+    Assert(!sparse_tables, "Exact inference requires the dense tables.");
     InitializeCache();
         
 #if SHOW_TIMINGS
@@ -4107,18 +4672,38 @@ void InferenceEngine<RealT>::ComputeInside()
     // initialization
 
     F5i.clear(); F5i.resize(L+1, RealT(NEG_INF));
-    FCi.clear(); FCi.resize(SIZE, RealT(NEG_INF));
-    FMi.clear(); FMi.resize(SIZE, RealT(NEG_INF));
-    FM1i.clear(); FM1i.resize(SIZE, RealT(NEG_INF));
+    AllocateTable(FCi, SIZE, RealT(NEG_INF));
+    AllocateTable(FMi, SIZE, RealT(NEG_INF));
+    AllocateTable(FM1i, SIZE, RealT(NEG_INF));
     
 #if PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR
-    FEi.clear(); FEi.resize(SIZE, RealT(NEG_INF));
-    FNi.clear(); FNi.resize(SIZE, RealT(NEG_INF));
+    AllocateTable(FEi, SIZE, RealT(NEG_INF));
+    AllocateTable(FNi, SIZE, RealT(NEG_INF));
 #endif
 
-    for (int i = L; i >= 0; i--)
+#if BLOCKED_MULTI_SPLITS
+    ResetMultiSplitBlocks();
+#endif
+    
+#if BLOCKED_MULTI_SPLITS
+    const int block = MULTI_SPLIT_BLOCK;
+#else
+    const int block = 1;
+#endif
+    
+    // Fill a block of rows at a time, column by column, so that the
+    // multiloop splits of each tile can be summed together (see
+    // SumMultiSplitsBlocked()).  With block = 1, this is the usual
+    // row by row order.
+    
+    for (int i0 = L - L % block; i0 >= 0; i0 -= block)
     {
-        for (int j = i; j <= L; j++)
+#if FAST_HELIX_LENGTHS && (PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR)
+        ExtendHelixSums(i0, i0+block+D_MAX_HELIX_LENGTH-2);
+#endif
+        
+        for (int j = i0; j <= std::min(L, i0+block-1+MaxEntrySpan()); j++)
+        for (int i = std::min(j, i0 + block - 1); i >= std::max(i0, j - MaxEntrySpan()); i--)
         {
             
             // FM2[i,j] = SUM (i<k<j : FM1[i,k] + FM[k,j])
@@ -4130,6 +4715,10 @@ void InferenceEngine<RealT>::ComputeInside()
             for (int k = i+1; k < j; k++)
                 Fast_LogPlusEquals(FM2i, FM1i[offset[i]+k] + FMi[offset[k]+j]);
             
+#elif BLOCKED_MULTI_SPLITS
+            
+            FM2i = SumMultiSplitsBlocked(FM1i, FMi, i, j);
+            
 #else
             
             if (i+2 <= j)
@@ -4390,6 +4979,7 @@ void InferenceEngine<RealT>::ComputeInside()
                     Fast_LogPlusEquals(sum_i, FM1i[offset[i+1]+j] + ScoreMultiUnpaired(i+1));
                 
                 FM1i[offset[i]+j] = sum_i;
+                
             }
             
             // FM[i,j] = optimal energy for substructure belonging to a
@@ -4474,13 +5064,13 @@ void InferenceEngine<RealT>::ComputeOutside()
     // initialization
     
     F5o.clear(); F5o.resize(L+1, RealT(NEG_INF));
-    FCo.clear(); FCo.resize(SIZE, RealT(NEG_INF));
-    FMo.clear(); FMo.resize(SIZE, RealT(NEG_INF));
-    FM1o.clear(); FM1o.resize(SIZE, RealT(NEG_INF));
+    AllocateTable(FCo, SIZE, RealT(NEG_INF));
+    AllocateTable(FMo, SIZE, RealT(NEG_INF));
+    AllocateTable(FM1o, SIZE, RealT(NEG_INF));
     
 #if PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR
-    FEo.clear(); FEo.resize(SIZE, RealT(NEG_INF));
-    FNo.clear(); FNo.resize(SIZE, RealT(NEG_INF));
+    AllocateTable(FEo, SIZE, RealT(NEG_INF));
+    AllocateTable(FNo, SIZE, RealT(NEG_INF));
 #endif
     
     F5o[L] = RealT(0);  
@@ -4513,9 +5103,21 @@ void InferenceEngine<RealT>::ComputeOutside()
         }
     }
     
+#if SPARSE_PARTITION_FUNCTION
+    std::vector<int> candidates;
+    candidates.reserve(L+1);
+#endif
+    
     for (int i = 0; i <= L; i++)
     {
-        for (int j = L; j >= i; j--)
+#if FAST_HELIX_LENGTHS && (PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR)
+        ExtendHelixSums(i, i+D_MAX_HELIX_LENGTH-1);
+#endif
+#if SPARSE_PARTITION_FUNCTION
+        FillMultiSplitCandidates(candidates, FM1i, i);
+#endif
+        
+        for (int j = std::min(L, i+MaxEntrySpan()); j >= i; j--)
         {
             RealT FM2o = RealT(NEG_INF);
             
@@ -4776,6 +5378,18 @@ void InferenceEngine<RealT>::ComputeOutside()
             }
 
 #else
+#if SPARSE_PARTITION_FUNCTION
+            if (2*candidates.size() < size_t(std::max(j-i-1,0)))
+            {
+                for (size_t kp = 0; kp < candidates.size() && candidates[kp] < j; kp++)
+                {
+                    const int k = candidates[kp];
+                    Fast_LogPlusEquals(FM1o[offset[i]+k], FM2o + FMi[offset[k]+j]);
+                    Fast_LogPlusEquals(FMo[offset[k]+j], FM2o + FM1i[offset[i]+k]);
+                }
+            }
+            else
+#endif
             if (i+2 <= j)
             {
                 RealT *p1i = &(FM1i[offset[i]+i+1]);
@@ -4837,8 +5451,16 @@ std::vector<RealT> InferenceEngine<RealT>::ComputeFeatureCountExpectations()
 
     ClearCounts();
     
+#if BLOCKED_MULTI_SPLITS
+    ResetMultiSplitBlocks();
+#endif
+    
     for (int i = L; i >= 0; i--)
     {
+#if FAST_HELIX_LENGTHS && (PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR)
+        ExtendHelixSums(i, i+D_MAX_HELIX_LENGTH-1);
+#endif
+        
         for (int j = i; j <= L; j++)
         {
 
@@ -4851,6 +5473,10 @@ std::vector<RealT> InferenceEngine<RealT>::ComputeFeatureCountExpectations()
             for (int k = i+1; k < j; k++)
                 Fast_LogPlusEquals(FM2i, FM1i[offset[i]+k] + FMi[offset[k]+j]);
             
+#elif BLOCKED_MULTI_SPLITS
+            
+            FM2i = SumMultiSplitsBlocked(FM1i, FMi, i, j);
+            
 #else
             
             if (i+2 <= j)
@@ -5224,8 +5850,16 @@ std::vector<RealT> InferenceEngine<RealT>::ComputeFeatureCountExpectationsESS()
 
     ClearCounts();
     
+#if BLOCKED_MULTI_SPLITS
+    ResetMultiSplitBlocks();
+#endif
+    
     for (int i = L; i >= 0; i--)
     {
+#if FAST_HELIX_LENGTHS && (PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR)
+        ExtendHelixSums(i, i+D_MAX_HELIX_LENGTH-1);
+#endif
+        
         for (int j = i; j <= L; j++)
         {
 
@@ -5238,6 +5872,10 @@ std::vector<RealT> InferenceEngine<RealT>::ComputeFeatureCountExpectationsESS()
             for (int k = i+1; k < j; k++)
                 Fast_LogPlusEquals(FM2i_ess, FM1i_ess[offset[i]+k] + FMi_ess[offset[k]+j]);
             
+#elif BLOCKED_MULTI_SPLITS
+            
+            FM2i_ess = SumMultiSplitsBlocked(FM1i_ess, FMi_ess, i, j);
+            
 #else
             
             if (i+2 <= j)
@@ -5600,16 +6238,27 @@ std::vector<RealT> InferenceEngine<RealT>::ComputeFeatureCountExpectationsESS()
 template<class RealT>
 void InferenceEngine<RealT>::ComputePosterior()
 { 
-    posterior.clear();
-    posterior.resize(SIZE, RealT(0));
+    AllocateTable(posterior, SIZE, RealT(0));
     
     //double starting_time = GetSystemTime();
 
     const RealT Z = ComputeLogPartitionCoefficient();
     
+#if SPARSE_PARTITION_FUNCTION
+    std::vector<int> candidates;
+    candidates.reserve(L+1);
+#endif
+    
     for (int i = L; i >= 0; i--)
     {
-        for (int j = i; j <= L; j++)
+#if FAST_HELIX_LENGTHS && (PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR)
+        ExtendHelixSums(i, i+D_MAX_HELIX_LENGTH-1);
+#endif
+#if SPARSE_PARTITION_FUNCTION
+        FillMultiSplitCandidates(candidates, FM1i, i);
+#endif
+        
+        for (int j = i; j <= std::min(L, i+MaxEntrySpan()); j++)
         {
             
             // FM2[i,j] = SUM (i<k<j : FM1[i,k] + FM[k,j])
@@ -5623,6 +6272,17 @@ void InferenceEngine<RealT>::ComputePosterior()
             
 #else
             
+#if SPARSE_PARTITION_FUNCTION
+            if (2*candidates.size() < size_t(std::max(j-i-1,0)))
+            {
+                for (size_t kp = 0; kp < candidates.size() && candidates[kp] < j; kp++)
+                {
+                    const int k = candidates[kp];
+                    Fast_LogPlusEquals(FM2i, FM1i[offset[i]+k] + FMi[offset[k]+j]);
+                }
+            }
+            else
+#endif
             if (i+2 <= j)
             {
                 const RealT *p1 = &(FM1i[offset[i]+i+1]);
@@ -5720,7 +6380,7 @@ void InferenceEngine<RealT>::ComputePosterior()
                 // compute ScoreBP(i+1,j) + ScoreHelixStacking(i,j+1) + FE[i+1,j-1]
                 
                 if (i+2 <= j && allow_paired[offset[i+1]+j])
-                    posterior[offset[i]+j] += Fast_Exp(outside + ScoreBasePair(i+1,j) + ScoreHelixStacking(i,j+1) + FEi[offset[i+1]+j-1]);
+                    posterior[offset[i+1]+j] += Fast_Exp(outside + ScoreBasePair(i+1,j) + ScoreHelixStacking(i,j+1) + FEi[offset[i+1]+j-1]);
                 
                 // compute FN(i,j) -- do nothing
                 
@@ -5932,17 +6592,28 @@ void InferenceEngine<RealT>::ComputePosterior()
 template<class RealT>
 void InferenceEngine<RealT>::ComputePosteriorESS()
 { 
-    posterior.clear();
-    posterior.resize(SIZE, RealT(0));
+    AllocateTable(posterior, SIZE, RealT(0));
     
     //double starting_time = GetSystemTime();
 
     const RealT Z = ComputeLogPartitionCoefficientESS();
 
     
+#if SPARSE_PARTITION_FUNCTION
+    std::vector<int> candidates;
+    candidates.reserve(L+1);
+#endif
+    
     for (int i = L; i >= 0; i--)
     {
-        for (int j = i; j <= L; j++)
+#if FAST_HELIX_LENGTHS && (PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR)
+        ExtendHelixSums(i, i+D_MAX_HELIX_LENGTH-1);
+#endif
+#if SPARSE_PARTITION_FUNCTION
+        FillMultiSplitCandidates(candidates, FM1i_ess, i);
+#endif
+        
+        for (int j = i; j <= std::min(L, i+MaxEntrySpan()); j++)
         {
             
             // FM2[i,j] = SUM (i<k<j : FM1[i,k] + FM[k,j])
@@ -5956,6 +6627,17 @@ void InferenceEngine<RealT>::ComputePosteriorESS()
             
 #else
             
+#if SPARSE_PARTITION_FUNCTION
+            if (2*candidates.size() < size_t(std::max(j-i-1,0)))
+            {
+                for (size_t kp = 0; kp < candidates.size() && candidates[kp] < j; kp++)
+                {
+                    const int k = candidates[kp];
+                    Fast_LogPlusEquals(FM2i_ess, FM1i_ess[offset[i]+k] + FMi_ess[offset[k]+j]);
+                }
+            }
+            else
+#endif
             if (i+2 <= j)
             {
                 const RealT *p1 = &(FM1i_ess[offset[i]+i+1]);
@@ -6055,7 +6737,7 @@ void InferenceEngine<RealT>::ComputePosteriorESS()
                 // compute ScoreBP(i+1,j) + ScoreHelixStacking(i,j+1) + FE[i+1,j-1]
                 
                 if (i+2 <= j && allow_paired[offset[i+1]+j]) {
-                    posterior[offset[i]+j] += Fast_Exp(outside + ScoreBasePairEvidence(i+1,j) + ScoreHelixStacking(i,j+1) + FEi_ess[offset[i+1]+j-1]);
+                    posterior[offset[i+1]+j] += Fast_Exp(outside + ScoreBasePairEvidence(i+1,j) + ScoreHelixStacking(i,j+1) + FEi_ess[offset[i+1]+j-1]);
 
                 }
 
@@ -6388,6 +7070,10 @@ std::vector<int> InferenceEngine<RealT>::PredictPairingsPosterior(const RealT ga
         }
     }
     
+    delete [] unpaired_posterior;
+    delete [] score;
+    delete [] traceback;
+
     return solution;
 }
 
@@ -6505,28 +7191,1194 @@ std::vector<int> InferenceEngine<RealT>::PredictPairingsPosteriorCentroid(const
         }
     }
 
+    delete [] score;
+    delete [] traceback;
+
     return solution;
 }
 
-
 //////////////////////////////////////////////////////////////////////
-// InferenceEngine::GetPosterior()
+// InferenceEngine::PredictPairingsPosteriorSparse()
 //
-// Return posterior probability matrix, thresholded.
+// Maximize the same objective as PredictPairingsPosterior() (or,
+// if centroid is set, PredictPairingsPosteriorCentroid()), but
+// decompose each interval by its last position, which is either
+// unpaired or paired with some k.  Only base-pairs that can raise
+// the objective are tried, so for at most d such pairs ending at
+// each position this takes O(L^2 d) rather than O(L^3) time.  This
+// suits the sparse posteriors of span-limited and beam-pruned
+// inference.  Ties may be broken differently from the dense
+// decoders.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+std::vector<int> InferenceEngine<RealT>::PredictPairingsPosteriorSparse(const RealT gamma, const bool centroid) const
+{
+    Assert(gamma > 0, "Non-negative gamma expected.");
+    
+#if SHOW_TIMINGS
+    double starting_time = GetSystemTime();
+#endif
+
+    // compute the scores for unpaired nucleotides, subtracting the
+    // posteriors of the pairs (k,i) and then of the pairs (i,j), and
+    // list the base-pairs (k,j) with positive score by their right
+    // end j
+    
+    std::vector<std::vector<std::pair<int,RealT> > > pairs;
+    GetPosterior(pairs, RealT(0));
+
+    std::vector<RealT> unpaired_score(L+1, RealT(0));
+    if (!centroid)
+    {
+        std::vector<RealT> unpaired_posterior(L+1, RealT(1));
+        for (int i = 1; i <= L; i++)
+            for (size_t kp = 0; kp < pairs[i].size(); kp++)
+                unpaired_posterior[i] -= pairs[i][kp].second;
+        for (int j = 1; j <= L; j++)
+            for (size_t kp = 0; kp < pairs[j].size(); kp++)
+                unpaired_posterior[pairs[j][kp].first] -= pairs[j][kp].second;
+        for (int i = 1; i <= L; i++)
+            unpaired_score[i] = unpaired_posterior[i] / (2 * gamma);
+    }
+
+    for (int j = 1; j <= L; j++)
+    {
+        size_t kept = 0;
+        for (size_t kp = 0; kp < pairs[j].size(); kp++)
+        {
+            const int k = pairs[j][kp].first;
+            if (!AllowPaired(k,j)) continue;
+            const RealT pair_score = centroid ? (gamma + 1)*pairs[j][kp].second - 1 : pairs[j][kp].second;
+            if (pair_score > RealT(0)) pairs[j][kept++] = std::make_pair(k, pair_score);
+        }
+        pairs[j].resize(kept);
+    }
+    
+    // dynamic programming; traceback 0 for empty, 1 for the last
+    // position unpaired, and k+2 for the last position paired with k
+    
+    std::vector<RealT> score(SIZE, RealT(NEG_INF));
+    std::vector<int> traceback(SIZE, -1);
+    
+    for (int i = L; i >= 0; i--)
+    {
+        score[offset[i]+i] = RealT(0);
+        traceback[offset[i]+i] = 0;
+        
+        for (int j = i+1; j <= L; j++)
+        {
+            RealT &this_score = score[offset[i]+j];
+            int &this_traceback = traceback[offset[i]+j];
+            
+            if (allow_unpaired_position[j])
+                UPDATE_MAX(this_score, this_traceback, unpaired_score[j] + score[offset[i]+j-1], 1);
+            
+            for (int kp = int(pairs[j].size()) - 1; kp >= 0 && pairs[j][kp].first > i; kp--)
+            {
+                const int k = pairs[j][kp].first;
+                UPDATE_MAX(this_score, this_traceback, score[offset[i]+k-1] + pairs[j][kp].second + score[offset[k]+j-1], k+2);
+            }
+        }
+    }
+    
+#if SHOW_TIMINGS
+    std::cerr << "Time: " << GetSystemTime() - starting_time << std::endl;
+#endif
+    
+    // perform traceback
+    
+    std::vector<int> solution(L+1,SStruct::UNPAIRED);
+    solution[0] = SStruct::UNKNOWN;
+    
+    std::vector<std::pair<int,int> > traceback_stack(1, std::make_pair(0, L));
+    
+    while (!traceback_stack.empty())
+    {
+        const int i = traceback_stack.back().first;
+        const int j = traceback_stack.back().second;
+        traceback_stack.pop_back();
+        
+        switch (traceback[offset[i]+j])
+        {
+            case -1:
+                Assert(false, "Should not get here.");
+                break;
+            case 0: 
+                break;
+            case 1: 
+                traceback_stack.push_back(std::make_pair(i,j-1));
+                break;
+            default:
+            {
+                const int k = traceback[offset[i]+j] - 2;
+                solution[k] = j;
+                solution[j] = k;
+                traceback_stack.push_back(std::make_pair(i,k-1));
+                traceback_stack.push_back(std::make_pair(k,j-1));
+            }
+            break;       
+        }
+    }
+    
+    return solution;
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::ComputeExpectedAccuracy()
+//
+// Score a predicted structure against the posterior distribution
+// over structures computed by ComputePosterior() or
+// ComputePosteriorESS().  The expected counts of true positive,
+// false positive and false negative base-pairs are
+//
+//     TP = sum of P(i,j) over predicted pairs (i,j)
+//     FP = (number of predicted pairs) - TP
+//     FN = (sum of P(i,j) over all pairs) - TP
+//
+// from which sensitivity, PPV, F1 and MCC are computed as ratios of
+// expectations.  The ensemble defect is the expected number of
+// positions whose pairing status differs from the prediction, and
+// the MEA objective is the quantity maximized by
+// PredictPairingsPosterior() for the given gamma.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+ExpectedAccuracy<RealT> InferenceEngine<RealT>::ComputeExpectedAccuracy(const std::vector<int> &mapping, const RealT gamma) const
+{
+    Assert(int(mapping.size()) == L+1, "Supplied mapping of incorrect length!");
+    Assert(gamma > 0, "Non-negative gamma expected.");
+
+    // expected number of pairs, and unpaired probabilities
+    std::vector<std::vector<std::pair<int,RealT> > > pairs;
+    GetPosterior(pairs, RealT(0));
+    std::vector<double> unpaired_posterior(L+1, 1.0);
+    double expected_pairs = 0;
+    for (int j = 1; j <= L; j++)
+    {
+        for (size_t k = 0; k < pairs[j].size(); k++)
+        {
+            const double p = pairs[j][k].second;
+            unpaired_posterior[pairs[j][k].first] -= p;
+            unpaired_posterior[j] -= p;
+            expected_pairs += p;
+        }
+    }
+
+    // agreement of each position with the prediction
+    double tp = 0, predicted_pairs = 0, correct_positions = 0, mea = 0;
+    for (int i = 1; i <= L; i++)
+    {
+        if (mapping[i] == SStruct::UNPAIRED || mapping[i] == SStruct::UNKNOWN)
+        {
+            correct_positions += unpaired_posterior[i];
+            mea += unpaired_posterior[i] / (2 * gamma);
+        }
+        else
+        {
+            const int j = mapping[i];
+            const std::vector<std::pair<int,RealT> > &column = pairs[std::max(i,j)];
+            typename std::vector<std::pair<int,RealT> >::const_iterator iter =
+                std::lower_bound(column.begin(), column.end(), std::make_pair(std::min(i,j), RealT(NEG_INF)));
+            const double p = (iter != column.end() && iter->first == std::min(i,j) ? iter->second : 0);
+            correct_positions += p;
+            if (i < j)
+            {
+                tp += p;
+                predicted_pairs += 1;
+                mea += p;
+            }
+        }
+    }
+
+    const double fp = predicted_pairs - tp;
+    const double fn = expected_pairs - tp;
+    const double tn = 0.5 * L * (L-1) - tp - fp - fn;
+    const double mcc_denominator = std::sqrt((tp + fp) * (tp + fn) * (tn + fp) * (tn + fn));
+
+    ExpectedAccuracy<RealT> ret;
+    ret.ensemble_defect = RealT(L - correct_positions);
+    ret.sensitivity = RealT(expected_pairs > 0 ? tp / expected_pairs : 0);
+    ret.ppv = RealT(predicted_pairs > 0 ? tp / predicted_pairs : 0);
+    ret.f1 = RealT(predicted_pairs + expected_pairs > 0 ? 2 * tp / (predicted_pairs + expected_pairs) : 0);
+    ret.mcc = RealT(mcc_denominator > 0 ? (tp * tn - fp * fn) / mcc_denominator : 0);
+    ret.mea_objective = RealT(mea);
+    return ret;
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::GetPosterior()
+//
+// Return posterior probability matrix, thresholded.
 //////////////////////////////////////////////////////////////////////
 
 template<class RealT>
 RealT *InferenceEngine<RealT>::GetPosterior(const RealT posterior_cutoff) const
 {
-    RealT *ret = new RealT[SIZE];
-    for (int i = 0; i < SIZE; i++)
-        ret[i] = (posterior[i] >= posterior_cutoff ? posterior[i] : RealT(0));
-    return ret;
+    RealT *ret = new RealT[SIZE];
+    GetPosterior(ret, posterior_cutoff);
+    return ret;
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::GetPosterior()
+//
+// Write thresholded posterior probability matrix into a
+// caller-provided buffer of GetPosteriorSize() entries.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::GetPosterior(RealT *ret, const RealT posterior_cutoff) const
+{
+    Assert(!sparse_tables, "Dense posteriors are not kept with sparse tables.");
+    for (int i = 0; i < SIZE; i++)
+        ret[i] = (posterior[i] >= posterior_cutoff ? posterior[i] : RealT(0));
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::LoadPosterior()
+//
+// Replace the posterior probability matrix of the current sequence,
+// e.g. by posteriors averaged over several models, so that it can be
+// decoded by PredictPairingsPosterior() and friends.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::LoadPosterior(const std::vector<RealT> &values)
+{
+    Assert(!sparse_tables, "Dense posteriors are not kept with sparse tables.");
+    Assert(int(values.size()) == SIZE, "Posterior matrix size mismatch.");
+    posterior = values;
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::GetPosterior()
+// InferenceEngine::LoadPosterior()
+//
+// Posteriors as lists of the pairs (i,P(i,j)) with nonzero
+// probability, by right end j and sorted by i.  These apply with
+// or without sparse tables.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::GetPosterior(std::vector<std::vector<std::pair<int,RealT> > > &ret, const RealT posterior_cutoff) const
+{
+    ret.clear();
+    ret.resize(L+1);
+    
+    if (sparse_tables)
+    {
+        for (int j = 1; j <= L; j++)
+            for (size_t k = 0; k < sparse_posterior[j].size(); k++)
+                if (sparse_posterior[j][k].second >= posterior_cutoff)
+                    ret[j].push_back(sparse_posterior[j][k]);
+        return;
+    }
+
+    for (int i = 1; i <= L; i++)
+    {
+        for (int j = i+1; j <= L; j++)
+        {
+            const RealT p = posterior[offset[i]+j];
+            if (p != RealT(0) && p >= posterior_cutoff) ret[j].push_back(std::make_pair(i, p));
+        }
+    }
+}
+
+template<class RealT>
+void InferenceEngine<RealT>::LoadPosterior(const std::vector<std::vector<std::pair<int,RealT> > > &values)
+{
+    Assert(int(values.size()) == L+1, "Posterior matrix size mismatch.");
+    
+    if (sparse_tables)
+    {
+        sparse_posterior = values;
+        return;
+    }
+
+    AllocateTable(posterior, SIZE, RealT(0));
+    for (int j = 1; j <= L; j++)
+        for (size_t k = 0; k < values[j].size(); k++)
+            posterior[offset[values[j][k].first]+j] = values[j][k].second;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Beam-pruned inference
+//
+// The routines below compute approximate Viterbi and inside/outside
+// scores in a single left-to-right sweep, in the manner of LinearFold
+// and LinearPartition.  All states (i,j) ending at position j (a
+// "column") are built from columns j' <= j, after which only the
+// beam_width best states of each type are kept.  A state is ranked
+// by F5[i-1] + inside, or F5[i] + inside for the multi-branch loop
+// states, so that states with different start positions compete
+// on the score of the best (or all) prefix structures.
+//
+// The states are those of the exact recurrences, except that the
+// multi-branch loop is split so that every edge reads one earlier
+// column:
+//
+//     FB[i,j]  = multi-branch loop substructure with at least two
+//                helices, the last of which is closed by (k+1,j)
+//
+//              = SUM (k : FM[i,k] + FC[k+1,j-1] + ScoreJunctionA(j,k) + c + ScoreBP(k+1,j))
+//
+//     FM[i,j]  = multi-branch loop substructure with at least one
+//                helix, the first of which starts at letter i+1
+//
+//              = SUM [FC[i+1,j-1] + ScoreJunctionA(j,i) + c + ScoreBP(i+1,j),
+//                     FB[i,j],
+//                     FM[i,j-1] + b]
+//
+//     FM2[i,j] = SUM [FB[i,j], FM2[i,j-1] + b]
+//
+//     FH[i,j]  = ScoreHairpin(i,j)
+//
+// and FN, FE and FC as before.  The 5' unpaired region of a
+// multi-branch loop is limited to C_MAX_SINGLE_LENGTH letters, so
+// that FN[i,j] reads a bounded number of FM2 states.  The states
+// take O(L * beam_width) memory; with UseSparseTables(), so do the
+// constraints and posteriors (only the profile score index of an
+// alignment stays O(L^2)).
+//
+// Each structure has a single derivation here.  In the exact
+// recurrences, a multi-branch loop with three or more helices and
+// unpaired letters before its closing pair has several (through
+// FM[i,j-1] + b and the FM[k,j] of FM2), so with an unlimited beam
+// the Viterbi scores agree but the partition functions differ
+// slightly.
+//////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::BeamScoreBasePair()
+// InferenceEngine::BeamScoreHairpin()
+// InferenceEngine::BeamScoreHelix()
+// InferenceEngine::BeamScoreSingle()
+// InferenceEngine::BeamScoreMultiUnpaired()
+// InferenceEngine::BeamScoreExternalUnpaired()
+//
+// Scoring functions, including evidence terms if requested.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+RealT InferenceEngine<RealT>::BeamScoreBasePair(int i, int j) const
+{
+    return beam_use_evidence ? ScoreBasePairEvidence(i,j) : ScoreBasePair(i,j);
+}
+
+template<class RealT>
+RealT InferenceEngine<RealT>::BeamScoreHairpin(int i, int j) const
+{
+    return beam_use_evidence ? ScoreHairpinEvidence(i,j) : ScoreHairpin(i,j);
+}
+
+template<class RealT>
+RealT InferenceEngine<RealT>::BeamScoreHelix(int i, int j, int m) const
+{
+    return beam_use_evidence ? ScoreHelixEvidence(i,j,m) : ScoreHelix(i,j,m);
+}
+
+template<class RealT>
+RealT InferenceEngine<RealT>::BeamScoreSingle(int i, int j, int p, int q) const
+{
+    return beam_use_evidence ? ScoreSingleEvidence(i,j,p,q) : ScoreSingle(i,j,p,q);
+}
+
+template<class RealT>
+RealT InferenceEngine<RealT>::BeamScoreMultiUnpaired(int i) const
+{
+    return beam_use_evidence ? ScoreMultiUnpairedEvidence(i) : ScoreMultiUnpaired(i);
+}
+
+template<class RealT>
+RealT InferenceEngine<RealT>::BeamScoreExternalUnpaired(int i) const
+{
+    return beam_use_evidence ? ScoreExternalUnpairedEvidence(i) : ScoreExternalUnpaired(i);
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::BeamEdge()
+//
+// Apply the edge from states a and b (either of which may be NULL)
+// to the state (i,j) of the column being processed.  When building
+// a column, the target state is created if necessary and its
+// Viterbi or inside score is updated.  In the outside pass, the
+// outside scores of a and b are updated from the target, if it
+// was kept in the beam.  Returns the log-weight of the edge (the
+// inside score along it, or its inside times outside score).
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+RealT InferenceEngine<RealT>::BeamEdge(int i, RealT score, BeamState *a, BeamState *b, int traceback)
+{
+    RealT value = score;
+    if (a) value += a->inside;
+    if (b) value += b->inside;
+
+    int &k = beam_index[i];
+
+    if (beam_mode == BEAM_OUTSIDE)
+    {
+        if (k < 0) return RealT(NEG_INF);
+        const RealT outside = (*beam_target)[k].outside + score;
+        if (a) Fast_LogPlusEquals(a->outside, outside + (b ? b->inside : RealT(0)));
+        if (b) Fast_LogPlusEquals(b->outside, outside + a->inside);
+        return (*beam_target)[k].outside + value;
+    }
+
+    if (value <= RealT(NEG_INF/2)) return value;
+
+    if (k < 0)
+    {
+        k = int(beam_column.size());
+        BeamState state = { i, traceback, value, RealT(NEG_INF) };
+        beam_column.push_back(state);
+    }
+    else if (beam_mode == BEAM_VITERBI)
+    {
+        UPDATE_MAX(beam_column[k].inside, beam_column[k].traceback, value, traceback);
+    }
+    else
+    {
+        Fast_LogPlusEquals(beam_column[k].inside, value);
+    }
+    return value;
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::BeamExtendHairpin()
+//
+// Schedule the hairpin starting at i for the first column after j
+// in which it can be closed.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::BeamExtendHairpin(int i, int j)
+{
+    for (j++; j < L; j++)
+    {
+        if (!AllowUnpaired(i,j)) return;
+        if (AllowPaired(i,j+1))
+        {
+            beam_hairpins[j].push_back(i);
+            return;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::BeamBifurcations()
+//
+// Viterbi FB states of column j by cube pruning.  An edge ranks as
+// its FM state plus the FC state and score of its last branch, so
+// visiting each branch's FM states best first (beam_order) and
+// merging the branches with a heap yields the edges in order of
+// rank; the first edge reaching each state is its best, and the
+// search stops once beam_width states are built.  These are the
+// states that pruning would keep from all O(b^2) edges, found in
+// O(b log b) time (more if many edges reach the same state).  The
+// inside and outside passes need every edge, and keep the full loop.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::BeamBifurcations(int j)
+{
+    std::vector<BeamState> &branches = beam[BEAM_FC][j-1];
+    std::vector<RealT> branch_score(branches.size());
+    std::priority_queue<std::pair<RealT,std::pair<int,int> > > queue;
+
+    for (size_t c = 0; c < branches.size(); c++)
+    {
+        const int k = branches[c].i - 1;
+        branch_score[c] = ScoreJunctionA(j,k) + ScoreMultiPaired() + BeamScoreBasePair(k+1,j);
+        if (beam[BEAM_FM][k].empty()) continue;
+        const BeamState &multi = beam[BEAM_FM][k][beam_order[k][0]];
+        queue.push(std::make_pair(F5v[multi.i] + (branch_score[c] + multi.inside + branches[c].inside), std::make_pair(int(c), 0)));
+    }
+
+    while (!queue.empty() && int(beam_column.size()) < beam_width)
+    {
+        const int c = queue.top().second.first;
+        const int n = queue.top().second.second;
+        queue.pop();
+
+        const int k = branches[c].i - 1;
+        std::vector<BeamState> &multi = beam[BEAM_FM][k];
+        BeamState &state = multi[beam_order[k][n]];
+        BeamEdge(state.i, branch_score[c], &state, &branches[c], k * NUM_BEAM_TRACEBACK_TYPES + BEAM_TB_BIFURCATION);
+
+        if (n+1 < int(multi.size()))
+        {
+            const BeamState &next = multi[beam_order[k][n+1]];
+            queue.push(std::make_pair(F5v[next.i] + (branch_score[c] + next.inside + branches[c].inside), std::make_pair(c, n+1)));
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::BeamColumn()
+//
+// Apply all edges into states of the given type in column j.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::BeamColumn(int type, int j)
+{
+    // every state lies within some base-pair (i,j+1) with 0 < i <= j < L
+
+    if (j == 0 || j >= L) return;
+
+    switch (type)
+    {
+        case BEAM_FB:
+        {
+            // FB[i,j] = SUM (k : FM[i,k] + FC[k+1,j-1] + ScoreJunctionA(j,k) + c + ScoreBP(k+1,j))
+
+            if (beam_mode == BEAM_VITERBI && j > beam_width)
+            {
+                BeamBifurcations(j);
+                break;
+            }
+
+            std::vector<BeamState> &branches = beam[BEAM_FC][j-1];
+            for (size_t c = 0; c < branches.size(); c++)
+            {
+                const int k = branches[c].i - 1;
+                const RealT score = ScoreJunctionA(j,k) + ScoreMultiPaired() + BeamScoreBasePair(k+1,j);
+                std::vector<BeamState> &multi = beam[BEAM_FM][k];
+                for (size_t m = 0; m < multi.size(); m++)
+                    BeamEdge(multi[m].i, score, &multi[m], &branches[c], k * NUM_BEAM_TRACEBACK_TYPES + BEAM_TB_BIFURCATION);
+            }
+        }
+        break;
+
+        case BEAM_FM:
+        {
+            // FM[i,j] = SUM [FC[i+1,j-1] + ScoreJunctionA(j,i) + c + ScoreBP(i+1,j),
+            //                FB[i,j],
+            //                FM[i,j-1] + b]
+
+            std::vector<BeamState> &branches = beam[BEAM_FC][j-1];
+            for (size_t c = 0; c < branches.size(); c++)
+            {
+                const int i = branches[c].i - 1;
+                if (i > 0)
+                    BeamEdge(i, ScoreJunctionA(j,i) + ScoreMultiPaired() + BeamScoreBasePair(i+1,j), &branches[c], NULL, BEAM_TB_PAIRED);
+            }
+
+            std::vector<BeamState> &multi = beam[BEAM_FB][j];
+            for (size_t m = 0; m < multi.size(); m++)
+                BeamEdge(multi[m].i, RealT(0), &multi[m], NULL, BEAM_TB_BRANCHES);
+
+            if (allow_unpaired_position[j])
+            {
+                std::vector<BeamState> &previous = beam[BEAM_FM][j-1];
+                for (size_t m = 0; m < previous.size(); m++)
+                    BeamEdge(previous[m].i, BeamScoreMultiUnpaired(j), &previous[m], NULL, BEAM_TB_UNPAIRED);
+            }
+        }
+        break;
+
+        case BEAM_FM2:
+        {
+            // FM2[i,j] = SUM [FB[i,j], FM2[i,j-1] + b]
+
+            std::vector<BeamState> &multi = beam[BEAM_FB][j];
+            for (size_t m = 0; m < multi.size(); m++)
+                BeamEdge(multi[m].i, RealT(0), &multi[m], NULL, BEAM_TB_BRANCHES);
+
+            if (allow_unpaired_position[j])
+            {
+                std::vector<BeamState> &previous = beam[BEAM_FM2][j-1];
+                for (size_t m = 0; m < previous.size(); m++)
+                    BeamEdge(previous[m].i, BeamScoreMultiUnpaired(j), &previous[m], NULL, BEAM_TB_UNPAIRED);
+            }
+        }
+        break;
+
+        case BEAM_FH:
+        {
+            // FH[i,j] = ScoreHairpin(i,j), for the hairpins scheduled in column j
+
+            if (beam_mode == BEAM_OUTSIDE) break;
+
+            const std::vector<int> &hairpins = beam_hairpins[j];
+            for (size_t h = 0; h < hairpins.size(); h++)
+                BeamEdge(hairpins[h], BeamScoreHairpin(hairpins[h],j), NULL, NULL, BEAM_TB_HAIRPIN);
+        }
+        break;
+
+#if PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR
+        case BEAM_FN:
+#else
+        case BEAM_FC:
+#endif
+        {
+            // FN[i,j] = SUM [ScoreHairpin(i,j),
+            //                SUM (i<=p<p+2<=q<=j, p-i+j-q>0 : ScoreSingle(i,j,p,q) + FC[p+1,q-1]),
+            //                ScoreJunctionA(i,j) + a + c + SUM (i<=k<=i+C : FM2[k,j] + b * (k-i))]
+            //
+            // (or FC[i,j], with the stacking pair taken as the case p-i+j-q=0)
+
+            std::vector<BeamState> &hairpins = beam[BEAM_FH][j];
+            for (size_t h = 0; h < hairpins.size(); h++)
+                BeamEdge(hairpins[h].i, RealT(0), &hairpins[h], NULL, BEAM_TB_HAIRPIN);
+
+            for (int q = j; q >= 2 && j-q <= C_MAX_SINGLE_LENGTH; q--)
+            {
+                if (q < j && !allow_unpaired_position[q+1]) break;
+                std::vector<BeamState> &inner = beam[BEAM_FC][q-1];
+                for (size_t c = 0; c < inner.size(); c++)
+                {
+                    const int p = inner[c].i - 1;
+                    for (int i = p; i > 0 && p-i+j-q <= C_MAX_SINGLE_LENGTH; i--)
+                    {
+                        if (i < p && !allow_unpaired_position[i+1]) break;
+                        if (!AllowPaired(i,j+1)) continue;
+                        if (i == p && j == q)
+                        {
+#if !PARAMS_HELIX_LENGTH && !PARAMS_ISOLATED_BASE_PAIR
+                            BeamEdge(i, BeamScoreBasePair(i+1,j) + ScoreHelixStacking(i,j+1), &inner[c], NULL, BEAM_TB_SINGLE);
+#endif
+                            continue;
+                        }
+                        BeamEdge(i, BeamScoreSingle(i,j,p,q), &inner[c], NULL,
+                                 ((p-i)*(C_MAX_SINGLE_LENGTH+1)+j-q) * NUM_BEAM_TRACEBACK_TYPES + BEAM_TB_SINGLE);
+                    }
+                }
+            }
+
+            std::vector<BeamState> &multi = beam[BEAM_FM2][j];
+            for (size_t m = 0; m < multi.size(); m++)
+            {
+                const int k = multi[m].i;
+                RealT score = ScoreMultiPaired() + ScoreMultiBase();
+                for (int i = k; i > 0 && k-i <= C_MAX_SINGLE_LENGTH; i--)
+                {
+                    if (i < k)
+                    {
+                        if (!allow_unpaired_position[i+1]) break;
+                        score += BeamScoreMultiUnpaired(i+1);
+                    }
+                    if (AllowPaired(i,j+1))
+                        BeamEdge(i, score + ScoreJunctionA(i,j), &multi[m], NULL, (k-i) * NUM_BEAM_TRACEBACK_TYPES + BEAM_TB_MULTI);
+                }
+            }
+        }
+        break;
+
+#if PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR
+        case BEAM_FE:
+        {
+            // FE[i,j] = SUM [ScoreBP(i+1,j) + ScoreHelixStacking(i,j+1) + FE[i+1,j-1],
+            //                FN(i,j)]
+
+            std::vector<BeamState> &loops = beam[BEAM_FN][j];
+            for (size_t n = 0; n < loops.size(); n++)
+                BeamEdge(loops[n].i, RealT(0), &loops[n], NULL, BEAM_TB_LOOP);
+
+            std::vector<BeamState> &inner = beam[BEAM_FE][j-1];
+            for (size_t e = 0; e < inner.size(); e++)
+            {
+                const int i = inner[e].i - 1;
+                if (i == 0 || !AllowPaired(i,j+1)) continue;
+                const RealT value = BeamEdge(i, BeamScoreBasePair(i+1,j) + ScoreHelixStacking(i,j+1), &inner[e], NULL, BEAM_TB_STACKING);
+                if (beam_mode == BEAM_OUTSIDE && value > RealT(NEG_INF/2))
+                    BeamAddPosterior(i+1, j, Fast_Exp(value - F5i[L]));
+            }
+        }
+        break;
+
+        case BEAM_FC:
+        {
+            // FC[i,j] = SUM [ScoreIsolated() + FN(i,j),
+            //                SUM (2<=k<D : FN(i+k-1,j-k+1) + ScoreHelix(i-1,j+1,k)),
+            //                FE(i+D-1,j-D+1) + ScoreHelix(i-1,j+1,D)]
+
+            std::vector<BeamState> &loops = beam[BEAM_FN][j];
+            for (size_t n = 0; n < loops.size(); n++)
+                BeamEdge(loops[n].i, ScoreIsolated(), &loops[n], NULL, BEAM_TB_LOOP);
+
+            for (int k = 2; k <= D_MAX_HELIX_LENGTH && j-k+1 > 0; k++)
+            {
+                std::vector<BeamState> &inner = beam[k < D_MAX_HELIX_LENGTH ? BEAM_FN : BEAM_FE][j-k+1];
+                for (size_t n = 0; n < inner.size(); n++)
+                {
+                    const int i = inner[n].i - k + 1;
+                    if (i <= 0) continue;
+                    int p = 0;
+                    while (p < k-1 && AllowPaired(i+p,j-p+1)) p++;
+                    if (p < k-1) continue;
+
+                    const RealT value = BeamEdge(i, BeamScoreHelix(i-1,j+1,k), &inner[n], NULL, k * NUM_BEAM_TRACEBACK_TYPES + BEAM_TB_HELIX);
+                    if (beam_mode == BEAM_OUTSIDE && value > RealT(NEG_INF/2))
+                    {
+                        const RealT probability = Fast_Exp(value - F5i[L]);
+                        for (p = 1; p < k; p++)
+                            BeamAddPosterior(i+p, j-p+1, probability);
+                    }
+                }
+            }
+        }
+        break;
+#endif
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::BeamPrune()
+//
+// Keep the beam_width best states of the column just built, ranked
+// by the score of the best prefix structure plus their own score,
+// and store them sorted by start position.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::BeamPrune(int type, int j)
+{
+    const std::vector<RealT> &F5 = (beam_mode == BEAM_VITERBI ? F5v : F5i);
+    const int prefix = (type == BEAM_FB || type == BEAM_FM || type == BEAM_FM2) ? 0 : 1;
+
+    for (size_t k = 0; k < beam_column.size(); k++)
+        beam_index[beam_column[k].i] = -1;
+
+    if (int(beam_column.size()) > beam_width)
+    {
+        std::vector<RealT> scores(beam_column.size());
+        for (size_t k = 0; k < beam_column.size(); k++)
+            scores[k] = F5[beam_column[k].i - prefix] + beam_column[k].inside;
+        std::nth_element(scores.begin(), scores.begin() + (beam_width - 1), scores.end(), std::greater<RealT>());
+        const RealT threshold = scores[beam_width - 1];
+
+        int kept = 0;
+        for (size_t k = 0; k < beam_column.size() && kept < beam_width; k++)
+            if (F5[beam_column[k].i - prefix] + beam_column[k].inside >= threshold)
+                beam_column[kept++] = beam_column[k];
+        beam_column.resize(kept);
+    }
+
+    std::sort(beam_column.begin(), beam_column.end());
+    beam[type][j] = beam_column;
+    beam_column.clear();
+
+    // rank the FM states for BeamBifurcations()
+    if (type == BEAM_FM && beam_mode == BEAM_VITERBI)
+    {
+        const std::vector<BeamState> &states = beam[type][j];
+        std::vector<std::pair<RealT,int> > ranked(states.size());
+        for (size_t k = 0; k < states.size(); k++)
+            ranked[k] = std::make_pair(-(F5[states[k].i] + states[k].inside), int(k));
+        std::sort(ranked.begin(), ranked.end());
+        beam_order[j].resize(ranked.size());
+        for (size_t k = 0; k < ranked.size(); k++)
+            beam_order[j][k] = ranked[k].second;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::BeamExternal()
+//
+// Compute F5[j] from F5[j-1] and the FC states of column j-1, or
+// in the outside pass, propagate F5o[j] back to them.
+//
+// F5[j] = SUM [F5[j-1] + ScoreExternalUnpaired(),
+//              SUM (0<=k<j : F5[k] + FC[k+1,j-1] + ScoreExternalPaired() + ScoreBP(k+1,j) + ScoreJunctionA(j,k))]
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::BeamExternal(int j)
+{
+    std::vector<BeamState> &branches = beam[BEAM_FC][j-1];
+
+    if (beam_mode == BEAM_OUTSIDE)
+    {
+        if (allow_unpaired_position[j])
+            Fast_LogPlusEquals(F5o[j-1], F5o[j] + BeamScoreExternalUnpaired(j));
+        for (size_t c = 0; c < branches.size(); c++)
+        {
+            const int k = branches[c].i - 1;
+            const RealT outside = F5o[j] + ScoreExternalPaired() + BeamScoreBasePair(k+1,j) + ScoreJunctionA(j,k);
+            Fast_LogPlusEquals(F5o[k], outside + branches[c].inside);
+            Fast_LogPlusEquals(branches[c].outside, outside + F5i[k]);
+        }
+        return;
+    }
+
+    std::vector<RealT> &F5 = (beam_mode == BEAM_VITERBI ? F5v : F5i);
+    RealT best_v = RealT(NEG_INF);
+    int best_t = -1;
+
+    if (allow_unpaired_position[j])
+    {
+        best_v = F5[j-1] + BeamScoreExternalUnpaired(j);
+        best_t = BEAM_TB_UNPAIRED;
+    }
+
+    for (size_t c = 0; c < branches.size(); c++)
+    {
+        const int k = branches[c].i - 1;
+        const RealT value = F5[k] + branches[c].inside + ScoreExternalPaired() + BeamScoreBasePair(k+1,j) + ScoreJunctionA(j,k);
+        if (beam_mode == BEAM_VITERBI)
+        {
+            UPDATE_MAX(best_v, best_t, value, k * NUM_BEAM_TRACEBACK_TYPES + BEAM_TB_PAIRED);
+        }
+        else
+        {
+            Fast_LogPlusEquals(best_v, value);
+        }
+    }
+
+    F5[j] = best_v;
+    F5t[j] = best_t;
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::ComputeBeam()
+//
+// Left-to-right sweep for beam-pruned Viterbi or inside scores.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::ComputeBeam(int mode)
+{
+    if (beam_use_evidence)
+        InitializeCacheESS();
+    else
+        InitializeCache();
+
+#if SHOW_TIMINGS
+    double starting_time = GetSystemTime();
+#endif
+
+    // initialization
+
+    beam_mode = mode;
+    std::vector<RealT> &F5 = (mode == BEAM_VITERBI ? F5v : F5i);
+    F5.clear(); F5.resize(L+1, RealT(NEG_INF));
+    F5t.clear(); F5t.resize(L+1, -1);
+
+    for (int type = 0; type < NUM_BEAM_STATE_TYPES; type++)
+    {
+        beam[type].clear();
+        beam[type].resize(L+1);
+    }
+    beam_column.clear();
+    beam_index.clear(); beam_index.resize(L+1, -1);
+    beam_hairpins.clear(); beam_hairpins.resize(L+1);
+    beam_order.clear(); beam_order.resize(mode == BEAM_VITERBI ? L+1 : 0);
+
+    for (int i = 1; i < L; i++)
+        BeamExtendHairpin(i, i + C_MIN_HAIRPIN_LENGTH - 1);
+
+    // sweep
+
+    F5[0] = RealT(0);
+    for (int j = 0; j <= L; j++)
+    {
+        if (j > 0) BeamExternal(j);
+
+        for (int type = 0; type < NUM_BEAM_STATE_TYPES; type++)
+        {
+            BeamColumn(type, j);
+            BeamPrune(type, j);
+        }
+
+        // hairpins that survived pruning are extended to their next
+        // possible closing pair
+
+        const std::vector<BeamState> &hairpins = beam[BEAM_FH][j];
+        for (size_t h = 0; h < hairpins.size(); h++)
+            BeamExtendHairpin(hairpins[h].i, j);
+        std::vector<int>().swap(beam_hairpins[j]);
+    }
+
+#if SHOW_TIMINGS
+    std::cerr << (mode == BEAM_VITERBI ? "Viterbi score: " : "Inside score: ") << F5[L]
+              << " (" << GetSystemTime() - starting_time << " seconds)" << std::endl;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::ComputeViterbiBeam()
+// InferenceEngine::ComputeInsideBeam()
+//
+// Run beam-pruned Viterbi or inside algorithm, keeping beam_width
+// states of each type per position.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::ComputeViterbiBeam(int beam_width, bool use_evidence)
+{
+    Assert(beam_width > 0, "Beam width must be positive.");
+    this->beam_width = beam_width;
+    beam_use_evidence = use_evidence;
+    ComputeBeam(BEAM_VITERBI);
+}
+
+template<class RealT>
+void InferenceEngine<RealT>::ComputeInsideBeam(int beam_width, bool use_evidence)
+{
+    Assert(beam_width > 0, "Beam width must be positive.");
+    this->beam_width = beam_width;
+    beam_use_evidence = use_evidence;
+    ComputeBeam(BEAM_INSIDE);
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::BeamAddPosterior()
+// InferenceEngine::BeamFinishPosterior()
+//
+// Accumulate base-pair probabilities in the outside pass.  The
+// pairs ending at j are listed in order of arrival, and summed,
+// clipped and sorted once no more can arrive (beam_index, unused
+// between columns, locates each i in the list).
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::BeamAddPosterior(int i, int j, RealT probability)
+{
+    sparse_posterior[j].push_back(std::make_pair(i, probability));
+}
+
+template<class RealT>
+void InferenceEngine<RealT>::BeamFinishPosterior(int j)
+{
+    std::vector<std::pair<int,RealT> > &column = sparse_posterior[j];
+
+    size_t kept = 0;
+    for (size_t k = 0; k < column.size(); k++)
+    {
+        int &index = beam_index[column[k].first];
+        if (index < 0)
+        {
+            index = int(kept);
+            column[kept++] = column[k];
+        }
+        else
+        {
+            column[index].second += column[k].second;
+        }
+    }
+    column.resize(kept);
+
+    kept = 0;
+    for (size_t k = 0; k < column.size(); k++)
+    {
+        beam_index[column[k].first] = -1;
+        column[k].second = Clip(column[k].second, RealT(0), RealT(1));
+        if (column[k].second > RealT(0)) column[kept++] = column[k];
+    }
+    column.resize(kept);
+    std::vector<std::pair<int,RealT> >(column).swap(column);
+    std::sort(column.begin(), column.end());
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::ComputePosteriorBeam()
+//
+// Run outside algorithm over the states kept by
+// ComputeInsideBeam(), and compute base-pair posteriors.  Pairs
+// not reached by any kept state have posterior 0, and are not
+// stored with sparse tables.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InferenceEngine<RealT>::ComputePosteriorBeam()
+{
+    Assert(beam_mode == BEAM_INSIDE, "ComputeInsideBeam() must be called first.");
+
+#if SHOW_TIMINGS
+    double starting_time = GetSystemTime();
+#endif
+
+    // initialization
+
+    beam_mode = BEAM_OUTSIDE;
+    F5o.clear(); F5o.resize(L+1, RealT(NEG_INF));
+    F5o[L] = RealT(0);
+    sparse_posterior.clear(); sparse_posterior.resize(L+1);
+
+    for (int type = 0; type < NUM_BEAM_STATE_TYPES; type++)
+        for (int j = 0; j <= L; j++)
+            for (size_t k = 0; k < beam[type][j].size(); k++)
+                beam[type][j][k].outside = RealT(NEG_INF);
+
+    // sweep, right to left; within a column, states are visited in
+    // the reverse of the order in which they were built
+
+    const RealT Z = F5i[L];
+    for (int j = L; j >= 0; j--)
+    {
+        // the outside scores of column j are complete, so the
+        // outermost base-pairs (i,j+1) of its helices can be counted;
+        // those within helices reach column j+1 from columns j+1 and
+        // up, through FE and FC edges, so it is now complete too
+
+        if (j < L)
+        {
+            const std::vector<BeamState> &pairs = beam[BEAM_FC][j];
+            for (size_t k = 0; k < pairs.size(); k++)
+                BeamAddPosterior(pairs[k].i, j+1, Fast_Exp(pairs[k].inside + pairs[k].outside - Z));
+            BeamFinishPosterior(j+1);
+        }
+
+        if (j > 0) BeamExternal(j);
+
+        for (int type = NUM_BEAM_STATE_TYPES - 1; type >= 0; type--)
+        {
+            beam_target = &beam[type][j];
+            for (size_t k = 0; k < beam_target->size(); k++)
+                beam_index[(*beam_target)[k].i] = int(k);
+            BeamColumn(type, j);
+            for (size_t k = 0; k < beam_target->size(); k++)
+                beam_index[(*beam_target)[k].i] = -1;
+        }
+    }
+
+    // without sparse tables, the posteriors are also kept dense
+
+    if (!sparse_tables)
+    {
+        AllocateTable(posterior, SIZE, RealT(0));
+        for (int j = 1; j <= L; j++)
+            for (size_t k = 0; k < sparse_posterior[j].size(); k++)
+                posterior[offset[sparse_posterior[j][k].first]+j] = sparse_posterior[j][k].second;
+    }
+
+    beam_mode = BEAM_INSIDE;
+
+#if SHOW_TIMINGS
+    std::cerr << "Beam outside score: " << F5o[0] << " (" << GetSystemTime() - starting_time << " seconds)" << std::endl;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::FindBeamState()
+//
+// Return the kept state (i,j) of the given type, or NULL.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+const typename InferenceEngine<RealT>::BeamState *InferenceEngine<RealT>::FindBeamState(int type, int i, int j) const
+{
+    const std::vector<BeamState> &column = beam[type][j];
+    BeamState key = { i, -1, RealT(0), RealT(0) };
+    typename std::vector<BeamState>::const_iterator iter = std::lower_bound(column.begin(), column.end(), key);
+    if (iter == column.end() || iter->i != i) return NULL;
+    return &(*iter);
+}
+
+//////////////////////////////////////////////////////////////////////
+// InferenceEngine::PredictPairingsViterbiBeam()
+//
+// Use Viterbi decoding over the states kept by ComputeViterbiBeam()
+// to predict pairings.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+std::vector<int> InferenceEngine<RealT>::PredictPairingsViterbiBeam() const
+{
+    Assert(beam_mode == BEAM_VITERBI, "ComputeViterbiBeam() must be called first.");
+
+    std::vector<int> solution(L+1,SStruct::UNPAIRED);
+    solution[0] = SStruct::UNKNOWN;
+    if (F5v[L] <= RealT(NEG_INF/2)) return solution;
+
+    // type -1 denotes F5
+
+    std::queue<triple<int,int,int> > traceback_queue;
+    traceback_queue.push(make_triple(-1, 0, L));
+
+    while (!traceback_queue.empty())
+    {
+        triple<int,int,int> t = traceback_queue.front();
+        traceback_queue.pop();
+        const int type = t.first;
+        const int i = t.second;
+        const int j = t.third;
+
+        if (type == -1 && j == 0) continue;
+
+        int traceback = F5t[j];
+        if (type != -1)
+        {
+            const BeamState *state = FindBeamState(type, i, j);
+            Assert(state != NULL, "Traceback reached a pruned state.");
+            traceback = state->traceback;
+        }
+        const int value = traceback / NUM_BEAM_TRACEBACK_TYPES;
+
+        switch (traceback % NUM_BEAM_TRACEBACK_TYPES)
+        {
+            case BEAM_TB_HAIRPIN:
+                break;
+            case BEAM_TB_SINGLE:
+            {
+                const int p = i + value / (C_MAX_SINGLE_LENGTH+1);
+                const int q = j - value % (C_MAX_SINGLE_LENGTH+1);
+                solution[p+1] = q;
+                solution[q] = p+1;
+                traceback_queue.push(make_triple(int(BEAM_FC), p+1, q-1));
+            }
+            break;
+            case BEAM_TB_MULTI:
+                traceback_queue.push(make_triple(int(BEAM_FM2), i+value, j));
+                break;
+#if PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR
+            case BEAM_TB_LOOP:
+                traceback_queue.push(make_triple(int(BEAM_FN), i, j));
+                break;
+            case BEAM_TB_STACKING:
+                solution[i+1] = j;
+                solution[j] = i+1;
+                traceback_queue.push(make_triple(int(BEAM_FE), i+1, j-1));
+                break;
+            case BEAM_TB_HELIX:
+            {
+                for (int p = 1; p < value; p++)
+                {
+                    solution[i+p] = j-p+1;
+                    solution[j-p+1] = i+p;
+                }
+                traceback_queue.push(make_triple(int(value < D_MAX_HELIX_LENGTH ? BEAM_FN : BEAM_FE), i+value-1, j-value+1));
+            }
+            break;
+#endif
+            case BEAM_TB_PAIRED:
+            {
+                // base-pair (k+1,j) closing FC[k+1,j-1], after F5[k] or
+                // as the first helix of FM[k,j]
+                const int k = (type == -1 ? value : i);
+                solution[k+1] = j;
+                solution[j] = k+1;
+                traceback_queue.push(make_triple(int(BEAM_FC), k+1, j-1));
+                if (type == -1) traceback_queue.push(make_triple(-1, 0, k));
+            }
+            break;
+            case BEAM_TB_BRANCHES:
+                traceback_queue.push(make_triple(int(BEAM_FB), i, j));
+                break;
+            case BEAM_TB_BIFURCATION:
+                solution[value+1] = j;
+                solution[j] = value+1;
+                traceback_queue.push(make_triple(int(BEAM_FM), i, value));
+                traceback_queue.push(make_triple(int(BEAM_FC), value+1, j-1));
+                break;
+            case BEAM_TB_UNPAIRED:
+                traceback_queue.push(make_triple(type, i, j-1));
+                break;
+            default:
+                Assert(false, "Bad traceback.");
+        }
+    }
+
+    return solution;
 }
 
 template<class RealT>
 void InferenceEngine<RealT>::ComputeInsideESS() 
 {
+    Assert(!sparse_tables, "Exact inference requires the dense tables.");
     InitializeCacheESS();
         
 #if SHOW_TIMINGS
@@ -6536,18 +8388,38 @@ void InferenceEngine<RealT>::ComputeInsideESS()
     // initialization
 
     F5i_ess.clear(); F5i_ess.resize(L+1, RealT(NEG_INF));
-    FCi_ess.clear(); FCi_ess.resize(SIZE, RealT(NEG_INF));
-    FMi_ess.clear(); FMi_ess.resize(SIZE, RealT(NEG_INF));
-    FM1i_ess.clear(); FM1i_ess.resize(SIZE, RealT(NEG_INF));
+    AllocateTable(FCi_ess, SIZE, RealT(NEG_INF));
+    AllocateTable(FMi_ess, SIZE, RealT(NEG_INF));
+    AllocateTable(FM1i_ess, SIZE, RealT(NEG_INF));
     
 #if PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR
-    FEi_ess.clear(); FEi_ess.resize(SIZE, RealT(NEG_INF));
-    FNi_ess.clear(); FNi_ess.resize(SIZE, RealT(NEG_INF));
+    AllocateTable(FEi_ess, SIZE, RealT(NEG_INF));
+    AllocateTable(FNi_ess, SIZE, RealT(NEG_INF));
 #endif
 
-    for (int i = L; i >= 0; i--)
+#if BLOCKED_MULTI_SPLITS
+    ResetMultiSplitBlocks();
+#endif
+    
+#if BLOCKED_MULTI_SPLITS
+    const int block = MULTI_SPLIT_BLOCK;
+#else
+    const int block = 1;
+#endif
+    
+    // Fill a block of rows at a time, column by column, so that the
+    // multiloop splits of each tile can be summed together (see
+    // SumMultiSplitsBlocked()).  With block = 1, this is the usual
+    // row by row order.
+    
+    for (int i0 = L - L % block; i0 >= 0; i0 -= block)
     {
-        for (int j = i; j <= L; j++)
+#if FAST_HELIX_LENGTHS && (PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR)
+        ExtendHelixSums(i0, i0+block+D_MAX_HELIX_LENGTH-2);
+#endif
+        
+        for (int j = i0; j <= std::min(L, i0+block-1+MaxEntrySpan()); j++)
+        for (int i = std::min(j, i0 + block - 1); i >= std::max(i0, j - MaxEntrySpan()); i--)
         {
             
             // FM2[i,j] = SUM (i<k<j : FM1[i,k] + FM[k,j])
@@ -6559,6 +8431,10 @@ void InferenceEngine<RealT>::ComputeInsideESS()
             for (int k = i+1; k < j; k++)
                 Fast_LogPlusEquals(FM2i_ess, FM1i_ess[offset[i]+k] + FMi_ess[offset[k]+j]);
             
+#elif BLOCKED_MULTI_SPLITS
+            
+            FM2i_ess = SumMultiSplitsBlocked(FM1i_ess, FMi_ess, i, j);
+            
 #else
             
             if (i+2 <= j)
@@ -6819,6 +8695,7 @@ void InferenceEngine<RealT>::ComputeInsideESS()
                     Fast_LogPlusEquals(sum_i, FM1i_ess[offset[i+1]+j] + ScoreMultiUnpairedEvidence(i+1));
                 
                 FM1i_ess[offset[i]+j] = sum_i;
+                
             }
             
             // FM[i,j] = optimal energy for substructure belonging to a
@@ -6903,13 +8780,13 @@ void InferenceEngine<RealT>::ComputeOutsideESS()
     // initialization
     
     F5o_ess.clear(); F5o_ess.resize(L+1, RealT(NEG_INF));
-    FCo_ess.clear(); FCo_ess.resize(SIZE, RealT(NEG_INF));
-    FMo_ess.clear(); FMo_ess.resize(SIZE, RealT(NEG_INF));
-    FM1o_ess.clear(); FM1o_ess.resize(SIZE, RealT(NEG_INF));
+    AllocateTable(FCo_ess, SIZE, RealT(NEG_INF));
+    AllocateTable(FMo_ess, SIZE, RealT(NEG_INF));
+    AllocateTable(FM1o_ess, SIZE, RealT(NEG_INF));
     
 #if PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR
-    FEo_ess.clear(); FEo_ess.resize(SIZE, RealT(NEG_INF));
-    FNo_ess.clear(); FNo_ess.resize(SIZE, RealT(NEG_INF));
+    AllocateTable(FEo_ess, SIZE, RealT(NEG_INF));
+    AllocateTable(FNo_ess, SIZE, RealT(NEG_INF));
 #endif
     
     F5o_ess[L] = RealT(0);  
@@ -6942,9 +8819,21 @@ void InferenceEngine<RealT>::ComputeOutsideESS()
         }
     }
     
+#if SPARSE_PARTITION_FUNCTION
+    std::vector<int> candidates;
+    candidates.reserve(L+1);
+#endif
+    
     for (int i = 0; i <= L; i++)
     {
-        for (int j = L; j >= i; j--)
+#if FAST_HELIX_LENGTHS && (PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR)
+        ExtendHelixSums(i, i+D_MAX_HELIX_LENGTH-1);
+#endif
+#if SPARSE_PARTITION_FUNCTION
+        FillMultiSplitCandidates(candidates, FM1i_ess, i);
+#endif
+        
+        for (int j = std::min(L, i+MaxEntrySpan()); j >= i; j--)
         {
             RealT FM2o_ess = RealT(NEG_INF);
             
@@ -7205,6 +9094,18 @@ void InferenceEngine<RealT>::ComputeOutsideESS()
             }
 
 #else
+#if SPARSE_PARTITION_FUNCTION
+            if (2*candidates.size() < size_t(std::max(j-i-1,0)))
+            {
+                for (size_t kp = 0; kp < candidates.size() && candidates[kp] < j; kp++)
+                {
+                    const int k = candidates[kp];
+                    Fast_LogPlusEquals(FM1o_ess[offset[i]+k], FM2o_ess + FMi_ess[offset[k]+j]);
+                    Fast_LogPlusEquals(FMo_ess[offset[k]+j], FM2o_ess + FM1i_ess[offset[i]+k]);
+                }
+            }
+            else
+#endif
             if (i+2 <= j)
             {
                 RealT *p1i = &(FM1i_ess[offset[i]+i+1]);
@@ -7266,8 +9167,16 @@ std::vector<RealT> InferenceEngine<RealT>::ComputeESS()
 
     ClearCounts();
     
+#if BLOCKED_MULTI_SPLITS
+    ResetMultiSplitBlocks();
+#endif
+    
     for (int i = L; i >= 0; i--)
     {
+#if FAST_HELIX_LENGTHS && (PARAMS_HELIX_LENGTH || PARAMS_ISOLATED_BASE_PAIR)
+        ExtendHelixSums(i, i+D_MAX_HELIX_LENGTH-1);
+#endif
+        
         for (int j = i; j <= L; j++)
         {
 
@@ -7280,6 +9189,10 @@ std::vector<RealT> InferenceEngine<RealT>::ComputeESS()
             for (int k = i+1; k < j; k++)
                 Fast_LogPlusEquals(FM2i_ess, FM1i_ess[offset[i]+k] + FMi_ess[offset[k]+j]);
             
+#elif BLOCKED_MULTI_SPLITS
+            
+            FM2i_ess = SumMultiSplitsBlocked(FM1i_ess, FMi_ess, i, j);
+            
 #else
             
             if (i+2 <= j)
@@ -28,13 +28,13 @@ class InnerOptimizationWrapperBundleMethod : public BundleMethod<RealT>, public
 {
 public:
     InnerOptimizationWrapperBundleMethod(OptimizationWrapper<RealT> *optimization_wrapper,
-                                               const std::vector<int> &units,
-                                               const std::vector<RealT> &C);
+                                         const std::vector<int> &units,
+                                         const std::vector<RealT> &C);
     
     RealT ComputeFunction(const std::vector<RealT> &x);
     void ComputeSubgradient(std::vector<RealT> &g, const std::vector<RealT> &x);
     void Report(int iteration, const std::vector<RealT> &x, RealT f, const std::vector<RealT> &g,
-                RealT norm_bound, RealT step_size);
+                RealT lower_bound, int bundle_size);
     void Report(const std::string &s);
     RealT Minimize(std::vector<RealT> &x0);
 };
@@ -14,35 +14,34 @@ template<class RealT>
 InnerOptimizationWrapperBundleMethod<RealT>::InnerOptimizationWrapperBundleMethod(OptimizationWrapper<RealT> *optimization_wrapper,
                                                                                             const std::vector<int> &units,
                                                                                             const std::vector<RealT> &C) :
-    BundleMethod<double>(1000,C[1]),
+    BundleMethod<RealT>(C, 1000, BUNDLE_MAX_SIZE),
     InnerOptimizationWrapper<RealT>(optimization_wrapper, units, C)
-{
-}
+{}
 
 //////////////////////////////////////////////////////////////////////
 // InnerOptimizationWrapperBundleMethod::ComputeFunction()
 //
-// Compute the regularized logloss using a particular
-// parameter set and fixed regularization hyperparameters.
+// Compute the unregularized loss (plus linear bias) using a
+// particular parameter set; the bundle method adds the regularizer.
 //////////////////////////////////////////////////////////////////////
 
 template<class RealT>
 RealT InnerOptimizationWrapperBundleMethod<RealT>::ComputeFunction(const std::vector<RealT> &w)
 {
-  return this->optimization_wrapper->GetComputationWrapper().ComputeFunction(this->units, w, true, true, this->optimization_wrapper->GetOptions().GetRealValue("log_base"));
+    return this->optimization_wrapper->GetComputationWrapper().ComputeFunction(this->units, w, true, true, this->optimization_wrapper->GetOptions().GetRealValue("log_base"), this->optimization_wrapper->GetOptions().GetRealValue("hyperparam_data")) + DotProduct(w, this->bias);
 }
 
 //////////////////////////////////////////////////////////////////////
 // InnerOptimizationWrapperBundleMethod::ComputeSubgradient()
 //
-// Compute the regularized logloss gradient using a particular
-// parameter set and fixed regularization hyperparameters.
+// Compute a subgradient of the unregularized loss (plus linear
+// bias) using a particular parameter set.
 //////////////////////////////////////////////////////////////////////
 
 template<class RealT>
 void InnerOptimizationWrapperBundleMethod<RealT>::ComputeSubgradient(std::vector<RealT> &g, const std::vector<RealT> &w)
 {
-  g = this->optimization_wrapper->GetComputationWrapper().ComputeGradient(this->units, w, true, true, this->optimization_wrapper->GetOptions().GetRealValue("log_base"));
+    g = this->optimization_wrapper->GetComputationWrapper().ComputeGradient(this->units, w, true, true, this->optimization_wrapper->GetOptions().GetRealValue("log_base"), this->optimization_wrapper->GetOptions().GetRealValue("hyperparam_data")) + this->bias;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -52,15 +51,15 @@ void InnerOptimizationWrapperBundleMethod<RealT>::ComputeSubgradient(std::vector
 //////////////////////////////////////////////////////////////////////
 
 template<class RealT>
-void InnerOptimizationWrapperBundleMethod<RealT>::Report(int iteration, const std::vector<RealT> &w, RealT f, const std::vector<RealT> &g, RealT norm_bound, RealT step_size)
+void InnerOptimizationWrapperBundleMethod<RealT>::Report(int iteration, const std::vector<RealT> &w, RealT f, const std::vector<RealT> &g, RealT lower_bound, int bundle_size)
 {
     // write results to disk
     this->optimization_wrapper->GetParameterManager().WriteToFile(SPrintF("optimize.params.iter%d", iteration), w);
     
     // write results to console
-    this->optimization_wrapper->PrintMessage(SPrintF("Inner iteration %d: f = %lf (%lf), |w| = %lf, |g| = %lf, norm bound = %lf, step = %lf, efficiency = %lf%%", 
+    this->optimization_wrapper->PrintMessage(SPrintF("Inner iteration %d: f = %lf (%lf), |w| = %lf, |g| = %lf, lower bound = %lf, bundle size = %d, efficiency = %lf%%", 
                                                      iteration, double(f), double(f - RealT(0.5) * DotProduct(this->C, w*w)),
-                                                     double(Norm(w)), double(step_size), double(Norm(g)), double(norm_bound),
+                                                     double(Norm(w)), double(Norm(g)), double(lower_bound), bundle_size,
                                                      double(this->optimization_wrapper->GetComputationEngine().GetEfficiency())));
 }
 
@@ -73,7 +72,7 @@ void InnerOptimizationWrapperBundleMethod<RealT>::Report(const std::string &s)
 //////////////////////////////////////////////////////////////////////
 // InnerOptimizationWrapperBundleMethod::Minimize()
 //
-// Perform subgradient optimization.
+// Perform bundle method optimization.
 //////////////////////////////////////////////////////////////////////
 
 template<class RealT>
@@ -28,17 +28,36 @@ class InnerOptimizationWrapperLBFGS : public LBFGS<RealT>, public InnerOptimizat
 {
     RealT log_base;
     RealT hyperparam_data;
+
+    // early stopping on holdout units (see LoadHoldout)
+    std::vector<int> holdout;
+    int holdout_interval;
+    int holdout_patience;
+    int num_gradients;
+    int evaluations_since_best;
+    int best_iteration;
+    RealT best_holdout_function;
+    RealT best_f;
+    std::vector<RealT> best_w;
+
+    void RecordHoldoutFunction(int iteration, const std::vector<RealT> &w, RealT f, RealT holdout_function);
     
 public:
     InnerOptimizationWrapperLBFGS(OptimizationWrapper<RealT> *optimization_wrapper,
                                   const std::vector<int> &units,
                                   const std::vector<RealT> &weights_initial,
                                   const std::vector<RealT> &C);
+    ~InnerOptimizationWrapperLBFGS();
     
+    void LoadHoldout(const std::vector<int> &holdout);
+
     RealT ComputeFunction(const std::vector<RealT> &x);
     void ComputeGradient(std::vector<RealT> &g, const std::vector<RealT> &x);
+    int GetLineSearchWidth();
+    void ComputeFunctions(std::vector<RealT> &f, const std::vector<RealT> &x, const std::vector<RealT> &d, const std::vector<RealT> &steps);
     void Report(int iteration, const std::vector<RealT> &x, RealT f, RealT step_size);
     void Report(const std::string &s);
+    bool StopEarly();
     RealT Minimize(std::vector<RealT> &x0);
 };
 
@@ -19,9 +19,42 @@ InnerOptimizationWrapperLBFGS<RealT>::InnerOptimizationWrapperLBFGS(Optimization
     LBFGS<RealT>(20, 1e-5, optimization_wrapper->GetOptions().GetIntValue("train_max_iter"),1e-6),
     InnerOptimizationWrapper<RealT>(optimization_wrapper, units, weights_initial, C),
     log_base(optimization_wrapper->GetOptions().GetRealValue("log_base")),
-    hyperparam_data(optimization_wrapper->GetOptions().GetRealValue("hyperparam_data"))
+    hyperparam_data(optimization_wrapper->GetOptions().GetRealValue("hyperparam_data")),
+    holdout_interval(optimization_wrapper->GetOptions().GetIntValue("early_stop_interval")),
+    holdout_patience(optimization_wrapper->GetOptions().GetIntValue("early_stop_patience")),
+    num_gradients(0),
+    evaluations_since_best(0),
+    best_iteration(0),
+    best_holdout_function(0),
+    best_f(0)
 {}
 
+//////////////////////////////////////////////////////////////////////
+// InnerOptimizationWrapperLBFGS::~InnerOptimizationWrapperLBFGS()
+//
+// Destructor.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+InnerOptimizationWrapperLBFGS<RealT>::~InnerOptimizationWrapperLBFGS()
+{}
+
+//////////////////////////////////////////////////////////////////////
+// InnerOptimizationWrapperLBFGS::LoadHoldout()
+//
+// Monitor the (unregularized) function value over a set of holdout
+// units every holdout_interval iterations.  Optimization stops once
+// holdout_patience consecutive evaluations fail to improve on the
+// best value, and the iterate with the best value is returned.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InnerOptimizationWrapperLBFGS<RealT>::LoadHoldout(const std::vector<int> &holdout)
+{
+    Assert(holdout.size() == 0 || holdout_interval > 0, "Holdout monitoring requires a positive interval.");
+    this->holdout = holdout;
+}
+
 //////////////////////////////////////////////////////////////////////
 // InnerOptimizationWrapperLBFGS::ComputeFunction()
 //
@@ -45,9 +78,79 @@ RealT InnerOptimizationWrapperLBFGS<RealT>::ComputeFunction(const std::vector<Re
 template<class RealT>
 void InnerOptimizationWrapperLBFGS<RealT>::ComputeGradient(std::vector<RealT> &g, const std::vector<RealT> &w)
 {
+    // the gradient is computed once per iterate, starting with x0
+    const int iteration = num_gradients++;
+    if (holdout.size() > 0 && iteration % holdout_interval == 0)
+    {
+        RealT f, holdout_function;
+        g = this->optimization_wrapper->GetComputationWrapper().ComputeGradientWithHoldoutSE(this->units, holdout, w, true, log_base, hyperparam_data, f, holdout_function) + this->C * (w - this->weights_initial) + this->bias;
+        f += RealT(0.5) * DotProduct(this->C, (w - this->weights_initial)*(w - this->weights_initial)) + DotProduct(w, this->bias);
+        RecordHoldoutFunction(iteration, w, f, holdout_function);
+        return;
+    }
+
     g = this->optimization_wrapper->GetComputationWrapper().ComputeGradient(this->units, w, false, true, log_base, hyperparam_data) + this->C * (w - this->weights_initial) + this->bias;
 }
 
+//////////////////////////////////////////////////////////////////////
+// InnerOptimizationWrapperLBFGS::RecordHoldoutFunction()
+// InnerOptimizationWrapperLBFGS::StopEarly()
+//
+// Keep track of the iterate with the best holdout function value.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InnerOptimizationWrapperLBFGS<RealT>::RecordHoldoutFunction(int iteration, const std::vector<RealT> &w, RealT f, RealT holdout_function)
+{
+    if (best_w.size() == 0 || holdout_function < best_holdout_function)
+    {
+        best_iteration = iteration;
+        best_holdout_function = holdout_function;
+        best_f = f;
+        best_w = w;
+        evaluations_since_best = 0;
+    }
+    else
+    {
+        evaluations_since_best++;
+    }
+
+    this->optimization_wrapper->PrintMessage(SPrintF("Holdout function at iteration %d: %lf (best %lf at iteration %d)",
+                                                     iteration, double(holdout_function),
+                                                     double(best_holdout_function), best_iteration));
+}
+
+template<class RealT>
+bool InnerOptimizationWrapperLBFGS<RealT>::StopEarly()
+{
+    return holdout.size() > 0 && evaluations_since_best >= holdout_patience;
+}
+
+//////////////////////////////////////////////////////////////////////
+// InnerOptimizationWrapperLBFGS::GetLineSearchWidth()
+// InnerOptimizationWrapperLBFGS::ComputeFunctions()
+//
+// Evaluate several line search step lengths in a single pass when
+// there are idle compute nodes.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+int InnerOptimizationWrapperLBFGS<RealT>::GetLineSearchWidth()
+{
+    return this->optimization_wrapper->GetComputationWrapper().GetLineSearchWidth(this->units);
+}
+
+template<class RealT>
+void InnerOptimizationWrapperLBFGS<RealT>::ComputeFunctions(std::vector<RealT> &f, const std::vector<RealT> &x, const std::vector<RealT> &d, const std::vector<RealT> &steps)
+{
+    f = this->optimization_wrapper->GetComputationWrapper().ComputeFunctionAlongDirection(this->units, x, d, steps, false, true, log_base, hyperparam_data);
+    for (size_t i = 0; i < steps.size(); i++)
+    {
+        const std::vector<RealT> w = x + steps[i] * d;
+        f[i] += RealT(0.5) * DotProduct(this->C, (w - this->weights_initial)*(w - this->weights_initial)) + DotProduct(w, this->bias);
+    }
+}
+
 //////////////////////////////////////////////////////////////////////
 // InnerOptimizationWrapperLBFGS::Report()
 //
@@ -83,5 +186,17 @@ void InnerOptimizationWrapperLBFGS<RealT>::Report(const std::string &s)
 template<class RealT>
 RealT InnerOptimizationWrapperLBFGS<RealT>::Minimize(std::vector<RealT> &x0)
 {
-    return LBFGS<RealT>::Minimize(x0);        
+    num_gradients = 0;
+    evaluations_since_best = 0;
+    best_w.clear();
+
+    RealT f = LBFGS<RealT>::Minimize(x0);
+
+    if (best_w.size() > 0)
+    {
+        Report(SPrintF("Using iterate %d with best holdout function %lf", best_iteration, double(best_holdout_function)));
+        x0 = best_w;
+        f = best_f;
+    }
+    return f;
 }
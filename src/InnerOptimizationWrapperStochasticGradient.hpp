@@ -7,6 +7,8 @@
 #ifndef INNEROPTIMIZATIONWRAPPERSTOCHASTICGRADIENT_HPP
 #define INNEROPTIMIZATIONWRAPPERSTOCHASTICGRADIENT_HPP
 
+#include <string>
+#include <utility>
 #include "OptimizationWrapper.hpp"
 
 template<class RealT>
@@ -34,10 +36,24 @@ class InnerOptimizationWrapperStochasticGradient : public InnerOptimizationWrapp
 
     RealT hyperparam_data;
 
+    // variance reduction ("sgd", "saga" or "svrg"); for the latter two,
+    // one gradient per example is kept (sparsely), along with their sum
+    std::string method;
+    std::vector<std::vector<std::pair<int,RealT> > > example_gradients;
+    std::vector<RealT> example_gradient_sum;
+    std::vector<int> order;
+    int next_in_order;
+
+    std::vector<int> SampleBatch(int batch_size);
+    void ComputeExampleGradients(std::vector<std::vector<std::pair<int,RealT> > > &gradients, const std::vector<int> &positions, const std::vector<RealT> &w);
+    void StoreExampleGradients(const std::vector<RealT> &w);
+    void ComputeVarianceReducedGradient(std::vector<RealT> &g, const std::vector<RealT> &w, const int batch_size);
+
 public:
     InnerOptimizationWrapperStochasticGradient(OptimizationWrapper<RealT> *optimization_wrapper,
                                                const std::vector<int> &units,
                                                const std::vector<RealT> &C);
+    ~InnerOptimizationWrapperStochasticGradient();
 
     RealT ComputeFunction(const std::vector<RealT> &x);
     void ComputeGradient(std::vector<RealT> &g, const std::vector<RealT> &x, const int batch_size);
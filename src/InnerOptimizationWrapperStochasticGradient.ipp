@@ -20,11 +20,26 @@ InnerOptimizationWrapperStochasticGradient<RealT>::InnerOptimizationWrapperStoch
     MAX_ITERATIONS(optimization_wrapper->GetOptions().GetIntValue("train_max_iter")),
     s0(optimization_wrapper->GetOptions().GetRealValue("s0")),
     s1(optimization_wrapper->GetOptions().GetRealValue("s1")),
-    hyperparam_data(optimization_wrapper->GetOptions().GetRealValue("hyperparam_data"))
+    hyperparam_data(optimization_wrapper->GetOptions().GetRealValue("hyperparam_data")),
+    method(optimization_wrapper->GetOptions().GetStringValue("sgd_method")),
+    order(units.size()),
+    next_in_order(int(units.size()))
 {
     std::srand(GetSystemTime());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = int(i);
 }
 
+//////////////////////////////////////////////////////////////////////
+// InnerOptimizationWrapperStochasticGradient::~InnerOptimizationWrapperStochasticGradient()
+//
+// Destructor.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+InnerOptimizationWrapperStochasticGradient<RealT>::~InnerOptimizationWrapperStochasticGradient()
+{}
+
 //////////////////////////////////////////////////////////////////////
 // InnerOptimizationWrapperStochasticGradient::ComputeFunction()
 //
@@ -62,6 +77,129 @@ void InnerOptimizationWrapperStochasticGradient<RealT>::ComputeGradient(std::vec
     g = this->optimization_wrapper->GetComputationWrapper().ComputeGradientSE(units, w, false, true, log_base, hyperparam_data) + this->C * w + this->bias;
 }
 
+//////////////////////////////////////////////////////////////////////
+// InnerOptimizationWrapperStochasticGradient::SampleBatch()
+//
+// Draw the next mini-batch of examples (as positions in units)
+// without replacement.  Examples are visited in a random order that
+// is reshuffled at the start of each pass over the data.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+std::vector<int> InnerOptimizationWrapperStochasticGradient<RealT>::SampleBatch(int batch_size)
+{
+    const int num_examples = int(order.size());
+    if (next_in_order >= num_examples)
+    {
+        for (int i = num_examples - 1; i > 0; i--)
+            std::swap(order[i], order[RandInt(i+1)]);
+        next_in_order = 0;
+    }
+
+    if (batch_size == 0 || batch_size > num_examples - next_in_order)
+        batch_size = num_examples - next_in_order;
+    std::vector<int> positions(order.begin() + next_in_order, order.begin() + next_in_order + batch_size);
+    next_in_order += batch_size;
+    return positions;
+}
+
+//////////////////////////////////////////////////////////////////////
+// InnerOptimizationWrapperStochasticGradient::ComputeExampleGradients()
+//
+// Compute the gradient of each of the given examples, dropping
+// zero entries.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InnerOptimizationWrapperStochasticGradient<RealT>::ComputeExampleGradients(std::vector<std::vector<std::pair<int,RealT> > > &gradients,
+                                                                                const std::vector<int> &positions,
+                                                                                const std::vector<RealT> &w)
+{
+    std::vector<int> units(positions.size());
+    for (size_t k = 0; k < positions.size(); k++)
+        units[k] = this->units[positions[k]];
+
+    std::map<int, std::vector<RealT> > dense = this->optimization_wrapper->GetComputationWrapper().ComputeExampleGradientsSE(units, w, true, log_base, hyperparam_data);
+
+    gradients.clear();
+    gradients.resize(positions.size());
+    for (size_t k = 0; k < positions.size(); k++)
+    {
+        const std::vector<RealT> &gradient = dense[units[k]];
+        for (size_t i = 0; i < gradient.size(); i++)
+            if (gradient[i] != RealT(0)) gradients[k].push_back(std::make_pair(int(i), gradient[i]));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// InnerOptimizationWrapperStochasticGradient::StoreExampleGradients()
+//
+// Replace the stored gradient of every example with its gradient
+// at w, and recompute their sum.  This costs one full pass over the
+// data.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InnerOptimizationWrapperStochasticGradient<RealT>::StoreExampleGradients(const std::vector<RealT> &w)
+{
+    std::vector<int> positions(this->units.size());
+    for (size_t k = 0; k < positions.size(); k++)
+        positions[k] = int(k);
+    ComputeExampleGradients(example_gradients, positions, w);
+
+    example_gradient_sum.assign(w.size(), RealT(0));
+    for (size_t k = 0; k < example_gradients.size(); k++)
+        for (size_t p = 0; p < example_gradients[k].size(); p++)
+            example_gradient_sum[example_gradients[k][p].first] += example_gradients[k][p].second;
+}
+
+//////////////////////////////////////////////////////////////////////
+// InnerOptimizationWrapperStochasticGradient::ComputeVarianceReducedGradient()
+//
+// Compute an unbiased estimate of the regularized gradient from a
+// mini-batch B of n examples, corrected by the stored gradients:
+//
+//     g = (n/|B|) * sum_{i in B} (grad_i(w) - stored_i) + sum_i stored_i + C*w
+//
+// With SAGA, the stored gradients of the batch are then replaced by
+// the fresh ones.  With SVRG, all stored gradients are recomputed at
+// the current point at the start of each pass over the data.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+void InnerOptimizationWrapperStochasticGradient<RealT>::ComputeVarianceReducedGradient(std::vector<RealT> &g, const std::vector<RealT> &w, const int batch_size)
+{
+    const int num_examples = int(order.size());
+    if (example_gradients.size() == 0 || (method == "svrg" && next_in_order >= num_examples))
+        StoreExampleGradients(w);
+
+    const std::vector<int> positions = SampleBatch(batch_size);
+    std::vector<std::vector<std::pair<int,RealT> > > fresh;
+    ComputeExampleGradients(fresh, positions, w);
+
+    g = example_gradient_sum;
+    const RealT scale = RealT(num_examples) / RealT(positions.size());
+    for (size_t k = 0; k < positions.size(); k++)
+    {
+        std::vector<std::pair<int,RealT> > &stored = example_gradients[positions[k]];
+        for (size_t p = 0; p < fresh[k].size(); p++)
+            g[fresh[k][p].first] += scale * fresh[k][p].second;
+        for (size_t p = 0; p < stored.size(); p++)
+            g[stored[p].first] -= scale * stored[p].second;
+
+        if (method == "saga")
+        {
+            for (size_t p = 0; p < fresh[k].size(); p++)
+                example_gradient_sum[fresh[k][p].first] += fresh[k][p].second;
+            for (size_t p = 0; p < stored.size(); p++)
+                example_gradient_sum[stored[p].first] -= stored[p].second;
+            stored.swap(fresh[k]);
+        }
+    }
+
+    g += this->C * w + this->bias;
+}
+
 //////////////////////////////////////////////////////////////////////
 // InnerOptimizationWrapperStochasticGradient::GetLogicalIndex()
 //
@@ -134,7 +272,10 @@ RealT InnerOptimizationWrapperStochasticGradient<RealT>::Minimize(std::vector<Re
     int next_report_iter = 1;
 
     for (int iter = 1; iter <= MAX_ITERATIONS; iter++) {
-        ComputeGradient(g, x0, batch_size);
+        if (method == "sgd")
+            ComputeGradient(g, x0, batch_size);
+        else
+            ComputeVarianceReducedGradient(g, x0, batch_size);
 
         RealT stepsize = s0 / pow(1.0 + iter, s1);
         x0 -= stepsize*g;
@@ -47,6 +47,9 @@ public:
     virtual void ComputeGradient(std::vector<double> &g, const std::vector<double> &x) = 0;
     virtual void Report(int iteration, const std::vector<double> &x, double f, double step_size) = 0;
     virtual void Report(const std::string &s) = 0;
+
+    // checked after each iteration; return true to stop before convergence
+    virtual bool StopEarly() { return false; }
 };
 
 #include "LBFGS.ipp"
@@ -120,6 +120,12 @@ Real LBFGS<Real>::Minimize(std::vector<Real> &x0)
             Report("Termination condition: maximum number of iterations reached");
             break; 
         }
+
+        if (StopEarly())
+        {
+            Report("Termination condition: early stopping");
+            break;
+        }
         
         // check gradient termination condition
         
@@ -0,0 +1,17 @@
+/////////////////////////////////////////////////////////////////
+// LibContrafold.cpp
+//
+// Instantiations for libcontrafold.  Programs linking against the
+// library include FoldingContext.hpp and use FoldingModel<float>
+// or FoldingModel<double> (and the matching FoldingContext).
+/////////////////////////////////////////////////////////////////
+
+#include "FoldingContext.hpp"
+
+// default parameters
+#include "Defaults.ipp"
+
+template class FoldingModel<float>;
+template class FoldingContext<float>;
+template class FoldingModel<double>;
+template class FoldingContext<double>;
@@ -23,6 +23,11 @@
 //
 // As a side effect, this function also updates the value of
 // the function f(x) to its new value f(x + t*d).
+//
+// Subclasses that can evaluate several step lengths at once for
+// about the cost of one may override GetLineSearchWidth() and
+// ComputeFunctions(); the search then tries a batch of decreasing
+// step lengths in each round instead of one at a time.
 //////////////////////////////////////////////////////////////////////
 
 template<class Real>
@@ -34,6 +39,20 @@ class LineSearch
     const int MAX_EVALUATIONS;
     const Real GAMMA1;
     const Real GAMMA2;    
+
+    Real DoSpeculativeLineSearch
+    (
+        const std::vector<Real> &x,
+        const Real f,
+        const std::vector<Real> &g,
+        const std::vector<Real> &d,
+        std::vector<Real> &new_x,
+        Real &new_f,
+        std::vector<Real> &new_g,
+        const Real T_MIN,
+        const Real T_MAX,
+        const int width
+    );
     
 public:
     LineSearch
@@ -65,6 +84,10 @@ public:
     
     virtual double ComputeFunction(const std::vector<double> &x) = 0;
     virtual void ComputeGradient(std::vector<double> &g, const std::vector<double> &x) = 0;
+
+    // batched evaluation of f(x + t*d) for each t in steps
+    virtual int GetLineSearchWidth() { return 1; }
+    virtual void ComputeFunctions(std::vector<double> &f, const std::vector<double> &x, const std::vector<double> &d, const std::vector<double> &steps);
 };
 
 #include "LineSearch.ipp"
@@ -6,6 +6,9 @@
 // interpolation.
 //////////////////////////////////////////////////////////////////////
 
+// ratio between successive step lengths in a speculative batch
+const double SPECULATIVE_STEP_RATIO = 0.5;
+
 template<class Real>
 LineSearch<Real>::LineSearch
 (
@@ -71,6 +74,10 @@ Real LineSearch<Real>::DoLineSearch
 )
 {
     Assert(T_MIN <= T_MAX, "Line search called with T_MIN > T_MAX.");
+
+    const int width = std::min(GetLineSearchWidth(), MAX_EVALUATIONS);
+    if (width > 1) return DoSpeculativeLineSearch(x, f, g, d, new_x, new_f, new_g, T_MIN, T_MAX, width);
+
     const Real dot_prod = DotProduct(d, g);
     bool sufficient_decrease = false;
 
@@ -166,3 +173,76 @@ Real LineSearch<Real>::DoLineSearch
     ComputeGradient(new_g, new_x);
     return t_best;    
 }
+
+//////////////////////////////////////////////////////////////////////
+// DoSpeculativeLineSearch()
+//
+// Backtracking line search which evaluates a batch of step lengths,
+// t, t*r, t*r^2, ..., per round, starting from the initial step
+// size.  The search stops after the first round in which some step
+// length gives sufficient decrease, and returns the step length with
+// the lowest function value seen.
+//////////////////////////////////////////////////////////////////////
+
+template<class Real>
+Real LineSearch<Real>::DoSpeculativeLineSearch
+(
+    const std::vector<Real> &x,                        // initial parameters
+    const Real f,                                      // initial function value
+    const std::vector<Real> &g,                        // initial gradient vector
+    const std::vector<Real> &d,                        // initial direction vector
+    
+    std::vector<Real> &new_x,                          // new parameters
+    Real &new_f,                                       // new function value
+    std::vector<Real> &new_g,                          // new gradient vector
+    
+    const Real T_MIN,                                  // minimum step size
+    const Real T_MAX,                                  // maximum step size
+    const int width                                    // number of step sizes per round
+)
+{
+    const Real dot_prod = DotProduct(d, g);
+    bool sufficient_decrease = false;
+
+    Real t_best = Real(0), f_best = f;
+    Real t_first = std::min(T_MAX, std::max(T_MIN, T_INIT));
+
+    for (int evaluations = 0; evaluations < MAX_EVALUATIONS && !sufficient_decrease; evaluations += width)
+    {
+        // choose step lengths for this round
+
+        std::vector<Real> steps;
+        for (Real t = t_first; int(steps.size()) < width && t >= T_MIN; t *= Real(SPECULATIVE_STEP_RATIO))
+            steps.push_back(t);
+        if (steps.empty()) break;
+
+        // evaluate all of them at once
+
+        std::vector<Real> values;
+        ComputeFunctions(values, x, d, steps);
+        for (size_t i = 0; i < steps.size(); i++)
+            UpdateQuoc(steps[i], values[i]);
+
+        t_first = steps.back() * Real(SPECULATIVE_STEP_RATIO);
+    }
+
+    new_f = f_best;
+    new_x = x + t_best * d;
+    ComputeGradient(new_g, new_x);
+    return t_best;
+}
+
+//////////////////////////////////////////////////////////////////////
+// ComputeFunctions()
+//
+// Evaluate f(x + t*d) for each t in steps.  By default, this makes
+// one call to ComputeFunction() per step length.
+//////////////////////////////////////////////////////////////////////
+
+template<class Real>
+void LineSearch<Real>::ComputeFunctions(std::vector<double> &f, const std::vector<double> &x, const std::vector<double> &d, const std::vector<double> &steps)
+{
+    f.resize(steps.size());
+    for (size_t i = 0; i < steps.size(); i++)
+        f[i] = ComputeFunction(x + steps[i] * d);
+}
@@ -18,6 +18,28 @@
 #include "InnerOptimizationWrapperBundleMethod.hpp"
 #endif
 #include "OuterOptimizationWrapper.hpp"
+#include "ExampleStatistics.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// struct TrainingCache
+//
+// Inputs and result of the most recent call to one of the training
+// routines, used to avoid repeating work.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+struct TrainingCache
+{
+    std::vector<int> units;
+    std::vector<int> holdout;
+    std::vector<RealT> initial_w;
+    std::vector<RealT> C;
+    std::vector<RealT> learned_w;
+    RealT f;
+
+    TrainingCache() : f(0) {}
+    ~TrainingCache();
+};
 
 //////////////////////////////////////////////////////////////////////
 // class OptimizationWrapper
@@ -31,13 +53,20 @@ class OptimizationWrapper
     ComputationWrapper<RealT> &computation_wrapper;
     std::ofstream logfile;
     int indent;
+
+    TrainingCache<RealT> train_cache;
+    TrainingCache<RealT> train_sgd_cache;
+    TrainingCache<RealT> train_em_cache;
     
 public:
     
     OptimizationWrapper(ComputationWrapper<RealT> &computation_wrapper);
     ~OptimizationWrapper();
     
-    RealT Train(const std::vector<int> &units, std::vector<RealT> &w, std::vector<RealT> &w0, const std::vector<RealT> &C);
+    RealT Train(const std::vector<int> &units, std::vector<RealT> &w, std::vector<RealT> &w0, const std::vector<RealT> &C,
+                const std::vector<int> &holdout = std::vector<int>());
+    RealT TrainWithEarlyStopping(const std::vector<int> &units, std::vector<RealT> &w, std::vector<RealT> &w0, const std::vector<RealT> &C);
+    RealT TrainIncremental(const std::vector<int> &units, std::vector<RealT> &w, std::vector<RealT> &w0, const std::vector<RealT> &C, const std::string &statistics_filename);
     RealT TrainEM(const std::vector<int> &units, std::vector<RealT> &w, const std::vector<RealT> &C, const int train_max_iter);
     RealT TrainSGD(const std::vector<int> &units, std::vector<RealT> &w, const std::vector<RealT> &C);
    
@@ -2,6 +2,16 @@
 // OptimizationWrapper.ipp
 //////////////////////////////////////////////////////////////////////
 
+//////////////////////////////////////////////////////////////////////
+// TrainingCache<RealT>::~TrainingCache()
+//
+// Destructor, defined out of line as it is too large to inline.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+TrainingCache<RealT>::~TrainingCache()
+{}
+
 //////////////////////////////////////////////////////////////////////
 // OptimizationWrapper<RealT>::OptimizationWrapper()
 //
@@ -56,26 +66,31 @@ void OptimizationWrapper<RealT>::PrintMessage(const std::string &s)
 // OptimizationWrapper<RealT>::Train()
 //
 // Run optimization algorithm with fixed regularization
-// constants.
+// constants.  If holdout units are given, their function value is
+// monitored for early stopping (see InnerOptimizationWrapperLBFGS).
 //////////////////////////////////////////////////////////////////////
 
 template<class RealT>
 RealT OptimizationWrapper<RealT>::Train(const std::vector<int> &units,
                                         std::vector<RealT> &w,
                                         std::vector<RealT> &weights_initial,
-                                        const std::vector<RealT> &C)
+                                        const std::vector<RealT> &C,
+                                        const std::vector<int> &holdout)
 {
-    static std::vector<int> cached_units;
-    static std::vector<RealT> cached_initial_w;
-    static std::vector<RealT> cached_C;
-    static std::vector<RealT> cached_learned_w;
-    static RealT cached_f;
+    std::vector<int> &cached_units = train_cache.units;
+    std::vector<int> &cached_holdout = train_cache.holdout;
+    std::vector<RealT> &cached_initial_w = train_cache.initial_w;
+    std::vector<RealT> &cached_C = train_cache.C;
+    std::vector<RealT> &cached_learned_w = train_cache.learned_w;
+    RealT &cached_f = train_cache.f;
 
     if (cached_units != units ||
+        cached_holdout != holdout ||
         cached_initial_w != w ||
         cached_C != C)
     {
         cached_units = units;
+        cached_holdout = holdout;
         cached_initial_w = w;
         cached_C = C;
         cached_learned_w = w;
@@ -92,6 +107,7 @@ RealT OptimizationWrapper<RealT>::Train(const std::vector<int> &units,
 
         if (GetOptions().GetBoolValue("viterbi_parsing"))
         {
+            if (holdout.size() > 0) Error("Early stopping is not supported for max-margin training.");
             std::vector<RealT> bias(w.size());
 
             
@@ -125,6 +141,7 @@ RealT OptimizationWrapper<RealT>::Train(const std::vector<int> &units,
         else
         {
             InnerOptimizationWrapperLBFGS<RealT> inner_optimization_wrapper(this, units, weights_initial, Ce);
+            inner_optimization_wrapper.LoadHoldout(holdout);
             
             cached_f = inner_optimization_wrapper.Minimize(cached_learned_w);
         }
@@ -141,6 +158,167 @@ RealT OptimizationWrapper<RealT>::Train(const std::vector<int> &units,
 }
 
 
+//////////////////////////////////////////////////////////////////////
+// OptimizationWrapper<RealT>::TrainWithEarlyStopping()
+//
+// Run optimization algorithm with fixed regularization constants on
+// part of the training data, stopping early based on the function
+// value over the rest.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+RealT OptimizationWrapper<RealT>::TrainWithEarlyStopping(const std::vector<int> &units,
+                                                         std::vector<RealT> &w,
+                                                         std::vector<RealT> &w0,
+                                                         const std::vector<RealT> &C)
+{
+    // split data into training and holdout sets
+    const RealT holdout_ratio = GetOptions().GetRealValue("holdout_ratio");
+    const std::vector<int> holdout(units.begin(), units.begin() + int(units.size() * holdout_ratio));
+    const std::vector<int> training(units.begin() + int(units.size() * holdout_ratio), units.end());
+
+    if (training.size() == 0 || holdout.size() == 0) 
+        Error("Not enough training samples for early stopping.");
+
+    PrintMessage(SPrintF("Training on %d examples, monitoring %d holdout examples every %d iterations...",
+                         int(training.size()), int(holdout.size()), GetOptions().GetIntValue("early_stop_interval")));
+    return Train(training, w, w0, C, holdout);
+}
+
+//////////////////////////////////////////////////////////////////////
+// OptimizationWrapper<RealT>::TrainIncremental()
+//
+// Run optimization algorithm with fixed regularization constants,
+// reusing per-example statistics from a previous run (see
+// ExampleStatistics).  If the statistics file does not exist yet,
+// all examples are trained on as usual.  Otherwise, stored examples
+// whose files are no longer among the training examples are dropped,
+// and only examples that are new or whose files have changed are
+// processed; every other stored example contributes its quadratic
+// approximation,
+// which together with the regularizer
+//
+//     0.5 * sum_j C[j] * (w[j] - w0[j])^2
+//
+// is again a diagonal quadratic, so it can be passed to the inner
+// optimizer as a regularizer with coefficients C + curvature,
+// centered at C * w0 / (C + curvature), plus a linear bias.  The
+// curvature is the same overestimate used for preconditioning, which
+// keeps the refreshed parameters conservatively close to the old
+// ones.  Afterwards, statistics for the processed examples are
+// computed at the new parameters and the file is rewritten.
+//////////////////////////////////////////////////////////////////////
+
+template<class RealT>
+RealT OptimizationWrapper<RealT>::TrainIncremental(const std::vector<int> &units,
+                                                   std::vector<RealT> &w,
+                                                   std::vector<RealT> &w0,
+                                                   const std::vector<RealT> &C,
+                                                   const std::string &statistics_filename)
+{
+    const RealT log_base = RealT(GetOptions().GetRealValue("log_base"));
+    const RealT hyperparam_data = RealT(GetOptions().GetRealValue("hyperparam_data"));
+    ExampleStatistics<RealT> statistics(GetParameterManager().GetNumLogicalParameters());
+
+    bool refresh;
+    {
+        std::ifstream infile(statistics_filename.c_str());
+        refresh = !infile.fail();
+    }
+    if (refresh)
+    {
+        statistics.Read(statistics_filename);
+        if (GetOptions().GetStringValue("train_initweights_filename") == "")
+            w = statistics.GetLastPoint();
+    }
+
+    // drop examples which are no longer in the training set
+    int num_dropped = 0;
+    if (refresh)
+    {
+        std::set<std::string> filenames;
+        for (size_t i = 0; i < units.size(); i++)
+            filenames.insert(GetDescriptions()[units[i]].input_filename);
+        num_dropped = statistics.Retain(filenames);
+        if (num_dropped > 0)
+            PrintMessage(SPrintF("Dropping statistics for %d examples no longer in the training set.", num_dropped));
+    }
+
+    // find examples which need processing
+    std::vector<int> new_units;
+    std::vector<unsigned int> new_checksums;
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        const std::string &filename = GetDescriptions()[units[i]].input_filename;
+        const unsigned int checksum = ExampleStatistics<RealT>::ComputeChecksum(filename);
+        if (refresh && statistics.IsCurrent(filename, checksum)) continue;
+        statistics.Remove(filename);
+        new_units.push_back(units[i]);
+        new_checksums.push_back(checksum);
+    }
+
+    if (new_units.size() == 0 && num_dropped == 0)
+    {
+        PrintMessage("No new or changed examples; keeping current parameters.");
+        return RealT(0);
+    }
+
+    RealT f;
+    if (!refresh)
+    {
+        f = Train(units, w, w0, C);
+    }
+    else
+    {
+        PrintMessage(SPrintF("Refreshing model with %d new or changed examples (%d stored examples)...",
+                             int(new_units.size()), statistics.GetNumExamples()));
+
+        std::vector<RealT> curvature, slope;
+        RealT constant;
+        statistics.ComputeApproximation(curvature, slope, constant);
+
+        const std::vector<RealT> Ce = GetParameterManager().ExpandParameterGroupValues(C);
+        const std::vector<RealT> combined = Ce + curvature;
+        std::vector<RealT> center(w.size());
+        for (size_t j = 0; j < w.size(); j++)
+        {
+            if (combined[j] > RealT(0)) center[j] = Ce[j] * w0[j] / combined[j];
+            constant += RealT(0.5) * (Ce[j] * w0[j] * w0[j] - combined[j] * center[j] * center[j]);
+        }
+
+        if (new_units.size() > 0)
+        {
+            InnerOptimizationWrapperLBFGS<RealT> inner_optimization_wrapper(this, new_units, center, combined);
+            inner_optimization_wrapper.LoadBias(slope);
+            f = inner_optimization_wrapper.Minimize(w) + constant;
+        }
+        else
+        {
+            // with examples only dropped, the objective is the diagonal
+            // quadratic alone, which is minimized directly
+            f = constant;
+            for (size_t j = 0; j < w.size(); j++)
+            {
+                if (combined[j] > RealT(0)) w[j] = center[j] - slope[j] / combined[j];
+                f += RealT(0.5) * combined[j] * (w[j] - center[j]) * (w[j] - center[j]) + slope[j] * w[j];
+            }
+        }
+    }
+
+    // save statistics for the processed examples
+    if (new_units.size() > 0)
+    {
+        const int point = statistics.AddPoint(w);
+        std::map<int, std::vector<RealT> > values = computation_wrapper.ComputeExampleStatisticsSE(new_units, w, log_base, hyperparam_data);
+        for (size_t i = 0; i < new_units.size(); i++)
+            statistics.AddExample(GetDescriptions()[new_units[i]].input_filename, new_checksums[i], point, values[new_units[i]]);
+    }
+    statistics.Write(statistics_filename);
+    PrintMessage(SPrintF("Wrote statistics for %d examples to %s.", statistics.GetNumExamples(), statistics_filename.c_str()));
+
+    return f;
+}
+
 //////////////////////////////////////////////////////////////////////
 // OptimizationWrapper<RealT>::TrainSGD()
 //
@@ -153,11 +331,11 @@ RealT OptimizationWrapper<RealT>::TrainSGD(const std::vector<int> &units,
                                            std::vector<RealT> &w,
                                            const std::vector<RealT> &C)
 {
-    static std::vector<int> cached_units;
-    static std::vector<RealT> cached_initial_w;
-    static std::vector<RealT> cached_C;
-    static std::vector<RealT> cached_learned_w;
-    static RealT cached_f;
+    std::vector<int> &cached_units = train_sgd_cache.units;
+    std::vector<RealT> &cached_initial_w = train_sgd_cache.initial_w;
+    std::vector<RealT> &cached_C = train_sgd_cache.C;
+    std::vector<RealT> &cached_learned_w = train_sgd_cache.learned_w;
+    RealT &cached_f = train_sgd_cache.f;
 
     if (cached_units != units ||
         cached_initial_w != w ||
@@ -230,11 +408,11 @@ RealT OptimizationWrapper<RealT>::TrainEM(const std::vector<int> &units,
                                         std::vector<RealT> &w,
                                         const std::vector<RealT> &C, const int train_max_iter)
 {
-    static std::vector<int> cached_units;
-    static std::vector<RealT> cached_initial_w;
-    static std::vector<RealT> cached_C;
-    static std::vector<RealT> cached_learned_w;
-    static RealT cached_f;
+    std::vector<int> &cached_units = train_em_cache.units;
+    std::vector<RealT> &cached_initial_w = train_em_cache.initial_w;
+    std::vector<RealT> &cached_C = train_em_cache.C;
+    std::vector<RealT> &cached_learned_w = train_em_cache.learned_w;
+    RealT &cached_f = train_em_cache.f;
 
     if (cached_units != units ||
         cached_initial_w != w ||
@@ -347,6 +525,9 @@ void OptimizationWrapper<RealT>::LearnHyperparameters(std::vector<int> units,
 
     std::vector<RealT> w0(w);
 
+    // optionally stop each training run early based on the holdout set
+    const std::vector<int> early_stop_holdout = (GetOptions().GetIntValue("early_stop_interval") > 0 ? holdout : std::vector<int>());
+
     // perform cross-validation
     for (int k = -5; k <= 10; k++)
     {
@@ -355,7 +536,7 @@ void OptimizationWrapper<RealT>::LearnHyperparameters(std::vector<int> units,
         PrintMessage(SPrintF("Performing optimization using C = %lf", C[0]));
         Indent();
         std::vector<RealT> x(w);
-        const RealT f = Train(training, x, w0, C);
+        const RealT f = Train(training, x, w0, C, early_stop_holdout);
         Unindent();
 
         // compute holdout loss
@@ -363,7 +544,7 @@ void OptimizationWrapper<RealT>::LearnHyperparameters(std::vector<int> units,
         if (GetOptions().GetBoolValue("viterbi_parsing")) Error("Cannot use logloss for cross validation if Viterbi parsing.");
         RealT loss = computation_wrapper.ComputeFunction(holdout, x, false, false, log_base, hyperparam_data);
 #else
-        RealT loss = computation_wrapper.ComputeLoss(holdout, x, true, log_base);
+        RealT loss = computation_wrapper.ComputeLoss(holdout, x, log_base);
 #endif
         
         PrintMessage(SPrintF("Using C = %lf, regularized training loss = %lf, holdout loss = %lf", double(C[0]), double(f), double(loss)));
@@ -443,7 +624,7 @@ void OptimizationWrapper<RealT>::LearnHyperparametersEM(std::vector<int> units,
         if (GetOptions().GetBoolValue("viterbi_parsing")) Error("Cannot use logloss for cross validation if Viterbi parsing.");
         RealT loss = computation_wrapper.ComputeFunction(holdout, x, false, false, log_base, hyperparam_data);
 #else
-        RealT loss = computation_wrapper.ComputeLoss(holdout, x, true, log_base);
+        RealT loss = computation_wrapper.ComputeLoss(holdout, x, log_base);
 #endif
         
         PrintMessage(SPrintF("Using C = %lf, regularized training loss = %lf, holdout loss = %lf", double(C[0]), double(f), double(loss)));
@@ -40,9 +40,10 @@ RealT OuterOptimizationWrapper<RealT>::ComputeFunction(const std::vector<RealT>
     
     // w = solution of OPT1 for current C
     std::vector<RealT> w = initial_w;
+    std::vector<RealT> w0 = initial_w;
     optimization_wrapper->PrintMessage("Solving OPT1...");
     optimization_wrapper->Indent();
-    optimization_wrapper->Train(training, w, Exp(log_C));
+    optimization_wrapper->Train(training, w, w0, Exp(log_C));
     optimization_wrapper->Unindent();
     
     // compute holdout logloss
@@ -80,9 +81,10 @@ void OuterOptimizationWrapper<RealT>::ComputeGradient(std::vector<RealT> &g, con
     
     // w = solution of OPT1 for current C
     std::vector<RealT> w = initial_w;
+    std::vector<RealT> w0 = initial_w;
     optimization_wrapper->PrintMessage("Solving OPT1...");
     optimization_wrapper->Indent();
-    optimization_wrapper->Train(training, w, C);
+    optimization_wrapper->Train(training, w, w0, C);
     optimization_wrapper->Unindent();
     
     // compute holdout logloss
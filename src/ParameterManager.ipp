@@ -11,9 +11,9 @@
 // Constructors and assignment operator.
 //////////////////////////////////////////////////////////////////////
 
-ParameterGroup::ParameterGroup() {}
+inline ParameterGroup::ParameterGroup() {}
 
-ParameterGroup::ParameterGroup(const std::string &name, int begin, int end) :
+inline ParameterGroup::ParameterGroup(const std::string &name, int begin, int end) :
     name(name),
     begin(begin),
     end(end)
@@ -21,7 +21,7 @@ ParameterGroup::ParameterGroup(const std::string &name, int begin, int end) :
     Assert(begin <= end, "Inconsistent begin and end indices.");
 }
 
-ParameterGroup::ParameterGroup(const ParameterGroup &rhs) :
+inline ParameterGroup::ParameterGroup(const ParameterGroup &rhs) :
     name(rhs.name),
     begin(rhs.begin),
     end(rhs.end)
@@ -29,7 +29,7 @@ ParameterGroup::ParameterGroup(const ParameterGroup &rhs) :
     Assert(begin <= end, "Inconsistent begin and end indices.");
 }
 
-ParameterGroup &ParameterGroup::operator=(const ParameterGroup &rhs)
+inline ParameterGroup &ParameterGroup::operator=(const ParameterGroup &rhs)
 {
     if (this != &rhs)
     {
@@ -2,6 +2,7 @@
 // SStruct.cpp
 //////////////////////////////////////////////////////////////////////
 
+#include <charconv>
 #include "SStruct.hpp"
 
 enum FileFormat
@@ -21,6 +22,66 @@ const double SStruct::UNKNOWN_POTENTIAL = -1;
 
 const double THRESH_NO_DATA = 1e-5;
 
+//////////////////////////////////////////////////////////////////////
+// class TokenBuffer
+//
+// Tokenizer for the BPSEQ-style loaders over the in-memory contents
+// of a file.  Tokens are whitespace-separated [begin,end) ranges into
+// the contents and numbers are parsed straight from them, so reading
+// a file allocates nothing beyond the contents themselves.
+// As with ConvertToNumber(), a number may be followed by other
+// characters within its token.
+//////////////////////////////////////////////////////////////////////
+
+class TokenBuffer
+{
+    const std::string &contents;
+    const char *pos;
+    const char *end;
+
+    template<class T>
+    bool ParseNumber(const char *begin, T &val) const
+    {
+        if (begin < token_end && *begin == '+') ++begin;
+        const std::from_chars_result result = std::from_chars(begin, token_end, val);
+        return result.ec == std::errc() && result.ptr != begin;
+    }
+
+public:
+
+    const char *token_begin;
+    const char *token_end;
+
+    TokenBuffer(const std::string &contents) :
+        contents(contents), pos(contents.data()), end(contents.data() + contents.length()),
+        token_begin(NULL), token_end(NULL)
+    {}
+
+    // number of lines, an upper bound on the number of rows
+    int CountLines() const
+    {
+        return int(std::count(contents.begin(), contents.end(), '\n')) + 1;
+    }
+
+    // advance to the next token; returns false at end of file
+    bool Next()
+    {
+        while (pos != end && isspace((unsigned char) *pos)) ++pos;
+        if (pos == end) return false;
+        token_begin = pos;
+        while (pos != end && !isspace((unsigned char) *pos)) ++pos;
+        token_end = pos;
+        return true;
+    }
+
+    int Length() const { return int(token_end - token_begin); }
+
+    // parse a number from the current token after skipping its
+    // first skip characters
+    bool Parse(int &val, int skip = 0) const { return ParseNumber(token_begin + skip, val); }
+    bool Parse(double &val, int skip = 0) const { return ParseNumber(token_begin + skip, val); }
+};
+
 //////////////////////////////////////////////////////////////////////
 // SStruct::SStruct()
 //
@@ -71,14 +132,18 @@ SStruct::SStruct(const std::string &filename)
 
 void SStruct::Load(const std::string &filename)
 {
+    // read (and if necessary decompress) the file once
+    std::string contents;
+    if (!ReadFileContents(filename, contents)) Error("Unable to open input file: %s", filename.c_str());
+
     // auto-detect file format and load file
-    switch (AnalyzeFormat(filename))
+    switch (AnalyzeFormat(contents))
     {
-        case FileFormat_FASTA: LoadFASTA(filename); break;
-        case FileFormat_RAW: LoadRAW(filename); break;
-        case FileFormat_BPSEQ: LoadBPSEQ(filename); break;
-        case FileFormat_BPP2TSEQ: LoadBPP2TSEQ(filename); break;
-        case FileFormat_BPP2SEQ: LoadBPP2SEQ(filename); break;
+        case FileFormat_FASTA: LoadFASTA(filename, contents); break;
+        case FileFormat_RAW: LoadRAW(filename, contents); break;
+        case FileFormat_BPSEQ: LoadBPSEQ(filename, contents); break;
+        case FileFormat_BPP2TSEQ: LoadBPP2TSEQ(filename, contents); break;
+        case FileFormat_BPP2SEQ: LoadBPP2SEQ(filename, contents); break;
         default: Error("Unable to determine file type.");
     }
 
@@ -90,21 +155,72 @@ void SStruct::Load(const std::string &filename)
     ValidateMapping(mapping);
 }
 
+//////////////////////////////////////////////////////////////////////
+// SStruct::LoadFromSequence()
+//
+// Create object from an in-memory sequence.  Behaves like LoadRAW()
+// except that no file is read; the sequence has no secondary
+// structure and no evidence.
+//////////////////////////////////////////////////////////////////////
+
+void SStruct::LoadFromSequence(const std::string &name, const std::string &sequence, const int num_data_sources)
+{
+    // clear any previous data
+    std::vector<std::string>().swap(names);
+    std::vector<std::string>().swap(sequences);
+    std::vector<int>().swap(mapping);
+    std::vector<std::vector<double> >().swap(unpaired_potentials);
+    std::vector<bool>().swap(which_evidence);
+    this->num_data_sources = num_data_sources;
+    has_struct = false;
+
+    // initialize
+    names.push_back(name);
+    sequences.push_back("@");
+    for (size_t i = 0; i < sequence.length(); i++)
+    {
+        if (isspace(sequence[i])) continue;
+        sequences.back() += sequence[i];
+    }
+
+    // sanity-checks
+    if (sequences[0].length() == 1) Error("Zero-length sequence read.");
+
+    // initialize empty secondary structure
+    mapping.resize(sequences[0].length(), UNKNOWN);
+    
+    // initialize unknown unpairedness potentials
+    for (int i = 0; i < num_data_sources; i++)
+        unpaired_potentials.push_back(std::vector<double>(sequences[0].length(), UNKNOWN_POTENTIAL));
+    which_evidence.resize(num_data_sources,false);
+    has_evidence = false;
+
+    // perform character conversions
+    sequences[0] = FilterSequence(sequences[0]);
+}
+
 //////////////////////////////////////////////////////////////////////
 // SStruct::AnalyzeFormat()
 //
 // Determine file format.
 //////////////////////////////////////////////////////////////////////
 
-int SStruct::AnalyzeFormat(const std::string &filename) const
+int SStruct::AnalyzeFormat(const std::string &contents) const
 {
-    std::ifstream data(filename.c_str());
-    if (data.fail()) Error(("Unable to open input file: " + filename).c_str());
-    
     // look for first non-blank line
     std::string s;
-    while (std::getline(data, s))
-        if (s.length() > 0) break;
+    size_t begin = 0;
+    while (begin < contents.length())
+    {
+        size_t end = contents.find('\n', begin);
+        if (end == std::string::npos) end = contents.length();
+        if (end > begin)
+        {
+            s = contents.substr(begin, end - begin);
+            break;
+        }
+        begin = end + 1;
+    }
     
     // analyze to determine file format
     FileFormat format;
@@ -131,8 +247,6 @@ int SStruct::AnalyzeFormat(const std::string &filename) const
         else
             format = FileFormat_RAW;
     }
-    
-    data.close();
 
     return format;
 }
@@ -145,7 +259,7 @@ int SStruct::AnalyzeFormat(const std::string &filename) const
 // may be provided as one of the sequences in the file.
 //////////////////////////////////////////////////////////////////////
 
-void SStruct::LoadFASTA(const std::string &filename)
+void SStruct::LoadFASTA(const std::string &filename, const std::string &contents)
 {
     // clear any previous data
     std::vector<std::string>().swap(names);
@@ -154,9 +268,8 @@ void SStruct::LoadFASTA(const std::string &filename)
     std::vector<std::vector<double> >().swap(unpaired_potentials);
     std::vector<bool>().swap(which_evidence);
 
-    // open file for reading
-    std::ifstream data(filename.c_str());
-    if (data.fail()) Error("Unable to open input file: %s", filename.c_str());
+    // read file contents line by line
+    std::istringstream data(contents);
 
     // process sequences
     std::string s;
@@ -241,7 +354,7 @@ void SStruct::LoadFASTA(const std::string &filename)
 // one sequence is provided, with no secondary structure.
 //////////////////////////////////////////////////////////////////////
 
-void SStruct::LoadRAW(const std::string &filename)
+void SStruct::LoadRAW(const std::string &filename, const std::string &contents)
 {
     // clear any previous data
     std::vector<std::string>().swap(names);
@@ -254,9 +367,8 @@ void SStruct::LoadRAW(const std::string &filename)
     names.push_back(filename);
     sequences.push_back("@");
 
-    // open file for reading
-    std::ifstream data(filename.c_str());
-    if (data.fail()) Error("Unable to open input file: %s", filename.c_str());
+    // read file contents line by line
+    std::istringstream data(contents);
     
     // now retrieve sequence data    
     std::string s;
@@ -294,7 +406,7 @@ void SStruct::LoadRAW(const std::string &filename)
 // base-pairing '-1'.
 //////////////////////////////////////////////////////////////////////
 
-void SStruct::LoadBPSEQ(const std::string &filename)
+void SStruct::LoadBPSEQ(const std::string &filename, const std::string &contents)
 {
     // clear any previous data
     std::vector<std::string>().swap(names);
@@ -308,31 +420,32 @@ void SStruct::LoadBPSEQ(const std::string &filename)
     sequences.push_back("@");
     mapping.push_back(UNKNOWN);
 
-    // open file
-    std::ifstream data(filename.c_str());
-    if (data.fail()) Error("Unable to open input file: %s", filename.c_str());
+    // tokenize file contents
+    TokenBuffer data(contents);
+    const int max_rows = data.CountLines();
+    sequences.back().reserve(max_rows+1);
+    mapping.reserve(max_rows+1);
 
     // process file
-    std::string token;
     int row = 0;
-    while (data >> token)
+    while (data.Next())
     {
         // read row        
         int index = 0;
-        if (!ConvertToNumber(token, index)) Error("Could not read row number: %s", filename.c_str());
+        if (!data.Parse(index)) Error("Could not read row number: %s", filename.c_str());
         if (index <= 0) Error("Row numbers must be positive: %s", filename.c_str());
         if (index != row+1) Error("Rows of BPSEQ file must occur in increasing order: %s", filename.c_str());
         row = index;
 
         // read sequence letter
-        if (!(data >> token)) Error("Expected sequence letter after row number: %s", filename.c_str());
-        if (token.length() != 1) Error("Expected sequence letter after row number: %s", filename.c_str());      
-        char ch = token[0];
+        if (!data.Next()) Error("Expected sequence letter after row number: %s", filename.c_str());
+        if (data.Length() != 1) Error("Expected sequence letter after row number: %s", filename.c_str());      
+        char ch = data.token_begin[0];
 
         // read mapping        
         int maps_to = 0;
-        if (!(data >> token)) Error("Expected mapping after sequence letter: %s", filename.c_str());
-        if (!ConvertToNumber(token, maps_to)) Error("Could not read matching row number: %s", filename.c_str());
+        if (!data.Next()) Error("Expected mapping after sequence letter: %s", filename.c_str());
+        if (!data.Parse(maps_to)) Error("Could not read matching row number: %s", filename.c_str());
         if (maps_to < -1) Error("Matching row numbers must be greater than or equal to -1: %s", filename.c_str());
 
         sequences.back().push_back(ch);
@@ -357,7 +470,7 @@ void SStruct::LoadBPSEQ(const std::string &filename)
 // Potentials for the unpairedness of a nucleotide should be positive.
 ////////////////////////////////////////////////////////////////////////////
 
-void SStruct::LoadBPP2SEQ(const std::string &filename)
+void SStruct::LoadBPP2SEQ(const std::string &filename, const std::string &contents)
 {
     // clear any previous data
     std::vector<std::string>().swap(names);
@@ -371,40 +484,40 @@ void SStruct::LoadBPP2SEQ(const std::string &filename)
     sequences.push_back("@");
     mapping.push_back(UNKNOWN);
 
-    // open file
-    std::ifstream data(filename.c_str());
-    if (data.fail()) Error("Unable to open input file: %s", filename.c_str());
+    // tokenize file contents
+    TokenBuffer data(contents);
+    const int max_rows = data.CountLines();
+    sequences.back().reserve(max_rows+1);
 
     // process file
-    std::string token;
     int row = 0;
 
     which_evidence.resize(num_data_sources,false);
     int num_data_sources_local = 0;
     for (int i = 0; i < num_data_sources; i++) {
-        std::vector<double> unpaired_potentials_current;
-        unpaired_potentials.push_back(unpaired_potentials_current);
+        unpaired_potentials.push_back(std::vector<double>());
+        unpaired_potentials.back().reserve(max_rows);
     }
     
-    while (data >> token)
+    while (data.Next())
     {
         // read row        
         int index = 0;
-        if (!ConvertToNumber(token, index)) Error("Could not read row number: %s", filename.c_str());
+        if (!data.Parse(index)) Error("Could not read row number: %s", filename.c_str());
         if (index <= 0) Error("Row numbers must be positive: %s", filename.c_str());
         if (index != row+1) Error("Rows of BPSEQ file must occur in increasing order: %s", filename.c_str());
         row = index;
 
         // read sequence letter
-        if (!(data >> token)) Error("Expected sequence letter after row number: %s", filename.c_str());
-        if (token.length() != 1) Error("Expected sequence letter after row number: %s", filename.c_str());      
-        char ch = token[0];
+        if (!data.Next()) Error("Expected sequence letter after row number: %s", filename.c_str());
+        if (data.Length() != 1) Error("Expected sequence letter after row number: %s", filename.c_str());      
+        char ch = data.token_begin[0];
         
         // read the "e" letter
-        if (!(data >> token)) Error("Expected 'e' after sequence letter: %s", filename.c_str());
-        if (token.substr(0,1) != "e") Error("Expected 'e' after sequence letter: %s", filename.c_str());
+        if (!data.Next()) Error("Expected 'e' after sequence letter: %s", filename.c_str());
+        if (data.token_begin[0] != 'e') Error("Expected 'e' after sequence letter: %s", filename.c_str());
 
-        bool success = ConvertToNumber(token.substr(1,token.length()),num_data_sources_local);
+        bool success = data.Parse(num_data_sources_local, 1);
 	if (!success)
             Error("Number of data sources must be an integer!");
         if (num_data_sources != num_data_sources_local)
@@ -414,8 +527,8 @@ void SStruct::LoadBPP2SEQ(const std::string &filename)
         {
             // read probing data
             double potential;
-            if (!(data >> token)) Error("Expected unpaired potential after sequence letter: %s", filename.c_str());
-            if (!ConvertToNumber(token, potential)) Error("Could not read unpaired potential: %s", filename.c_str());
+            if (!data.Next()) Error("Expected unpaired potential after sequence letter: %s", filename.c_str());
+            if (!data.Parse(potential)) Error("Could not read unpaired potential: %s", filename.c_str());
             
             unpaired_potentials[i].push_back(potential);
 
@@ -451,7 +564,7 @@ void SStruct::LoadBPP2SEQ(const std::string &filename)
 // Potentials for the unpairedness of a nucleotide should be positive.
 ////////////////////////////////////////////////////////////////////////////////
 
-void SStruct::LoadBPP2TSEQ(const std::string &filename)
+void SStruct::LoadBPP2TSEQ(const std::string &filename, const std::string &contents)
 {
     // clear any previous data
     std::vector<std::string>().swap(names);
@@ -465,40 +578,41 @@ void SStruct::LoadBPP2TSEQ(const std::string &filename)
     sequences.push_back("@");
     mapping.push_back(UNKNOWN);
 
-    // open file
-    std::ifstream data(filename.c_str());
-    if (data.fail()) Error("Unable to open input file: %s", filename.c_str());
+    // tokenize file contents
+    TokenBuffer data(contents);
+    const int max_rows = data.CountLines();
+    sequences.back().reserve(max_rows+1);
+    mapping.reserve(max_rows+1);
 
     // process file
-    std::string token;
     int row = 0;
 
     which_evidence.resize(num_data_sources,false);
     int num_data_sources_local = 0;
     for (int i = 0; i < num_data_sources; i++) {
-        std::vector<double> unpaired_potentials_current;
-        unpaired_potentials.push_back(unpaired_potentials_current);
+        unpaired_potentials.push_back(std::vector<double>());
+        unpaired_potentials.back().reserve(max_rows);
     }
 
-    while (data >> token)
+    while (data.Next())
     {
         // read row        
         int index = 0;
-        if (!ConvertToNumber(token, index)) Error("Could not read row number: %s", filename.c_str());
+        if (!data.Parse(index)) Error("Could not read row number: %s", filename.c_str());
         if (index <= 0) Error("Row numbers must be positive: %s", filename.c_str());
         if (index != row+1) Error("Rows of BPSEQ file must occur in increasing order: %s", filename.c_str());
         row = index;
 
         // read sequence letter
-        if (!(data >> token)) Error("Expected sequence letter after row number: %s", filename.c_str());
-        if (token.length() != 1) Error("Expected sequence letter after row number: %s", filename.c_str());      
-        char ch = token[0];
+        if (!data.Next()) Error("Expected sequence letter after row number: %s", filename.c_str());
+        if (data.Length() != 1) Error("Expected sequence letter after row number: %s", filename.c_str());      
+        char ch = data.token_begin[0];
 
         // read the "t" letter
-        if (!(data >> token)) Error("Expected 't' after sequence letter: %s", filename.c_str());
-        if (token.substr(0,1) != "t") Error("Expected 't' after sequence letter: %s", filename.c_str());
+        if (!data.Next()) Error("Expected 't' after sequence letter: %s", filename.c_str());
+        if (data.token_begin[0] != 't') Error("Expected 't' after sequence letter: %s", filename.c_str());
 
-        bool success = ConvertToNumber(token.substr(1,token.length()),num_data_sources_local);
+        bool success = data.Parse(num_data_sources_local, 1);
 	if (!success)
             Error("Number of data sources must be an integer!");
         if (num_data_sources != num_data_sources_local)
@@ -508,8 +622,8 @@ void SStruct::LoadBPP2TSEQ(const std::string &filename)
         {
             // read probing data
             double potential;
-            if (!(data >> token)) Error("Expected unpaired potential after sequence letter: %s", filename.c_str());
-            if (!ConvertToNumber(token, potential)) Error("Could not read unpaired potential: %s", filename.c_str());
+            if (!data.Next()) Error("Expected unpaired potential after sequence letter: %s", filename.c_str());
+            if (!data.Parse(potential)) Error("Could not read unpaired potential: %s", filename.c_str());
             
             unpaired_potentials[i].push_back(potential);
 
@@ -520,8 +634,8 @@ void SStruct::LoadBPP2TSEQ(const std::string &filename)
         
         // read mapping        
         int maps_to = 0;
-        if (!(data >> token)) Error("Expected mapping after sequence letter: %s", filename.c_str());
-        if (!ConvertToNumber(token, maps_to)) Error("Could not read matching row number: %s", filename.c_str());
+        if (!data.Next()) Error("Expected mapping after sequence letter: %s", filename.c_str());
+        if (!data.Parse(maps_to)) Error("Could not read matching row number: %s", filename.c_str());
         if (maps_to < -1) Error("Matching row numbers must be greater than or equal to -1: %s", filename.c_str());
 
         sequences.back().push_back(ch);
@@ -34,14 +34,14 @@ class SStruct
     std::vector<bool> which_evidence;
 
     // automatic file format detection
-    int AnalyzeFormat(const std::string &filename) const;
+    int AnalyzeFormat(const std::string &contents) const;
 
-    // load file of a particular file format
-    void LoadFASTA(const std::string &filename);
-    void LoadRAW(const std::string &filename);
-    void LoadBPSEQ(const std::string &filename);
-    void LoadBPP2SEQ(const std::string &filename);
-    void LoadBPP2TSEQ(const std::string &filename);
+    // load file of a particular file format from its contents
+    void LoadFASTA(const std::string &filename, const std::string &contents);
+    void LoadRAW(const std::string &filename, const std::string &contents);
+    void LoadBPSEQ(const std::string &filename, const std::string &contents);
+    void LoadBPP2SEQ(const std::string &filename, const std::string &contents);
+    void LoadBPP2TSEQ(const std::string &filename, const std::string &contents);
 
     // perform standard character conversions for RNA sequence and structures
     std::string FilterSequence(std::string sequence) const;
@@ -75,6 +75,9 @@ public:
     // load sequence and struture from file
     void Load(const std::string &filename);
 
+    // load a single unstructured sequence held in memory
+    void LoadFromSequence(const std::string &name, const std::string &sequence, const int num_data_sources = 1);
+
     // assignment operator
     const SStruct& operator=(const SStruct &rhs);
 
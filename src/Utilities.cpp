@@ -3,6 +3,14 @@
 //////////////////////////////////////////////////////////////////////
 
 #include "Utilities.hpp"
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#ifdef GZIP_INPUT
+#include <zlib.h>
+#endif
 
 bool toggle_error = false;
 
@@ -315,6 +323,47 @@ double GetSystemTime()
     return t.tv_sec + 1e-6 * t.tv_usec;
 }
 
+//////////////////////////////////////////////////////////////////////
+// PinToCore()
+//
+// Bind the calling thread to one core.  Under Linux's default
+// first-touch policy, memory subsequently touched by the thread is
+// then allocated on that core's NUMA node.
+//////////////////////////////////////////////////////////////////////
+
+bool PinToCore(int core)
+{
+#ifdef __linux__
+    const long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (core < 0) core = sched_getcpu();
+    if (num_cores <= 0 || core < 0) return false;
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(int(core % num_cores), &mask);
+    return sched_setaffinity(0, sizeof(mask), &mask) == 0;
+#else
+    return false;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+// AdviseHugePages()
+//
+// Request transparent huge pages for the whole huge pages contained
+// in [ptr, ptr+bytes).  Has no effect on regions smaller than a huge
+// page or on systems without madvise(MADV_HUGEPAGE).
+//////////////////////////////////////////////////////////////////////
+
+void AdviseHugePages(void *ptr, size_t bytes)
+{
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    const size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+    const size_t begin = (reinterpret_cast<size_t>(ptr) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    const size_t end = (reinterpret_cast<size_t>(ptr) + bytes) & ~(HUGE_PAGE_SIZE - 1);
+    if (begin < end) madvise(reinterpret_cast<void *>(begin), end - begin, MADV_HUGEPAGE);
+#endif
+}
+
 //////////////////////////////////////////////////////////////////////
 // MakeDirectory()
 //
@@ -357,6 +406,56 @@ std::string MakeTempDirectory()
     return res;
 }
 
+//////////////////////////////////////////////////////////////////////
+// ReadFileContents()
+//
+// Read an entire file into memory.  When built with GZIP_INPUT, the
+// file is read through zlib, which inflates gzip data on the fly and
+// passes uncompressed files through unchanged, so compressed inputs
+// never have to be staged on disk.
+//////////////////////////////////////////////////////////////////////
+
+bool ReadFileContents(const std::string &filename, std::string &contents)
+{
+    contents.clear();
+
+#ifdef GZIP_INPUT
+    const size_t CHUNK_SIZE = size_t(1) << 17;
+    gzFile data = gzopen(filename.c_str(), "rb");
+    if (!data) return false;
+    gzbuffer(data, unsigned(CHUNK_SIZE));
+
+    size_t size = 0;
+    while (true)
+    {
+        contents.resize(size + CHUNK_SIZE);
+        const int bytes_read = gzread(data, &contents[size], unsigned(CHUNK_SIZE));
+        if (bytes_read < 0) break;
+        size += size_t(bytes_read);
+        if (bytes_read < int(CHUNK_SIZE)) break;
+    }
+    contents.resize(size);
+
+    // short reads also signal corrupt or truncated gzip data
+    int errnum;
+    const char *message = gzerror(data, &errnum);
+    if (errnum != Z_OK) Error("Unable to read input file: %s", message);
+    gzclose(data);
+#else
+    std::ifstream data(filename.c_str(), std::ios::binary);
+    if (data.fail()) return false;
+    std::ostringstream oss;
+    oss << data.rdbuf();
+    contents = oss.str();
+    if (contents.length() >= 2 && BYTE(contents[0]) == 0x1f && BYTE(contents[1]) == 0x8b)
+        Error("Input file is gzip-compressed but gzip support was not compiled in (see GZIP_INPUT): %s", filename.c_str());
+#endif
+
+    if (contents.length() >= 4 && BYTE(contents[0]) == 0x28 && BYTE(contents[1]) == 0xb5 && BYTE(contents[2]) == 0x2f && BYTE(contents[3]) == 0xfd)
+        Error("Zstandard-compressed input is not supported; recompress with gzip: %s", filename.c_str());
+    return true;
+}
+
 //////////////////////////////////////////////////////////////////////
 // GetSequencePositions()
 //
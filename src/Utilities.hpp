@@ -85,12 +85,26 @@ void WriteProgressMessage(const std::string &message);
 // retrieve system time in seconds past the Epoch
 double GetSystemTime();
 
+// bind the calling thread to a single core (chosen modulo the
+// number of online cores, or the core it is running on if core < 0)
+// so that its memory stays on the local NUMA node; returns false if
+// affinity is not supported
+bool PinToCore(int core);
+
+// hint that a large, page-aligned region should use transparent
+// huge pages; must be called before the region is first touched
+void AdviseHugePages(void *ptr, size_t bytes);
+
 // make a directory if one doesn't exist
 void MakeDirectory(const std::string &directory);
 
 // make temporary directory
 std::string MakeTempDirectory();
 
+// read an entire file into memory, decompressing gzip input
+// transparently; returns false if the file cannot be opened
+bool ReadFileContents(const std::string &filename, std::string &contents);
+
 // return an array whose ith element is the index of the ith
 // letter in the input string.
 std::vector<int> GetSequencePositions(const std::string &s);